@@ -1,4 +1,12 @@
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
 #include "Application.h"
+#include "fs_sweep.h"
 
 #if defined(_WIN32) || defined(_WIN64)
 
@@ -10,12 +18,39 @@
 
 #endif
 
-bool Application::init() {
-	if (init_RealSense() == false) return false;
-	if (init_FindSurface() == false) return false;
+// the devices (which block until they stream) and the FindSurface context are brought up on background tasks
+// while the window and the GL resources are created; they join where the sizes of the images are needed.
+bool Application::init(const char* rig_config, bool headless) {
+	this->headless = headless;
+	startup_begin = scapture::Now();
+
+	double devices_ms = 0.0;
+	std::future<bool> realsense = std::async(std::launch::async, [this, rig_config, &devices_ms]() {
+		bool ok = init_RealSense(rig_config);
+		devices_ms = scapture::Now() - startup_begin;
+		return ok;
+	});
+	std::future<bool> findsurface = std::async(std::launch::async, [this]() { return init_FindSurface(); });
+
+	if (!headless && !(use_offscreen ? init_offscreen() : init_window())) return false;
+	double window_ms = scapture::Now() - startup_begin;
+
+	bool ok = realsense.get();
+	if (!findsurface.get() || !ok) return false;
 
 	init_data();
+	ply_writer.start();
+	if (!headless) {
+		allocate_images();
+		if (!use_offscreen) rig.on_arrival([]() { glfwPostEmptyEvent(); }); // wakes up run() (thread-safe)
+	}
 
+	if (headless) fprintf(stderr, "Startup: %.0f ms.\n", scapture::Now() - startup_begin);
+	else fprintf(stderr, "Startup: %.0f ms (devices %.0f ms, window and OpenGL %.0f ms, in parallel).\n", scapture::Now() - startup_begin, devices_ms, window_ms);
+	return true;
+}
+
+bool Application::init_window() {
 	glfwInit();
 
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
@@ -29,6 +64,8 @@ bool Application::init() {
 	glfwSetCursorPosCallback(window, [](GLFWwindow* w, double x, double y) {reinterpret_cast<Application*>(glfwGetWindowUserPointer(w))->on_cursor_pos(w, x, y); });
 	glfwSetKeyCallback(window, [](GLFWwindow* w, int k, int s, int a, int m) {reinterpret_cast<Application*>(glfwGetWindowUserPointer(w))->on_key(w, k, s, a, m); });
 	glfwSetScrollCallback(window, [](GLFWwindow* w, double x, double y) {reinterpret_cast<Application*>(glfwGetWindowUserPointer(w))->on_wheel(w, x, y); });
+	glfwSetFramebufferSizeCallback(window, [](GLFWwindow* w, int, int) {reinterpret_cast<Application*>(glfwGetWindowUserPointer(w))->redraw = true; });
+	glfwSetWindowRefreshCallback(window, [](GLFWwindow* w) {reinterpret_cast<Application*>(glfwGetWindowUserPointer(w))->redraw = true; });
 		
 	glfwMakeContextCurrent(window);
 
@@ -43,30 +80,77 @@ bool Application::init() {
 	return true;
 }
 
-bool Application::init_RealSense() {
+bool Application::init_offscreen() {
+	if (!offscreen.create(width, height)) return false;
+
+	init_OpenGL();
+	object_inset.screen = offscreen.framebuffer;
+
+	return true;
+}
+
+void Application::framebuffer_size(int& width, int& height) {
+	if (window) glfwGetFramebufferSize(window, &width, &height);
+	else {
+		width = offscreen.width;
+		height = offscreen.height;
+	}
+}
+
+bool Application::init_RealSense(const char* rig_config) {
 	rs::log_to_console(rs::log_severity::warn);
 
-	if (ctx.get_device_count() == 0) {
+	if (rig_config == nullptr && ctx.get_device_count() == 0) {
 		fprintf(stderr, "RealSense: there is no RealSense device connected.\n");
 		return false;
 	}
 
-	dev = ctx.get_device(0);
-	dev->enable_stream(rs::stream::depth, rs::preset::best_quality);
-	dev->enable_stream(rs::stream::color, rs::preset::best_quality);
-	dev->start();
+	if (rig.init(ctx, rig_config) == false) return false;
+
+	const scapture::Source& reference = rig.reference();
+	depth_intrin = reference.depth_intrin;
+	color_to_depth = reference.color_to_depth;
+	color_intrin = reference.color_intrin;
 
-	depth_intrin = dev->get_stream_intrinsics(rs::stream::depth);
-	depth_to_color = dev->get_extrinsics(rs::stream::depth, rs::stream::rectified_color);
-	color_to_depth = dev->get_extrinsics(rs::stream::rectified_color, rs::stream::depth);
-	color_intrin = dev->get_stream_intrinsics(rs::stream::rectified_color);
-	scale = dev->get_depth_scale();
+	rig.start();
 
 	return true;
 }
 
 void Application::release_RealSense() {
-	dev->stop();
+	rig.stop();
+}
+
+bool Application::switch_profile(int index) {
+	const std::vector<scapture::StreamProfile>& profiles = rig.profiles();
+	if (profiles.empty()) {
+		fprintf(stderr, "Profile: the reference source cannot switch its stream profile.\n");
+		return false;
+	}
+
+	int current = rig.profile();
+	if (!rig.set_profile(index)) return false;
+	fprintf(stderr, "Profile: %s -> %s.\n", current >= 0 ? profiles[current].name().c_str() : "default", profiles[index].name().c_str());
+	profile_controller.reset();
+	return true;
+}
+
+// the frames of the new profile have arrived: the buffers and the color texture take their sizes.
+void Application::apply_profile() {
+	depth_intrin = rig.merged_depth_intrin();
+	color_intrin = rig.merged_color_intrin();
+	init_data();
+
+	if (!headless) allocate_images();
+
+	latency.reset_interval();
+	fprintf(stderr, "Profile: depth %dx%d, color %dx%d.\n", depth_intrin.width, depth_intrin.height, color_intrin.width, color_intrin.height);
+}
+
+void Application::set_latency_budget(double ms) {
+	profile_controller.budget = ms;
+	profile_controller.reset();
+	adaptive_profile = true;
 }
 
 bool Application::init_FindSurface() {
@@ -77,9 +161,7 @@ bool Application::init_FindSurface() {
 	}
 
 	// initialize parameters (not mandatory, but recommended)
-	setFindSurfaceParamFloat(fs, FS_PARAMS::FS_PARAM_ACCURACY, 0.003f);
-	setFindSurfaceParamFloat(fs, FS_PARAMS::FS_PARAM_MEAN_DIST, 0.01f);
-	setFindSurfaceParamFloat(fs, FS_PARAMS::FS_PARAM_TOUCH_R, 0.045f);
+	fs_params.apply(fs);
 
 	return true;
 }
@@ -102,30 +184,48 @@ void Application::init_OpenGL() {
 
 	ShaderSource::init();
 
-	// vertex data array
-	std::vector<smath::float3> sphere_vertex_data;
-	std::vector<unsigned int> sphere_index_data;
-	sgeometry::CreateSphereVertexData(sphere_vertex_data, sphere_index_data, 3);
+	// programs: every one is begun before any is waited for, so that the driver may compile them in parallel.
+	struct { sgl::Program& program; const char* name; const char* fragment; } program_sources[] = { // fragment: if not the one of the name
+		{ plane_renderer.program, "plane" }, { sphere_renderer.program, "sphere" }, { cylinder_renderer.program, "cylinder" },
+		{ cone_renderer.program, "cone" }, { torus_renderer.program, "torus" }, { impostor_renderer.program, "impostor" },
+		{ depth_renderer.program, "point_cloud" }, { image_renderer.program, "color" }, { object_inset.program, "inset" },
+		{ shaded_programs[0], "sphere", "mesh_shaded" }, { shaded_programs[1], "cylinder", "mesh_shaded" }, { shaded_programs[2], "cone", "mesh_shaded" }
+	};
+	double t0 = scapture::Now();
+	for (auto& p : program_sources) p.program.Begin(ShaderSource::vs_src[p.name], ShaderSource::fs_src[p.fragment ? p.fragment : p.name]);
+	int cached = 0;
+	for (auto& p : program_sources) cached += p.program.End();
+	fprintf(stderr, "OpenGL: %d programs in %.1f ms (%d from the cache).\n", int(sizeof(program_sources) / sizeof(program_sources[0])), scapture::Now() - t0, cached);
+
+	// vertex data array: every level of detail of every primitive is packed into one vertex and one index array.
+	std::vector<smath::float3> geometry_vertex_data;
+	std::vector<unsigned int> geometry_index_data;
 
-	std::vector<smath::float3> cylinder_vertex_data;
-	std::vector<unsigned int> cylinder_index_data;
-	sgeometry::CreateCylinderVertexData(cylinder_vertex_data, cylinder_index_data);
+	auto pack = [&](const std::vector<smath::float3>& vertices, const std::vector<unsigned int>& indices) -> sgl::DrawElementsInstancedBaseVertexBaseInstance {
+		sgl::DrawElementsInstancedBaseVertexBaseInstance draw{ GL_TRIANGLES, GLsizei(indices.size()), GL_UNSIGNED_INT, reinterpret_cast<GLvoid*>(geometry_index_data.size() * sizeof(unsigned int)), GLint(geometry_vertex_data.size()) };
+		geometry_vertex_data.insert(geometry_vertex_data.end(), vertices.cbegin(), vertices.cend());
+		geometry_index_data.insert(geometry_index_data.end(), indices.cbegin(), indices.cend());
+		return draw;
+	};
 
-	std::vector<smath::float3> torus_vertex_data;
-	std::vector<unsigned int> torus_index_data;
-	sgeometry::CreateTorusVertexData(torus_vertex_data, torus_index_data);
+	for (int lod = 0; lod < sgeometry::LOD_COUNT; lod++) {
+		std::vector<smath::float3> vertices;
+		std::vector<unsigned int> indices;
 
-	std::vector<smath::float3> geometry_vertex_data;
-	geometry_vertex_data.reserve(sphere_vertex_data.size() + cylinder_vertex_data.size() + torus_vertex_data.size());
-	geometry_vertex_data.insert(geometry_vertex_data.end(), sphere_vertex_data.cbegin(), sphere_vertex_data.cend());
-	geometry_vertex_data.insert(geometry_vertex_data.end(), cylinder_vertex_data.cbegin(), cylinder_vertex_data.cend());
-	geometry_vertex_data.insert(geometry_vertex_data.end(), torus_vertex_data.cbegin(), torus_vertex_data.cend());
+		sgeometry::CreateSphereVertexData(vertices, indices, sgeometry::SPHERE_LOD[lod]);
+		sphere_renderer.draw[lod] = pack(vertices, indices);
+		vertices.clear(); indices.clear();
 
-	std::vector<unsigned int> geometry_index_data;
-	geometry_index_data.reserve(sphere_index_data.size() + cylinder_index_data.size() + torus_index_data.size());
-	geometry_index_data.insert(geometry_index_data.end(), sphere_index_data.cbegin(), sphere_index_data.cend());
-	geometry_index_data.insert(geometry_index_data.end(), cylinder_index_data.cbegin(), cylinder_index_data.cend());
-	geometry_index_data.insert(geometry_index_data.end(), torus_index_data.cbegin(), torus_index_data.cend());
+		sgeometry::CreateCylinderVertexData(vertices, indices, sgeometry::CYLINDER_SUBDIV[lod]);
+		cylinder_renderer.draw[lod] = pack(vertices, indices);
+		cone_renderer.draw[lod] = cylinder_renderer.draw[lod];
+		vertices.clear(); indices.clear();
+
+		sgeometry::CreateTorusVertexData(vertices, indices, sgeometry::TOROIDAL_SUBDIV[lod], sgeometry::POLOIDAL_SUBDIV[lod]);
+		torus_renderer.draw[lod] = pack(vertices, indices);
+
+		plane_renderer.draw[lod] = sgl::DrawArraysInstancedBaseInstance{ GL_TRIANGLES, 0, 6 };
+	}
 	
 	// vao, vbo, ibo for geometries
 	sgl::VertexArray geometry_vao;
@@ -143,45 +243,57 @@ void Application::init_OpenGL() {
 	geometry_ibo.Data(geometry_index_data.size(), sizeof(unsigned int), geometry_index_data.data(), GL_STATIC_DRAW);
 	geometry_ibo.Bind();
 
-	GLsizei sphere_vertex_count = GLsizei(sphere_vertex_data.size());
-	GLsizei sphere_index_count = GLsizei(sphere_index_data.size());
-	GLsizei cylinder_vertex_count = GLsizei(cylinder_vertex_data.size());
-	GLsizei cylinder_index_count = GLsizei(cylinder_index_data.size());
-	GLsizei torus_vertex_count = GLsizei(torus_vertex_data.size());
-	GLsizei torus_index_count = GLsizei(torus_index_data.size());
+	// vao for detected primitives: the shared geometry and the per-instance attributes
+	sgl::VertexArray primitive_vao;
+	primitive_vao.Init();
+	primitive_vao.Bind();
+
+	geometry_vbo.Bind();
+	primitive_vao.AttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+	geometry_ibo.Bind();
+
+	sgl::VertexBuffer instance_buffer;
+	instance_buffer.Init();
+	instance_buffer.Bind();
+	for (GLuint k = 0; k < 4; k++) {
+		primitive_vao.AttribPointer(2 + k, 4, GL_FLOAT, GL_FALSE, sizeof(PrimitiveInstance), reinterpret_cast<GLvoid*>(offsetof(PrimitiveInstance, model_matrix) + k * sizeof(smath::float4)));
+		primitive_vao.AttribDivisor(2 + k, 1);
+	}
+	primitive_vao.AttribPointer(6, 4, GL_FLOAT, GL_FALSE, sizeof(PrimitiveInstance), reinterpret_cast<GLvoid*>(offsetof(PrimitiveInstance, params)));
+	primitive_vao.AttribDivisor(6, 1);
+	primitive_vao.AttribPointer(7, 4, GL_FLOAT, GL_FALSE, sizeof(PrimitiveInstance), reinterpret_cast<GLvoid*>(offsetof(PrimitiveInstance, color)));
+	primitive_vao.AttribDivisor(7, 1);
+	primitive_vao.Bind(false);
 
 	// renderer
-	plane_renderer.program.Init(ShaderSource::vs_src["plane"], ShaderSource::fs_src["plane"]);
-	plane_renderer.vertex_array = geometry_vao;
+	plane_renderer.vertex_array = primitive_vao;
 	plane_renderer.position_buffer = geometry_vbo;
 	plane_renderer.index_buffer = geometry_ibo;
-	plane_renderer.draw = sgl::DrawArrays{ GL_TRIANGLES, 0, 6 };
+	plane_renderer.instance_buffer = instance_buffer;
 
-	sphere_renderer.program.Init(ShaderSource::vs_src["sphere"], ShaderSource::fs_src["sphere"]);
-	sphere_renderer.vertex_array = geometry_vao;
+	sphere_renderer.vertex_array = primitive_vao;
 	sphere_renderer.position_buffer = geometry_vbo;
 	sphere_renderer.index_buffer = geometry_ibo;
-	sphere_renderer.draw = sgl::DrawElementsBaseVertex{ GL_TRIANGLES, sphere_index_count, GL_UNSIGNED_INT, 0, 0 };
+	sphere_renderer.instance_buffer = instance_buffer;
 
-	cylinder_renderer.program.Init(ShaderSource::vs_src["cylinder"], ShaderSource::fs_src["cylinder"]);
-	cylinder_renderer.vertex_array = geometry_vao;
+	cylinder_renderer.vertex_array = primitive_vao;
 	cylinder_renderer.position_buffer = geometry_vbo;
 	cylinder_renderer.index_buffer = geometry_ibo;
-	cylinder_renderer.draw = sgl::DrawElementsBaseVertex{ GL_TRIANGLES, cylinder_index_count, GL_UNSIGNED_INT, reinterpret_cast<GLvoid*>(sphere_index_count * sizeof(unsigned int)), sphere_vertex_count };
+	cylinder_renderer.instance_buffer = instance_buffer;
 
-	cone_renderer.program.Init(ShaderSource::vs_src["cone"], ShaderSource::fs_src["cone"]);
-	cone_renderer.vertex_array = geometry_vao;
+	cone_renderer.vertex_array = primitive_vao;
 	cone_renderer.position_buffer = geometry_vbo;
 	cone_renderer.index_buffer = geometry_ibo;
-	cone_renderer.draw = cylinder_renderer.draw;
+	cone_renderer.instance_buffer = instance_buffer;
 
-	torus_renderer.program.Init(ShaderSource::vs_src["torus"], ShaderSource::fs_src["torus"]);
-	torus_renderer.vertex_array = geometry_vao;
+	torus_renderer.vertex_array = primitive_vao;
 	torus_renderer.position_buffer = geometry_vbo;
 	torus_renderer.index_buffer = geometry_ibo;
-	torus_renderer.draw = sgl::DrawElementsBaseVertex{ GL_TRIANGLES, torus_index_count, GL_UNSIGNED_INT, reinterpret_cast<GLvoid*>((sphere_index_count + cylinder_index_count) * sizeof(unsigned int)), sphere_vertex_count + cylinder_vertex_count };
+	torus_renderer.instance_buffer = instance_buffer;
+
+	impostor_renderer.vertex_array = primitive_vao;
+	impostor_renderer.draw = sgl::DrawArraysInstancedBaseInstance{ GL_TRIANGLES, 0, 6 };
 
-	depth_renderer.program.Init(ShaderSource::vs_src["point_cloud"], ShaderSource::fs_src["point_cloud"]);
 	depth_renderer.vertex_array.Init();
 	depth_renderer.vertex_array.Bind();
 	depth_renderer.position_buffer.Init();
@@ -190,6 +302,9 @@ void Application::init_OpenGL() {
 	depth_renderer.color_buffer.Init();
 	depth_renderer.color_buffer.Bind();
 	depth_renderer.vertex_array.AttribIPointer(1, 3, GL_UNSIGNED_BYTE, 0, 0);
+	depth_renderer.normal_buffer.Init();
+	depth_renderer.normal_buffer.Bind();
+	depth_renderer.vertex_array.AttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, 0);
 	depth_renderer.draw = sgl::DrawArrays{ GL_POINTS, 0, 0/*using position_buffer.count instead*/ };
 
 	inlier_renderer.program = depth_renderer.program;
@@ -203,22 +318,20 @@ void Application::init_OpenGL() {
 	inlier_renderer.vertex_array.AttribIPointer(1, 3, GL_UNSIGNED_BYTE, 0, 0);
 	inlier_renderer.draw = sgl::DrawArrays{ GL_POINTS, 0, 0/*using position_buffer.count instead*/ };
 	
-	const GLsizeiptr buffer_size = color_intrin.width*color_intrin.height * 3;
-	image_renderer.program.Init(ShaderSource::vs_src["color"], ShaderSource::fs_src["color"]);
 	glGenTextures(1, &image_renderer.texture);
 	glBindTexture(GL_TEXTURE_2D, image_renderer.texture);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, color_intrin.width, color_intrin.height, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
 	glBindTexture(GL_TEXTURE_2D, 0);
 	image_renderer.PBO[0].Init(GL_PIXEL_UNPACK_BUFFER);
-	image_renderer.PBO[0].Data(buffer_size, nullptr, GL_STREAM_DRAW);
 	image_renderer.PBO[1].Init(GL_PIXEL_UNPACK_BUFFER);
-	image_renderer.PBO[1].Data(buffer_size, nullptr, GL_STREAM_DRAW);
 	image_renderer.vertex_array = geometry_vao;
 
+	object_inset.init();
+	object_inset.vertex_array = geometry_vao;
+
 	trackball.curr.eye = smath::float3{};
 	trackball.curr.at = smath::float3{ 0, 0, 1 };
 	trackball.curr.up = smath::float3{ 0, -1, 0 };
@@ -241,37 +354,56 @@ void Application::init_OpenGL() {
 	glEnable(GL_PROGRAM_POINT_SIZE);
 }
 
+// the color texture and its upload buffers, in the size of the color images.
+void Application::allocate_images() {
+	const GLsizeiptr buffer_size = color_intrin.width*color_intrin.height * 3;
+	glBindTexture(GL_TEXTURE_2D, image_renderer.texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, color_intrin.width, color_intrin.height, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	image_renderer.PBO[0].Data(buffer_size, nullptr, GL_STREAM_DRAW);
+	image_renderer.PBO[1].Data(buffer_size, nullptr, GL_STREAM_DRAW);
+}
+
 void Application::release_OpenGL() {
 
 	plane_renderer.program.Release();
 	plane_renderer.vertex_array.Release();
 	plane_renderer.position_buffer.Release();
 	plane_renderer.index_buffer.Release();
+	plane_renderer.instance_buffer.Release();
 	
 	sphere_renderer.program.Release();
 	sphere_renderer.vertex_array.Release();
 	sphere_renderer.position_buffer.Release();
 	sphere_renderer.index_buffer.Release();
+	sphere_renderer.instance_buffer.Release();
 
 	cylinder_renderer.program.Release();
 	cylinder_renderer.vertex_array.Release();
 	cylinder_renderer.position_buffer.Release();
 	cylinder_renderer.index_buffer.Release();
+	cylinder_renderer.instance_buffer.Release();
 
 	cone_renderer.program.Release();
 	cone_renderer.vertex_array.Release();
 	cone_renderer.position_buffer.Release();
 	cone_renderer.index_buffer.Release();
+	cone_renderer.instance_buffer.Release();
 
 	torus_renderer.program.Release();
 	torus_renderer.vertex_array.Release();
 	torus_renderer.position_buffer.Release();
 	torus_renderer.index_buffer.Release();
+	torus_renderer.instance_buffer.Release();
+
+	impostor_renderer.program.Release();
+	for (sgl::Program& program : shaded_programs) program.Release();
 
 	depth_renderer.program.Release();
 	depth_renderer.vertex_array.Release();
 	depth_renderer.position_buffer.Release();
 	depth_renderer.color_buffer.Release();
+	depth_renderer.normal_buffer.Release();
 	
 	inlier_renderer.program.Release();
 	inlier_renderer.vertex_array.Release();
@@ -282,28 +414,88 @@ void Application::release_OpenGL() {
 	glDeleteTextures(1, &image_renderer.texture);
 	image_renderer.PBO[0].Release();
 	image_renderer.PBO[1].Release();
+
+	object_inset.program.Release();
+	object_inset.release();
+
+	for (auto& fence : fences) glDeleteSync(fence.first);
+	fences.clear();
 }
 
+// the screen is redrawn only when it is dirty: a frame has arrived, a camera has moved, or the input, the window or
+// a change of the primitives asked for it (once: their instance buffer is rewritten when they are next drawn, which
+// the point cloud mode does not do). otherwise the loop sleeps on the events (the capture thread posts one
+// on every arrival), waking up every millisecond only while frames are on the GPU, to poll their fences.
 void Application::run() {
 	int frame = 0;
-	double t0 = glfwGetTime();
+	double t0 = glfwGetTime(), t_drawn = t0;
+	loop_stats.begin = scapture::Now();
 	while (!glfwWindowShouldClose(window)) {
-		glfwPollEvents();
-		dev->wait_for_frames();
+		bool moving = trackball.movement.any() || trackball2.movement.any();
+		double t_wait = scapture::Now();
+		if (redraw || moving || rig.wait_for_frames(0)) glfwPollEvents();
+		else if (fences.empty()) glfwWaitEvents();
+		else glfwWaitEventsTimeout(0.001);
+		loop_stats.waiting += scapture::Now() - t_wait;
+		loop_stats.wakeups++;
 
+		poll_fences();
+
+		// cameras move by the time since the previous iteration (bounded, as it may have slept long).
 		double t1 = glfwGetTime();
-		double dt = t1 - t0;
+		double dt = min(t1 - t0, 0.1);
 		t0 = t1;
+
+		bool new_frame = rig.wait_for_frames(0);
+		bool camera_moved = trackball.update(dt);
+		if (trackball2.update(dt)) {
+			camera_moved = true;
+			object_inset.dirty = true;
+		}
+		if (!new_frame && !camera_moved && !redraw) continue;
+		redraw = false;
 		frame++;
+		loop_stats.redraws++;
 
-		update(frame, dt);
+		slatency::FrameTag tag;
+		tag.merged = scapture::Now();
+		if (new_frame) {
+			update(frame, dt);
+			loop_stats.frames++;
+		}
+		double updated = scapture::Now();
 		render(frame, dt);
+		tag.submitted = scapture::Now();
+		tag.device = rig.merged_device_timestamp();
+		tag.arrival = rig.merged_timestamp();
+		tag.deprojected = tag.arrival + rig.merged_deproject_ms();
+
+		if (new_frame && adaptive_profile) {
+			scapture::ProfileController::Stages stages;
+			stages.deproject = tag.deprojected - tag.arrival;
+			stages.queue = max(tag.merged - tag.deprojected, 0.0);
+			stages.update = updated - tag.merged;
+			stages.render = tag.submitted - updated;
+
+			int next = profile_controller.update(stages, rig.profile(), rig.profiles());
+			if (next != rig.profile()) {
+				const scapture::ProfileController::Stages& mean = profile_controller.last_mean();
+				fprintf(stderr, "Profile: latency %.1f ms (deproject %.1f, queue %.1f, update %.1f, render %.1f) for a budget of %.0f ms.\n",
+					mean.total(), mean.deproject, mean.queue, mean.update, mean.render, profile_controller.budget);
+				switch_profile(next);
+			}
+		}
 
-		ms_log[t_index] = dt;
+		ms_log[t_index] = t1 - t_drawn;
+		t_drawn = t1;
 		double avg_ms = std::accumulate(ms_log, ms_log + 60, 0.0) / 60;
 		t_index = (t_index + 1) % 60;
 		glfwSetWindowTitle(window, (std::string(title) + "(" + std::to_string(1.0 / avg_ms) + " fps, " + std::to_string(avg_ms) + " ms)").c_str());
 		glfwSwapBuffers(window);
+
+		// only the frames from the devices are tracked to the photons (not the redraws of the same frame).
+		if (new_frame) fences.push_back(std::make_pair(glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), tag));
+		poll_fences();
 	}
 
 	finalize();
@@ -312,58 +504,60 @@ void Application::run() {
 	glfwTerminate();
 }
 
-void Application::update(int frame, double time_elapsed) {
-	depth_points.clear();
-	depth_colors.clear();
-
-	// 1. fetch point clouds from the Intel RealSense device.
-	const uint16_t* depth_image = (const uint16_t*)dev->get_frame_data(rs::stream::depth);
-	color_image = (uint8_t*)dev->get_frame_data(rs::stream::rectified_color);
-
-	// 2. We have to filter out *dead* pixels that do not have depth values due to measurement errors,
-	//	  such as obsorbing IR of black surfaces or too much far distant surfaces.
-	int depth_width = depth_intrin.width;
-	int depth_height = depth_intrin.height;
-	for (int dy = 0; dy < depth_height; dy++) {
-		for (int dx = 0; dx < depth_width; dx++) {
-			uint16_t depth_value = depth_image[dy*depth_width + dx];
-			float depth_in_meters = depth_value * scale;
-
-			if (depth_value == 0) continue; // zero depth means it is one of the dead pixels.
-
-			rs::float2 depth_pixel = { float(dx), float(dy) };
-			rs::float3 depth_point = depth_intrin.deproject(depth_pixel, depth_in_meters);
-			rs::float3 color_point = depth_to_color.transform(depth_point);
-			rs::float2 color_pixel = color_intrin.project(color_point);
-
-			ubyte3 depth_color = {};
-			const int cx = int(std::round(color_pixel.x)), cy = int(std::round(color_pixel.y));
-			if (cx >= 0 && cx < color_intrin.width && cy >= 0 && cy < color_intrin.height) {
-				depth_color = *((ubyte3*)(color_image + 3 * (cy*color_intrin.width + cx)));
-			}
-
-			depth_points.push_back(depth_point);
-			depth_colors.push_back(depth_color);
+// the frames whose fences are signaled have been completed by the GPU (as of now, within the polling interval).
+void Application::poll_fences() {
+	while (!fences.empty()) {
+		GLenum status = glClientWaitSync(fences.front().first, 0, 0);
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) break;
+
+		slatency::FrameTag tag = fences.front().second;
+		tag.completed = scapture::Now();
+		glDeleteSync(fences.front().first);
+		fences.pop_front();
+		latency.frame(tag);
+
+		if (!first_frame_shown) {
+			first_frame_shown = true;
+			fprintf(stderr, "Startup: the first frame was on screen %.0f ms after the start.\n", tag.completed - startup_begin);
 		}
 	}
+}
 
-	// 3. pass the point cloud to FindSurface.
-	cleanUpFindSurface(fs);
-	setPointCloudFloat(fs, depth_points.data(), static_cast<unsigned int>(depth_points.size()), 0);
+void Application::update(int frame, double time_elapsed) {
+	// 1. fetch the point clouds deprojected by the capture threads, merged in the common frame.
+	rig.merge(depth_points, depth_colors, depth_tiles, color_image);
+	frame_serial++;
+	cloud_fused = false;
+
+	const rs::intrinsics& merged_depth = rig.merged_depth_intrin();
+	const rs::intrinsics& merged_color = rig.merged_color_intrin();
+	if (merged_depth.width > 0 && (merged_depth.width != depth_intrin.width || merged_depth.height != depth_intrin.height ||
+		merged_color.width != color_intrin.width || merged_color.height != color_intrin.height)) apply_profile();
+
+	// 2. dead pixels (without depth values) have been filtered out by the capture threads.
+
+	if (dumping) export_ply(dump_dir + "/frame_" + std::to_string(dump_index++) + ".ply", false);
+
+	if (accumulating) fusion.integrate(rig.merged_frames());
+	if (use_normals) estimate_normals();
+	else depth_normals.clear();
+
+	// 3. the point cloud (or the region around the seed) is passed to FindSurface when a fit is asked.
 
-	// 4. camera update
-	trackball.update(time_elapsed);
-	trackball2.update(time_elapsed);
+	// 4. the cameras are updated by run(), with or without a new frame.
 }
 
 void Application::render(int frame, double time_elapsed) {
 
 	int width, height;
-	glfwGetFramebufferSize(window, &width, &height);
+	framebuffer_size(width, height);
 	glViewport(0, 0, width, height);
 
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+	if (primitives_changed) object_inset.dirty = true;
+
+	// the packets of each pass are drawn sorted by the queue, before the framebuffer or the viewport changes.
 	switch (screen_mode) {
 	case SCREEN_MODE::DEPTH: 
 		render_depth(); 
@@ -372,80 +566,338 @@ void Application::render(int frame, double time_elapsed) {
 
 	case SCREEN_MODE::COLOR: 
 		render_color(); 
+		render_queue.flush();
 		
-		glEnable(GL_SCISSOR_TEST);
-		glScissor(0, 0, width / 5, height / 5);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-		glDisable(GL_SCISSOR_TEST);
+		// the inset is rendered again only after a new result or a move of its camera.
+		if (object_inset.begin(width / 5, height / 5)) {
+			render_inlier();
+			render_geometry();
+			render_queue.flush();
+			object_inset.end();
+		}
 
 		glViewport(0, 0, width / 5, height / 5);
-		
-		render_inlier();
-		render_geometry();
+		object_inset.submit(render_queue, 0);
 		
 		break;
 
 	case SCREEN_MODE::OBJECT:
 		render_inlier();
 		render_geometry();
+		render_queue.flush();
 
 		glViewport(0, 0, width / 5, height / 5);
-		glDisable(GL_DEPTH_TEST);
-		render_color();
-		glEnable(GL_DEPTH_TEST);
+		render_color(0);
 	}
+	render_queue.flush();
 }
 
 void Application::render_depth() {
-	depth_renderer.position_buffer.Data(depth_points.size(), sizeof(rs::float3), depth_points.data(), GL_STREAM_DRAW);
-	depth_renderer.color_buffer.Data(depth_colors.size(), sizeof(ubyte3), depth_colors.data(), GL_STREAM_DRAW);
+	// the point cloud is sent once per frame, not per redraw.
+	if (depth_serial != frame_serial) {
+		depth_renderer.position_buffer.Data(depth_points.size(), sizeof(rs::float3), depth_points.data(), GL_STREAM_DRAW);
+		depth_renderer.color_buffer.Data(depth_colors.size(), sizeof(ubyte3), depth_colors.data(), GL_STREAM_DRAW);
+		depth_renderer.shaded = !depth_normals.empty();
+		if (depth_renderer.shaded) depth_renderer.normal_buffer.Data(depth_normals.size(), sizeof(rs::float3), depth_normals.data(), GL_STREAM_DRAW);
+		depth_serial = frame_serial;
+	}
+
+	// only the tiles in the view frustum are drawn, and those covering few pixels on screen are subsampled.
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	float viewport_size = float(max(viewport[2], viewport[3]));
+
+	depth_renderer.tiled = true;
+	depth_renderer.firsts.clear();
+	depth_renderer.counts.clear();
+	for (const scapture::Tile& tile : depth_tiles) {
+		float extent;
+		if (!trackball.curr.isVisible(tile.lo, tile.hi, &extent)) continue;
+
+		// pixels of the depth image per pixel on screen (along the larger side).
+		float density = scapture::TILE_SIZE / max(0.5f*extent*viewport_size, 1.f);
+		int level = 0;
+		while (level < scapture::TILE_LEVELS - 1 && density >= float(2 << level)) level++;
+
+		depth_renderer.firsts.push_back(tile.first);
+		depth_renderer.counts.push_back(tile.count[level]);
+	}
 
 	depth_renderer.view_matrix = trackball.view_matrix();
 	depth_renderer.projection_matrix = trackball.projection_matrix();
-	depth_renderer.render();
+	depth_renderer.submit(render_queue, sgl::DEPTH_TEST);
 }
 
-void Application::render_color() {
-	image_renderer.render(color_intrin.width, color_intrin.height, color_image);
+void Application::render_color(unsigned int state) {
+	image_renderer.upload(color_intrin.width, color_intrin.height, color_image.data(), color_serial != frame_serial);
+	color_serial = frame_serial;
+	image_renderer.submit(render_queue, state);
 }
 
 void Application::render_inlier() {
 	inlier_renderer.view_matrix = trackball2.view_matrix();
 	inlier_renderer.projection_matrix = trackball2.projection_matrix();
-	inlier_renderer.render();
+	inlier_renderer.submit(render_queue, sgl::DEPTH_TEST);
 }
 
 void Application::render_geometry() {
 
-	glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-	switch (result.type) {
-	case FS_FEATURE_TYPE::FS_TYPE_PLANE:
-		plane_renderer.view_matrix = trackball2.view_matrix();
-		plane_renderer.projection_matrix = trackball2.projection_matrix();
-		plane_renderer.render(); 
-		break;
-	case FS_FEATURE_TYPE::FS_TYPE_SPHERE:
-		sphere_renderer.view_matrix = trackball2.view_matrix();
-		sphere_renderer.projection_matrix = trackball2.projection_matrix();
-		sphere_renderer.render();
-		break;
-	case FS_FEATURE_TYPE::FS_TYPE_CYLINDER:
-		cylinder_renderer.view_matrix = trackball2.view_matrix();
-		cylinder_renderer.projection_matrix = trackball2.projection_matrix();
-		cylinder_renderer.render();
-		break;
-	case FS_FEATURE_TYPE::FS_TYPE_CONE:
-		cone_renderer.view_matrix = trackball2.view_matrix();
-		cone_renderer.projection_matrix = trackball2.projection_matrix();
-		cone_renderer.render();
-		break;
-	case FS_FEATURE_TYPE::FS_TYPE_TORUS:
-		torus_renderer.view_matrix = trackball2.view_matrix();
-		torus_renderer.projection_matrix = trackball2.projection_matrix();
-		torus_renderer.render();
-		break;
+	upload_primitives();
+
+	plane_renderer.view_matrix = trackball2.view_matrix();
+	plane_renderer.projection_matrix = trackball2.projection_matrix();
+	sphere_renderer.view_matrix = trackball2.view_matrix();
+	sphere_renderer.projection_matrix = trackball2.projection_matrix();
+	cylinder_renderer.view_matrix = trackball2.view_matrix();
+	cylinder_renderer.projection_matrix = trackball2.projection_matrix();
+	cone_renderer.view_matrix = trackball2.view_matrix();
+	cone_renderer.projection_matrix = trackball2.projection_matrix();
+	torus_renderer.view_matrix = trackball2.view_matrix();
+	torus_renderer.projection_matrix = trackball2.projection_matrix();
+
+	// one instanced draw call per primitive type (and level of detail), no matter how many primitives are kept.
+	const unsigned int wireframe = sgl::DEPTH_TEST | sgl::WIREFRAME;
+	const unsigned int mesh_state = filled_meshes ? sgl::DEPTH_TEST : wireframe;
+	plane_renderer.submit(render_queue, wireframe);
+	if (!use_impostors) {
+		sphere_renderer.submit(render_queue, mesh_state);
+		cylinder_renderer.submit(render_queue, mesh_state);
+		cone_renderer.submit(render_queue, mesh_state);
+	}
+	torus_renderer.submit(render_queue, wireframe);
+
+	if (use_impostors) {
+		// spheres, cylinders and cones are contiguous in the instance buffer.
+		const int last = sgeometry::LOD_COUNT - 1;
+		impostor_renderer.base_instance = sphere_renderer.base_instance[0];
+		impostor_renderer.instance_count = GLsizei(cone_renderer.base_instance[last] + cone_renderer.instance_count[last] - sphere_renderer.base_instance[0]);
+		impostor_renderer.view_matrix = trackball2.view_matrix();
+		impostor_renderer.projection_matrix = trackball2.projection_matrix();
+		impostor_renderer.submit(render_queue, sgl::DEPTH_TEST);
 	}
-	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+}
+
+void Application::make_test_primitives(int count) {
+	using namespace smath;
+	int n = int(std::ceil(std::sqrt(float(count))));
+	float spacing = 1.f / n;
+	float r = 0.4f*spacing;
+
+	primitives.clear();
+	for (int k = 0; k < count; k++) {
+		float3 c = { (k % n + 0.5f)*spacing - 0.5f, (k / n + 0.5f)*spacing - 0.5f, 1.f };
+		Primitive p = {};
+		switch (k % 3) {
+		case 0:
+			p.result.type = FS_FEATURE_TYPE::FS_TYPE_SPHERE;
+			p.instance.model_matrix = Translate(c)*Scale(r);
+			p.instance.params = float4{ 0, 0, 0, 0 };
+			break;
+		case 1:
+			p.result.type = FS_FEATURE_TYPE::FS_TYPE_CYLINDER;
+			p.instance.model_matrix = Translate(c)*Scale({ r*0.5f, r, r*0.5f });
+			p.instance.params = float4{ 0, 0, 0, 1 };
+			break;
+		case 2:
+			p.result.type = FS_FEATURE_TYPE::FS_TYPE_CONE;
+			p.instance.model_matrix = Translate(c)*Scale({ 1, r, 1 });
+			p.instance.params = float4{ r*0.25f, r*0.5f, 0, 2 };
+			break;
+		}
+		p.bounding_center = c;
+		p.bounding_radius = r*1.2f;
+		primitives.push_back(p);
+	}
+	primitives_changed = true;
+}
+
+void Application::benchmark_geometry() {
+	// GPU time of render_geometry() for the mesh (in wireframe, as drawn, and filled and shaded as the impostors are)
+	// and the impostor path, on a grid of synthetic spheres, cylinders and cones in front of the object view.
+	static const int counts[] = { 1, 100, 1000 };
+	static const int repeat = 20;
+
+	std::vector<Primitive> kept;
+	kept.swap(primitives);
+	bool kept_use_impostors = use_impostors;
+
+	int width, height;
+	framebuffer_size(width, height);
+	glViewport(0, 0, width, height);
+
+	sgl::Query timer;
+	timer.Init(GL_TIME_ELAPSED);
+
+	fprintf(stdout, "Geometry benchmark (GPU time per frame in ms.)\n");
+	fprintf(stdout, "   count  mesh wire mesh shaded   impostor\n");
+	auto swap_programs = [this]() {
+		std::swap(sphere_renderer.program, shaded_programs[0]);
+		std::swap(cylinder_renderer.program, shaded_programs[1]);
+		std::swap(cone_renderer.program, shaded_programs[2]);
+	};
+	for (int count : counts) {
+		make_test_primitives(count);
+
+		double ms[3];
+		for (int path = 0; path < 3; path++) {
+			use_impostors = path == 2;
+			filled_meshes = path == 1;
+			if (filled_meshes) swap_programs();
+			render_geometry(); // warming up (and uploading the instances)
+			render_queue.flush();
+			glFinish();
+
+			GLuint64 elapsed = 0;
+			for (int k = 0; k < repeat; k++) {
+				glClear(GL_DEPTH_BUFFER_BIT);
+				timer.Begin();
+				render_geometry();
+				render_queue.flush();
+				timer.End();
+				elapsed += timer.Result();
+			}
+			ms[path] = double(elapsed) / repeat * 1e-6;
+			if (filled_meshes) swap_programs();
+		}
+		fprintf(stdout, "%8d %10.4f  %10.4f %10.4f\n", count, ms[0], ms[1], ms[2]);
+	}
+	fprintf(stdout, "(compare the impostors with the shaded meshes: both fill and shade the same pixels)\n");
+
+	timer.Release();
+
+	primitives.swap(kept);
+	primitives_changed = true;
+	use_impostors = kept_use_impostors;
+	filled_meshes = false;
+}
+
+// render() in each screen mode over the frames of the rig, redrawn as fast as they can be (with update() on every new
+// frame, as run() does), into the offscreen framebuffer. the GPU time of each redraw is read back a few redraws later,
+// so that the CPU does not wait for the GPU.
+void Application::benchmark_render(int frames, FILE* out) {
+	static const SCREEN_MODE modes[] = { SCREEN_MODE::DEPTH, SCREEN_MODE::COLOR, SCREEN_MODE::OBJECT };
+	static const char* names[] = { "depth", "color", "object" };
+	static const int TIMERS = 4; // in flight
+
+	// the first frame, with a grid of primitives and the inliers of a fit at the center of the color image.
+	if (!rig.wait_for_frames(5000)) {
+		fprintf(stderr, "Render: no frame from the rig.\n");
+		finalize();
+		return;
+	}
+	update(0, 0.0);
+	trackball.update(0.0); // the cameras stay where they start
+	trackball2.update(0.0);
+	make_test_primitives(100);
+	if (!depth_points.empty()) run_FindSurface(0.5f, 0.5f);
+
+	sgl::Query timers[TIMERS];
+	for (sgl::Query& timer : timers) timer.Init(GL_TIME_ELAPSED);
+
+	fprintf(out, "Render benchmark (%dx%d %s, %d redraws per mode, %d primitives)\n",
+		offscreen.width, offscreen.height, offscreen.surfaceless ? "surfaceless" : "pbuffer", frames, int(primitives.size()));
+	fprintf(out, "    mode   redraws/s   cpu ms  cpu p90   gpu ms  gpu p90   frames  changes\n");
+	SCREEN_MODE kept_mode = screen_mode;
+	for (int m = 0; m < 3; m++) {
+		screen_mode = modes[m];
+		object_inset.dirty = true;
+		render(0, 0.0); // warming up
+		glFinish();
+		render_queue.stats = sgl::RenderQueue::Stats();
+
+		slatency::Histogram cpu, gpu;
+		int updates = 0;
+		double begin = scapture::Now();
+		for (int k = 0; k < frames; k++) {
+			sgl::Query& timer = timers[k % TIMERS];
+			if (k >= TIMERS) gpu.add(double(timer.Result())*1e-6);
+
+			double t0 = scapture::Now();
+			if (rig.wait_for_frames(0)) {
+				update(k, 0.0);
+				updates++;
+			}
+			timer.Begin();
+			render(k, 0.0);
+			timer.End();
+			cpu.add(scapture::Now() - t0);
+		}
+		glFinish();
+		double elapsed = scapture::Now() - begin;
+		for (int k = max(frames - TIMERS, 0); k < frames; k++) gpu.add(double(timers[k % TIMERS].Result())*1e-6);
+
+		fprintf(out, "%8s %11.1f %8.3f %8.3f %8.3f %8.3f %8d %8.1f\n", names[m], frames / max(elapsed*1e-3, 1e-9),
+			cpu.mean(), cpu.percentile(0.9), gpu.mean(), gpu.percentile(0.9), updates, double(render_queue.stats.changes()) / max(frames, 1));
+	}
+	fprintf(out, "(cpu: update() and render() as submitted; gpu: render() as executed; frames: new ones from the rig; changes: state changes per redraw)\n");
+
+	for (sgl::Query& timer : timers) timer.Release();
+	screen_mode = kept_mode;
+	render_queue.stats = sgl::RenderQueue::Stats();
+
+	finalize();
+}
+
+void Application::upload_primitives() {
+	static const FS_FEATURE_TYPE order[] = {
+		FS_FEATURE_TYPE::FS_TYPE_PLANE,
+		FS_FEATURE_TYPE::FS_TYPE_SPHERE,
+		FS_FEATURE_TYPE::FS_TYPE_CYLINDER,
+		FS_FEATURE_TYPE::FS_TYPE_CONE,
+		FS_FEATURE_TYPE::FS_TYPE_TORUS
+	};
+	GeometryRenderer* renderers[] = { &plane_renderer, &sphere_renderer, &cylinder_renderer, &cone_renderer, &torus_renderer };
+
+	// level of detail of each primitive from its projected size in the current viewport.
+	using namespace smath;
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	mat4 view_matrix = trackball2.view_matrix();
+	mat4 projection_matrix = trackball2.projection_matrix();
+
+	std::vector<int> lods(primitives.size());
+	for (size_t k = 0; k < primitives.size(); k++) {
+		float4 clip = projection_matrix*(view_matrix*ToFloat4(primitives[k].bounding_center, 1));
+		float screen_size = 2.f*primitives[k].bounding_radius*projection_matrix[5] / max(clip[3], FLT_EPSILON)*0.5f*float(viewport[3]);
+		lods[k] = primitives[k].result.type == FS_FEATURE_TYPE::FS_TYPE_PLANE ? 0 : sgeometry::SelectLOD(screen_size);
+	}
+
+	// the instance buffer is rewritten only if the list or any level of detail has changed.
+	if (!primitives_changed && lods == primitive_lods) return;
+	primitive_lods = lods;
+
+	// instances are grouped by type and level of detail so that each renderer draws contiguous ranges.
+	std::vector<PrimitiveInstance> instances;
+	instances.reserve(primitives.size());
+	for (int t = 0; t < 5; t++) {
+		for (int lod = 0; lod < sgeometry::LOD_COUNT; lod++) {
+			renderers[t]->base_instance[lod] = GLuint(instances.size());
+			for (size_t k = 0; k < primitives.size(); k++) {
+				if (primitives[k].result.type != order[t] || lods[k] != lod) continue;
+				PrimitiveInstance instance = primitives[k].instance;
+				// the latest one is drawn in red, and the others in orange.
+				instance.color = k + 1 == primitives.size() ? smath::float4{ 1, 0, 0, 1 } : smath::float4{ 1, 0.6f, 0, 1 };
+				instances.push_back(instance);
+			}
+			renderers[t]->instance_count[lod] = GLsizei(instances.size() - renderers[t]->base_instance[lod]);
+		}
+	}
+
+	plane_renderer.instance_buffer.Data(instances.size(), sizeof(PrimitiveInstance), instances.data(), GL_DYNAMIC_DRAW);
+	primitives_changed = false;
+}
+
+void Application::undo_primitive() {
+	if (primitives.empty()) return;
+	primitives.pop_back();
+	primitives_changed = redraw = true;
+	fprintf(stdout, "Primitives: removed the latest one (%d left).\n", int(primitives.size()));
+}
+
+void Application::clear_primitives() {
+	primitives.clear();
+	primitives_changed = redraw = true;
+	fprintf(stdout, "Primitives: cleared.\n");
 }
 
 //void Application::render_touch_point() {
@@ -464,12 +916,18 @@ void Application::render_geometry() {
 //}
 
 void Application::finalize() {
+	if (latency.frames > 0) latency.print(stdout);
+	if (dumping) toggle_dump();
+	ply_writer.stop();
+	publisher.release();
 	release_FindSurface();
 	release_RealSense();
-	release_OpenGL();
+	if (!headless) release_OpenGL();
+	offscreen.release();
 }
 
 void Application::on_mouse_button(GLFWwindow* window, int button, int action, int mods) {
+	redraw = true;
 	double x, y;
 	glfwGetCursorPos(window, &x, &y);
 	x /= width;
@@ -477,7 +935,9 @@ void Application::on_mouse_button(GLFWwindow* window, int button, int action, in
 
 	if (screen_mode == SCREEN_MODE::COLOR) {
 		if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS) {
+			latency.click(scapture::Now());
 			run_FindSurface(float(x), float(y));
+			latency.click_result(scapture::Now());
 		}
 	}
 	else {
@@ -494,16 +954,294 @@ void Application::on_mouse_button(GLFWwindow* window, int button, int action, in
 	}
 }
 
+// if succeeds, the struct "result" will be filled with data.
+// the inliers are kept in inlier_flags (of depth_points), wherever the fit was run.
+int Application::find_surface(int index, FS_FEATURE_TYPE type) {
+	static const int ROI_TRIES = 3;			// then the whole cloud
+	static const float ROI_TOUCH_R = 4.f;	// initial radius of the region, in touch_r
+	static const float ROI_BORDER = 0.9f;	// an inlier this far (of the radius) touches the border
+
+	roi_tries = 0;
+	if (use_pyramid) {
+		int res = fit_pyramid(index, type);
+		if (res >= 0 || res == FS_LICENSE_EXPIRED || res == FS_LICENSE_UNKNOWN) return res;
+	}
+
+	if (use_segments) {
+		int segment_seed = gather_segment(index);
+		if (segment_seed >= 0) {
+			int res = fit_subset(segment_seed, type);
+			if (res >= 0 || res == FS_LICENSE_EXPIRED || res == FS_LICENSE_UNKNOWN) return res;
+		}
+	}
+
+	if (use_roi) {
+		float touch_r = 0.f;
+		getFindSurfaceParamFloat(fs, FS_PARAMS::FS_PARAM_TOUCH_R, &touch_r);
+		float radius = ROI_TOUCH_R*touch_r;
+		const rs::float3 seed = depth_points[index];
+
+		for (roi_tries = 1; roi_tries <= ROI_TRIES; roi_tries++, radius *= 2.f) {
+			int roi_seed = gather_roi(index, radius);
+			if (roi_seed < 0 || roi_points.size() == depth_points.size()) break; // as good as the whole cloud
+
+			int res = fit_subset(roi_seed, type);
+			if (res == FS_LICENSE_EXPIRED || res == FS_LICENSE_UNKNOWN) return res;
+			if (res < 0) continue; // too few points, maybe
+
+			// whether an inlier reaches the border.
+			float reach = 0.f;
+			for (size_t k = 0; k < roi_points.size(); k++) {
+				if (inlier_flags[roi_indices[k]]) continue;
+				float dx = roi_points[k].x - seed.x, dy = roi_points[k].y - seed.y, dz = roi_points[k].z - seed.z;
+				reach = max(reach, dx*dx + dy*dy + dz*dz);
+			}
+			if (reach < ROI_BORDER*ROI_BORDER*radius*radius) return res;
+		}
+	}
+	roi_tries = 0;
+
+	cleanUpFindSurface(fs);
+	setPointCloudFloat(fs, depth_points.data(), static_cast<unsigned int>(depth_points.size()), 0);
+	int res = findSurface(fs, type, index, &result);
+	if (res >= 0) inlier_flags.assign(getInOutlierFlags(fs), getInOutlierFlags(fs) + depth_points.size());
+	return res;
+}
+
+// the inlier flags of the subset go back to the indices of the whole cloud.
+int Application::fit_subset(int subset_seed, FS_FEATURE_TYPE type) {
+	cleanUpFindSurface(fs);
+	setPointCloudFloat(fs, roi_points.data(), static_cast<unsigned int>(roi_points.size()), 0);
+	int res = findSurface(fs, type, subset_seed, &result);
+	if (res < 0) return res;
+
+	const unsigned char* flags = getInOutlierFlags(fs);
+	inlier_flags.assign(depth_points.size(), 1);
+	for (size_t k = 0; k < roi_points.size(); k++) {
+		if (!flags[k]) inlier_flags[roi_indices[k]] = 0;
+	}
+	return res;
+}
+
+// the merged cloud is the points of the merged frames, one after another.
+int Application::merged_frame_of(int index, int& offset) const {
+	const std::vector<std::shared_ptr<scapture::Frame>>& frames = rig.merged_frames();
+	offset = 0;
+	for (int f = 0; f < int(frames.size()); f++) {
+		if (index < offset + int(frames[f]->points.size())) return f;
+		offset += int(frames[f]->points.size());
+	}
+	return -1;
+}
+
+// a frame is segmented once, however many seeds are picked in it.
+int Application::gather_segment(int index) {
+	if (cloud_fused) return -1;
+	const std::vector<std::shared_ptr<scapture::Frame>>& frames = rig.merged_frames();
+	int offset;
+	int seed_frame = merged_frame_of(index, offset);
+	if (seed_frame < 0) return -1;
+
+	if (frames[seed_frame] != segmented_frame) {
+		segmenter.segment(*frames[seed_frame]);
+		segmented_frame = frames[seed_frame];
+	}
+	segmenter.select(index - offset, roi_indices);
+	if (roi_indices.empty()) return -1;
+
+	smath::float3 lo = { FLT_MAX, FLT_MAX, FLT_MAX }, hi = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	for (int& k : roi_indices) {
+		k += offset;
+		const rs::float3& p = depth_points[k];
+		lo = smath::float3{ min(lo[0], p.x), min(lo[1], p.y), min(lo[2], p.z) };
+		hi = smath::float3{ max(hi[0], p.x), max(hi[1], p.y), max(hi[2], p.z) };
+	}
+
+	// the other sources, from their tiles overlapping the box.
+	int first = 0;
+	for (int f = 0; f < int(frames.size()); first += int(frames[f]->points.size()), f++) {
+		if (f == seed_frame) continue;
+		for (const scapture::Tile& tile : frames[f]->tiles) {
+			if (tile.hi[0] < lo[0] || tile.lo[0] > hi[0] || tile.hi[1] < lo[1] || tile.lo[1] > hi[1] || tile.hi[2] < lo[2] || tile.lo[2] > hi[2]) continue;
+			for (int k = first + tile.first; k < first + tile.first + tile.count[0]; k++) {
+				const rs::float3& p = depth_points[k];
+				if (p.x >= lo[0] && p.x <= hi[0] && p.y >= lo[1] && p.y <= hi[1] && p.z >= lo[2] && p.z <= hi[2]) roi_indices.push_back(k);
+			}
+		}
+	}
+
+	int segment_seed = -1;
+	roi_points.resize(roi_indices.size());
+	for (size_t k = 0; k < roi_indices.size(); k++) {
+		roi_points[k] = depth_points[roi_indices[k]];
+		if (roi_indices[k] == index) segment_seed = int(k);
+	}
+	return segment_seed;
+}
+
+// the pyramid is built once per frame, and its coarse level deprojected. the band around the coarse surface is
+// taken from every source; the coarse result is kept if the inliers of the band (within accuracy) are this close to it.
+int Application::fit_pyramid(int index, FS_FEATURE_TYPE type) {
+	static const int LEVEL = 2;				// of the coarse fit: 1/4 of the pixels along each side
+	static const float BAND = 3.f;			// half width of the band (in accuracy)
+	static const float TOLERANCE = 0.5f;	// rms of the inliers for an early stop (in accuracy)
+
+	pyramid_stats = PyramidStats{};
+	if (cloud_fused) return -1;
+	int offset;
+	int seed_frame = merged_frame_of(index, offset);
+	if (seed_frame < 0) return -1;
+
+	double t0 = scapture::Now();
+	const std::shared_ptr<scapture::Frame>& frame = rig.merged_frames()[seed_frame];
+	if (frame != pyramid_frame) {
+		spyramid::Build(*frame, LEVEL + 1, spyramid::Reduce::MEDIAN, pyramid);
+		spyramid::Deproject(*frame, pyramid[LEVEL], coarse_points);
+		pyramid_frame = frame;
+	}
+	pyramid_stats.coarse_points = int(coarse_points.size());
+	double t1 = scapture::Now();
+
+	// the coarse point nearest to the seed, and the mean distance of the coarse points.
+	using namespace smath;
+	const float3 seed = reinterpret_cast<const float3&>(depth_points[index]);
+	int coarse_seed = -1;
+	float min_dist = FLT_MAX;
+	for (int k = 0; k < int(coarse_points.size()); k++) {
+		float3 d = reinterpret_cast<const float3&>(coarse_points[k]) - seed;
+		if (Dot(d, d) < min_dist) { min_dist = Dot(d, d); coarse_seed = k; }
+	}
+	if (coarse_seed < 0) return -1;
+
+	float mean_dist = 0.f, accuracy = 0.f;
+	getFindSurfaceParamFloat(fs, FS_PARAMS::FS_PARAM_MEAN_DIST, &mean_dist);
+	getFindSurfaceParamFloat(fs, FS_PARAMS::FS_PARAM_ACCURACY, &accuracy);
+	setFindSurfaceParamFloat(fs, FS_PARAMS::FS_PARAM_MEAN_DIST, mean_dist*(1 << LEVEL));
+	cleanUpFindSurface(fs);
+	setPointCloudFloat(fs, coarse_points.data(), static_cast<unsigned int>(coarse_points.size()), 0);
+	int res = findSurface(fs, type, coarse_seed, &result);
+	setFindSurfaceParamFloat(fs, FS_PARAMS::FS_PARAM_MEAN_DIST, mean_dist);
+	double t2 = scapture::Now();
+	pyramid_stats.build_ms = t1 - t0;
+	pyramid_stats.coarse_ms = t2 - t1;
+	if (res < 0) return res;
+
+	// the band around the coarse surface, at full resolution.
+	int band_seed = -1;
+	double inlier_sum = 0.0;
+	int inliers = 0;
+	roi_points.clear();
+	roi_indices.clear();
+	for (int k = 0; k < int(depth_points.size()); k++) {
+		float d = spyramid::Distance(result, depth_points[k]);
+		if (d > BAND*accuracy && k != index) continue;
+		if (k == index) band_seed = int(roi_points.size());
+		roi_points.push_back(depth_points[k]);
+		roi_indices.push_back(k);
+		if (d <= accuracy) { inlier_sum += d*d; inliers++; }
+	}
+	double t3 = scapture::Now();
+	pyramid_stats.band_ms = t3 - t2;
+	pyramid_stats.band_points = int(roi_points.size());
+
+	if (inliers > 0 && sqrt(inlier_sum / inliers) <= TOLERANCE*accuracy) {
+		inlier_flags.assign(depth_points.size(), 1);
+		for (int k : roi_indices) {
+			if (spyramid::Distance(result, depth_points[k]) <= accuracy) inlier_flags[k] = 0;
+		}
+		pyramid_stats.early = true;
+		return res;
+	}
+
+	res = fit_subset(band_seed, type);
+	pyramid_stats.refine_ms = scapture::Now() - t3;
+	return res;
+}
+
+// the points within radius of the seed, from the tiles whose bounding boxes reach it.
+// (a tile is a block of the depth grid, so the region is a window of the grid which narrows with depth.)
+int Application::gather_roi(int index, float radius) {
+	const rs::float3 seed = depth_points[index];
+	const float radius2 = radius*radius;
+	int roi_seed = -1;
+
+	roi_points.clear();
+	roi_indices.clear();
+	for (const scapture::Tile& tile : depth_tiles) {
+		float dx = max(max(tile.lo[0] - seed.x, seed.x - tile.hi[0]), 0.f);
+		float dy = max(max(tile.lo[1] - seed.y, seed.y - tile.hi[1]), 0.f);
+		float dz = max(max(tile.lo[2] - seed.z, seed.z - tile.hi[2]), 0.f);
+		if (dx*dx + dy*dy + dz*dz > radius2) continue;
+
+		for (int k = tile.first; k < tile.first + tile.count[0]; k++) {
+			const rs::float3& p = depth_points[k];
+			float px = p.x - seed.x, py = p.y - seed.y, pz = p.z - seed.z;
+			if (px*px + py*py + pz*pz > radius2) continue;
+			if (k == index) roi_seed = int(roi_points.size());
+			roi_points.push_back(p);
+			roi_indices.push_back(k);
+		}
+	}
+	return roi_seed;
+}
+
+void Application::gather_inliers() {
+	int count = getInliersFloat(fs, nullptr, 0); // retrieve the number of inlier points;
+	inlier_points.clear(); inlier_points.reserve(count);
+	inlier_colors.clear(); inlier_colors.reserve(count);
+
+	for (size_t k = 0; k < inlier_flags.size(); k++) {
+		if (!inlier_flags[k]) {
+			inlier_points.push_back(depth_points[k]);
+			inlier_colors.push_back(depth_colors[k]);
+		}
+	}
+}
+
+bool Application::export_ply(const std::string& path, bool inliers) {
+	if (inliers) return ply_writer.submit(path, inlier_points.data(), inlier_colors.data(), inlier_points.size());
+	return ply_writer.submit(path, depth_points.data(), depth_colors.data(), depth_points.size());
+}
+
+void Application::toggle_dump() {
+	dumping = !dumping;
+	if (dumping) {
+		ply_writer.wait();
+		ply_writer.reset_stats();
+		fprintf(stdout, "PLY: dumping every frame into %s/frame_<n>.ply.\n", dump_dir.c_str());
+	}
+	else {
+		ply_writer.wait();
+		sply::PlyWriter::Stats stats = ply_writer.stats();
+		fprintf(stdout, "PLY: %d frames written (%.1f MB, %.1f MB/s), %d dropped.\n", stats.files, stats.bytes / (1024.0*1024.0), stats.mb_per_second(), stats.dropped);
+	}
+}
+
+bool Application::open_result_ring(const char* name, bool with_points) {
+	publish_points = with_points;
+
+	// the points of every source at the largest profile; larger clouds (fused) are truncated, and flagged so.
+	int pixels = depth_intrin.width*depth_intrin.height;
+	for (const scapture::StreamProfile& profile : rig.profiles()) pixels = max(pixels, profile.depth_pixels());
+	return publisher.create(name, 8, uint32_t(pixels*rig.size()));
+}
+
+void Application::publish_result(float arc) {
+	publisher.publish(result, arc, inlier_flags.data(), depth_points.data(), uint32_t(inlier_flags.size()), publish_points);
+	if (primitive_store.active()) primitive_store.append(result, uint32_t(inlier_points.size()), scapture::WallClock(rig.merged_timestamp()));
+}
+
 void Application::run_FindSurface(float x, float y) {
 	float depth;
 	int index = cast_to_point_cloud(x, y, depth);
+	if (accumulating) index = use_fused_cloud(index);
+	index = seed_off_edges(index);
 	hit_position = reinterpret_cast<smath::float3&>(depth_points[index]);
 
 	// point clouds tends to have measurement errors propositional to distance.
-	setFindSurfaceParamFloat(fs, FS_PARAMS::FS_PARAM_ACCURACY, 0.006f + 0.002f*(depth - 1.f));
+	setFindSurfaceParamFloat(fs, FS_PARAMS::FS_PARAM_ACCURACY, fs_params.accuracy_at(depth));
 
-	// if succeeds, the struct "result" will be filled with data.
-	int res = findSurface(fs, type, index, &result);
+	int res = find_surface(index, type);
 
 	switch (res) {
 	case FS_NOT_FOUND:
@@ -512,26 +1250,16 @@ void Application::run_FindSurface(float x, float y) {
 	case FS_LICENSE_UNKNOWN: fprintf(stderr, "FindSurface: license error occurred (FS_LICENSE_UNKNOWN).\n"); return;
 	}
 
-	const unsigned char* flags = getInOutlierFlags(fs);
-	int count = getInliersFloat(fs, nullptr, 0); // retrieve the number of inlier points;
-	inlier_points.clear(); inlier_points.reserve(count);
-	inlier_colors.clear(); inlier_colors.reserve(count);
+	gather_inliers();
 
-	for (int k = 0; k<int(getPointCloudCount(fs)); k++) {
-		if (!flags[k]) {
-			inlier_points.push_back(depth_points[k]);
-			inlier_colors.push_back(depth_colors[k]);
-		}
-	}
+	PrimitiveInstance instance = {};
+	float arc = 0.f; // of a torus
+	smath::float3 bounding_center = {};	// bounding sphere (for selecting the level of detail)
+	float bounding_radius = 0.f;
 
 	switch (result.type) {
 	case FS_FEATURE_TYPE::FS_TYPE_PLANE:
 	{
-		plane_renderer.quad[0] = result.plane_param.ll;
-		plane_renderer.quad[1] = result.plane_param.lr;
-		plane_renderer.quad[2] = result.plane_param.ur;
-		plane_renderer.quad[3] = result.plane_param.ul;
-		
 		using namespace smath;
 		float3 ll = ToFloat3(result.plane_param.ll);
 		float3 lr = ToFloat3(result.plane_param.lr);
@@ -544,6 +1272,16 @@ void Application::run_FindSurface(float x, float y) {
 		float height = Length(vert);
 		float3 normal = Normalize(Cross(hori, vert));
 
+		// maps the unit quad (0, 0)-(1, 1) on the xy-plane to ll-lr-ur-ul.
+		instance.model_matrix = mat4{
+			vert[0], hori[0], normal[0], ll[0],
+			vert[1], hori[1], normal[1], ll[1],
+			vert[2], hori[2], normal[2], ll[2],
+			0, 0, 0, 1
+		};
+		bounding_center = center;
+		bounding_radius = 0.5f*Length(ur - ll);
+
 		fprintf(stdout, "Plane.width=%6.4f\n", width);
 		fprintf(stdout, "     .height=%6.4f\n", height);
 		fprintf(stdout, "     .center=<%6.4f, %6.4f, %6.4f>\n", center[0], center[1], center[2]);
@@ -553,9 +1291,12 @@ void Application::run_FindSurface(float x, float y) {
 	case FS_FEATURE_TYPE::FS_TYPE_SPHERE:
 	{
 		using namespace smath;
-		sphere_renderer.model_matrix = Translate(smath::ToFloat3(result.sphere_param.c))*Scale(result.sphere_param.r);
+		instance.model_matrix = Translate(smath::ToFloat3(result.sphere_param.c))*Scale(result.sphere_param.r);
+		instance.params = float4{ 0, 0, 0, 0 };
 		float radius = result.sphere_param.r;
 		float3 center = ToFloat3(result.sphere_param.c);
+		bounding_center = center;
+		bounding_radius = radius;
 
 		fprintf(stdout, "Sphere.radius=%6.4f\n", radius);
 		fprintf(stdout, "      .center=<%6.4f, %6.4f, %6.4f>\n", center[0], center[1], center[2]);
@@ -579,7 +1320,10 @@ void Application::run_FindSurface(float x, float y) {
 		if (angle > deg1) model_matrix = Rotate(tilt_axis, angle)*model_matrix;
 		model_matrix = Translate(center)*model_matrix;
 
-		cylinder_renderer.model_matrix = model_matrix;
+		instance.model_matrix = model_matrix;
+		instance.params = float4{ 0, 0, 0, 1 };
+		bounding_center = center;
+		bounding_radius = sqrtf(radius*radius + 0.25f*height*height);
 
 		fprintf(stdout, "Cylinder.radius=%6.4f\n", radius);
 		fprintf(stdout, "        .height=%6.4f\n", height);
@@ -605,9 +1349,10 @@ void Application::run_FindSurface(float x, float y) {
 		if (angle > deg1) model_matrix = Rotate(Normalize(Cross(y_axis, cone_axis)), angle)*model_matrix;
 		model_matrix = Translate(center)*model_matrix;
 	
-		cone_renderer.model_matrix = model_matrix;
-		cone_renderer.bottom_radius = bottom_radius;
-		cone_renderer.top_radius = top_radius;
+		instance.model_matrix = model_matrix;
+		instance.params = float4{ top_radius, bottom_radius, 0, 2 };
+		bounding_center = center;
+		bounding_radius = sqrtf(max(top_radius, bottom_radius)*max(top_radius, bottom_radius) + 0.25f*height*height);
 
 		fprintf(stdout, "Cone.top.radius=%6.4f\n", top_radius);
 		fprintf(stdout, "    .bottom.radius=%6.4f\n", bottom_radius);
@@ -618,44 +1363,6 @@ void Application::run_FindSurface(float x, float y) {
 	}
 	case FS_FEATURE_TYPE::FS_TYPE_TORUS:
 	{
-		static auto get_inlier_point_cloud = [&]()->std::vector<smath::float3> {
-			const unsigned char* flags = getInOutlierFlags(fs);
-			int count = getInliersFloat(fs, nullptr, 0);
-			std::vector<smath::float3> inliers(count);
-			getInliersFloat(fs, inliers.data(), count * sizeof(smath::float3));
-
-			return inliers;
-		};
-
-		static auto get_elbow_joint_angle = [&](smath::float3 torus_center, smath::float3 torus_axis, smath::float3& elbow_begin, float& angle) {
-			using namespace smath;
-			std::vector<float3> inliers = get_inlier_point_cloud();
-
-			for (float3& pt : inliers) {
-				// point => vector (center -> point)
-				float3 v = pt - torus_center;
-				// project(point, plane perpendicular to the torus axis and including the torus center)
-				pt = Normalize(Cross(Cross(torus_axis, v), torus_axis));
-			}
-
-			float3 barycentric = std::accumulate(inliers.begin(), inliers.end(), float3(), [](float3& i0, float3& i1) { return i0 + i1; }) / float(inliers.size());
-
-			float3 elbow_middle = Normalize(barycentric);
-
-			// find two extreme ends of the vectors in terms of the angle to the elbow_middle.
-			std::vector<float> angles;
-			angles.reserve(inliers.size());
-			for (float3& pt : inliers) {
-				angles.push_back(AngleBetween(pt, elbow_middle, torus_axis));
-			}
-			
-			auto minmax = std::minmax_element(angles.begin(), angles.end());
-			size_t min_index = minmax.first - angles.begin();
-			size_t max_index = minmax.second - angles.begin();
-			elbow_begin = inliers[max_index];
-			float3 elbow_end = inliers[min_index];
-			angle = PositiveAngleBetween(elbow_begin, elbow_end, torus_axis);
-		};
 		using namespace smath;
 		float mean_radius = result.torus_param.mr;
 		float tube_radius = result.torus_param.tr;
@@ -664,7 +1371,9 @@ void Application::run_FindSurface(float x, float y) {
 		float3 elbow_begin;
 		float angle;
 
-		get_elbow_joint_angle(center, axis, elbow_begin, angle);
+		// the inliers have been gathered above, so the extent of the elbow is measured on them directly.
+		sgeometry::GetArcExtent(inlier_points.data(), inlier_points.size(), sizeof(rs::float3), center, axis, elbow_begin, angle);
+		arc = angle;
 
 		float3 y_axis = { 0, 1, 0 };
 		float3 tilt_axis = Normalize(Cross(y_axis, axis));
@@ -675,10 +1384,10 @@ void Application::run_FindSurface(float x, float y) {
 		float rot_angle = PositiveAngleBetween(tilt_elbow_begin, elbow_begin, rot_axis);
 		mat4 rot = Rotate(rot_axis, rot_angle);
 
-		torus_renderer.model_matrix = Translate(center)*rot*tilt;
-		torus_renderer.mean_radius = mean_radius;
-		torus_renderer.tube_radius = tube_radius;
-		torus_renderer.angle = angle;
+		instance.model_matrix = Translate(center)*rot*tilt;
+		instance.params = float4{ mean_radius, tube_radius, angle, 0 };
+		bounding_center = center;
+		bounding_radius = mean_radius + tube_radius;
 
 		fprintf(stdout, "Torus.mean.radius=%6.4f\n", mean_radius);
 		fprintf(stdout, "     .tube.radius=%6.4f\n", tube_radius);
@@ -688,6 +1397,11 @@ void Application::run_FindSurface(float x, float y) {
 		break;
 	}
 	}
+
+	primitives.push_back(Primitive{ result, instance, bounding_center, bounding_radius });
+	primitives_changed = redraw = true;
+
+	publish_result(arc);
 	
 	inlier_renderer.position_buffer.Data(inlier_points.size(), sizeof(rs::float3), inlier_points.data(), GL_STREAM_DRAW);
 	inlier_renderer.color_buffer.Data(inlier_colors.size(), sizeof(ubyte3), inlier_colors.data(), GL_STREAM_DRAW);
@@ -701,6 +1415,7 @@ void Application::on_cursor_pos(GLFWwindow* window, double x, double y) {
 }
 
 void Application::on_key(GLFWwindow* window, int key, int scancode, int action, int mods) {
+	redraw = true;
 	if (action == GLFW_PRESS) {
 		switch (key) {
 		case GLFW_KEY_ESCAPE: glfwSetWindowShouldClose(window, 1); break;
@@ -715,6 +1430,44 @@ void Application::on_key(GLFWwindow* window, int key, int scancode, int action,
 		case GLFW_KEY_5: type = FS_FEATURE_TYPE::FS_TYPE_TORUS; fprintf(stdout, "FindSurface: using FS_TYPE_TORUS.\n"); break;
 		case GLFW_KEY_HOME: trackball.reset(); break;
 		case GLFW_KEY_END: trackball2.reset(); break;
+		case GLFW_KEY_BACKSPACE: undo_primitive(); break;
+		case GLFW_KEY_DELETE: clear_primitives(); break;
+		case GLFW_KEY_I: use_impostors = !use_impostors; object_inset.dirty = true; fprintf(stdout, "Geometry: using %s.\n", use_impostors ? "ray-cast impostors" : "meshes"); break;
+		case GLFW_KEY_B: benchmark_geometry(); break;
+		case GLFW_KEY_P:
+			if (mods & GLFW_MOD_SHIFT) toggle_dump();
+			else {
+				std::string path = "cloud_" + std::to_string(export_index++) + ".ply";
+				if (export_ply(path, false)) fprintf(stdout, "PLY: saving %s.\n", path.c_str());
+			}
+			break;
+		case GLFW_KEY_L: {
+			std::string path = "inliers_" + std::to_string(export_index++) + ".ply";
+			if (export_ply(path, true)) fprintf(stdout, "PLY: saving %s.\n", path.c_str());
+			break;
+		}
+		case GLFW_KEY_A:
+			adaptive_profile = !adaptive_profile;
+			profile_controller.reset();
+			fprintf(stdout, "Profile: %s.\n", adaptive_profile ? ("adaptive, for a latency budget of " + std::to_string(int(profile_controller.budget)) + " ms").c_str() : "fixed");
+			break;
+		case GLFW_KEY_T:
+			latency.print(stdout);
+			print_loop_stats(stdout);
+			if (accumulating) fusion.print(stdout);
+			if (use_normals && normals_pixels > 0) fprintf(stdout, "Normals: %.2f ms for the latest frame (%.1f ns per pixel).\n", normals_ms, normals_ms*1e6 / normals_pixels);
+			break;
+		case GLFW_KEY_M:
+			if (mods & GLFW_MOD_SHIFT) { fusion.reset(); fprintf(stdout, "Fusion: cleared.\n"); }
+			else toggle_accumulate();
+			break;
+		case GLFW_KEY_F: use_roi = !use_roi; fprintf(stdout, "FindSurface: fitting %s.\n", use_roi ? "the region around the seed" : "the whole point cloud"); break;
+		case GLFW_KEY_N: toggle_normals(); break;
+		case GLFW_KEY_K: use_pyramid = !use_pyramid; fprintf(stdout, "FindSurface: %s.\n", use_pyramid ? "coarse to fine (1/4 resolution, then the points near the coarse surface)" : "at full resolution"); break;
+		case GLFW_KEY_G: use_segments = !use_segments; fprintf(stdout, "FindSurface: %s.\n", use_segments ? "fitting the segment of the seed (cut at depth jumps and creases)" : "not segmenting"); break;
+		case GLFW_KEY_LEFT_BRACKET: switch_profile(rig.profile() - 1); break;
+		case GLFW_KEY_RIGHT_BRACKET: switch_profile(rig.profile() + 1); break;
+		case GLFW_KEY_R: rig.record(!rig.recording()); fprintf(stdout, "Rig: recording %s.\n", rig.recording() ? "started (capture<k>.rsr)" : "stopped"); break;
 		case GLFW_KEY_SLASH: 
 			if (glfwGetKey(window, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS || 
 				glfwGetKey(window, GLFW_KEY_RIGHT_SHIFT) == GLFW_PRESS) {
@@ -743,10 +1496,11 @@ int Application::cast_to_point_cloud(double tx, double ty, float& depth) {
 	rs::float3 color_ray_begin = color_intrin.deproject_from_texcoord({ float(tx), float(ty) }, 0.5f);
 	rs::float3 color_ray_end = color_intrin.deproject_from_texcoord({ float(tx), float(ty) }, 1.0f);
 
-	// transform to depth space coordinates
-	rs::float3 depth_ray_begin = color_to_depth.transform(color_ray_begin);
-	rs::float3 depth_ray_end = color_to_depth.transform(color_ray_end);
-	rs::float3 depth_ray_origin = color_to_depth.transform({});
+	// transform to depth space coordinates, and then to the common frame of the rig.
+	const smath::mat4& extrinsic = rig.reference_extrinsic();
+	rs::float3 depth_ray_begin = scapture::Transform(extrinsic, color_to_depth.transform(color_ray_begin));
+	rs::float3 depth_ray_end = scapture::Transform(extrinsic, color_to_depth.transform(color_ray_end));
+	rs::float3 depth_ray_origin = scapture::Transform(extrinsic, color_to_depth.transform({}));
 
 	using namespace smath;
 
@@ -782,6 +1536,528 @@ int Application::cast_to_point_cloud(double tx, double ty, float& depth) {
 	return index_min_dist;
 }
 
+// the fused cloud replaces the merged one until the next frame; the new serial has it drawn, so that the inliers shown
+// are on the cloud they index (until the next frame, or as long as the rig stalls).
+int Application::use_fused_cloud(int index) {
+	smath::float3 seed = reinterpret_cast<smath::float3&>(depth_points[index]);
+	fusion.extract(fused_points, fused_colors, fused_tiles);
+	if (fused_points.empty()) return index; // nothing fused yet
+
+	depth_points.swap(fused_points);
+	depth_colors.swap(fused_colors);
+	depth_tiles.swap(fused_tiles);
+	depth_normals.clear();
+	frame_serial++;
+	cloud_fused = true;
+	return find_nearest_point(seed);
+}
+
+void Application::toggle_accumulate() {
+	accumulating = !accumulating;
+	if (accumulating) fusion.reset();
+	fprintf(stdout, "Fusion: %s.\n", accumulating ? "accumulating the frames into a voxel map" : "off, fitting the latest frame");
+}
+
+// fuse <frames>: integrates the next frames (turning the accumulation on) and reports the throughput and the memory.
+void Application::fuse_frames(const char* args, FILE* out) {
+	int frames = 30;
+	sscanf(args, "%d", &frames);
+	if (!accumulating) toggle_accumulate();
+
+	int fused = 0;
+	for (; fused < frames && rig.wait_for_frames(1000); fused++) update(0, 0.0);
+	if (fused == 0) { fprintf(out, "error no-frame\n"); return; }
+
+	sfusion::VoxelMap::Stats stats = fusion.stats();
+	fprintf(out, "ok frames=%d fps=%.1f blocks=%d capacity=%d memory=%.1fMB evicted=%lld\n",
+		stats.frames, stats.fps(), stats.blocks, stats.capacity, stats.memory / (1024.0*1024.0), stats.evicted);
+}
+
+// each merged frame in turn, into its range of depth_normals (the rows of a frame are split among the cores).
+void Application::estimate_normals() {
+	depth_normals.resize(depth_points.size());
+	normals_ms = 0.0;
+	normals_pixels = 0;
+	int offset = 0;
+	for (const std::shared_ptr<scapture::Frame>& frame : rig.merged_frames()) {
+		normal_estimator.estimate(*frame, depth_normals.data() + offset);
+		normals_ms += normal_estimator.estimate_ms;
+		normals_pixels += normal_estimator.pixels;
+		offset += int(frame->points.size());
+	}
+}
+
+// at once, so that a stalled or paused rig shows them too.
+void Application::toggle_normals() {
+	use_normals = !use_normals;
+	if (use_normals && !cloud_fused) estimate_normals();
+	else depth_normals.clear();
+	depth_serial = 0; // sent again
+	fprintf(stdout, "Normals: %s.\n", use_normals ? "shading the point cloud and moving the seeds off edges" : "off");
+}
+
+// a seed without a normal (on an edge, a depth jump or noise) moves to the nearest point with one, within touch_r,
+// from the tiles near it.
+int Application::seed_off_edges(int index) {
+	if (index < 0 || depth_normals.size() != depth_points.size()) return index;
+	auto has_normal = [this](int k) { return depth_normals[k].x != 0.f || depth_normals[k].y != 0.f || depth_normals[k].z != 0.f; };
+	if (has_normal(index)) return index;
+
+	float touch_r = 0.f;
+	getFindSurfaceParamFloat(fs, FS_PARAMS::FS_PARAM_TOUCH_R, &touch_r);
+	const rs::float3 seed = depth_points[index];
+	float min_dist = touch_r*touch_r;
+	int nearest = index;
+	for (const scapture::Tile& tile : depth_tiles) {
+		float dx = max(max(tile.lo[0] - seed.x, seed.x - tile.hi[0]), 0.f);
+		float dy = max(max(tile.lo[1] - seed.y, seed.y - tile.hi[1]), 0.f);
+		float dz = max(max(tile.lo[2] - seed.z, seed.z - tile.hi[2]), 0.f);
+		if (dx*dx + dy*dy + dz*dz > min_dist) continue;
+
+		for (int k = tile.first; k < tile.first + tile.count[0]; k++) {
+			const rs::float3& p = depth_points[k];
+			float px = p.x - seed.x, py = p.y - seed.y, pz = p.z - seed.z;
+			float dist = px*px + py*py + pz*pz;
+			if (dist < min_dist && has_normal(k)) {
+				min_dist = dist;
+				nearest = k;
+			}
+		}
+	}
+	return nearest;
+}
+
+int Application::find_nearest_point(smath::float3 seed) {
+	using namespace smath;
+
+	int index_min_dist = -1;
+	float min_dist = FLT_MAX;
+	for (int k = 0; k < int(depth_points.size()); k++) {
+		float3 d = reinterpret_cast<float3&>(depth_points[k]) - seed;
+		float dist = Dot(d, d);
+		if (dist < min_dist) {
+			index_min_dist = k;
+			min_dist = dist;
+		}
+	}
+	return index_min_dist;
+}
+
+void Application::serve(const char* socket_path) {
+	getFindSurfaceParamFloat(fs, FS_PARAMS::FS_PARAM_MEAN_DIST, &default_mean_dist);
+	getFindSurfaceParamFloat(fs, FS_PARAMS::FS_PARAM_TOUCH_R, &default_touch_r);
+	serve_begin = scapture::Now();
+
+	if (socket_path == nullptr) {
+		fprintf(stderr, "Server: reading requests from stdin.\n");
+		serve(stdin, stdout);
+	}
+	else {
+#if !defined(_WIN32) && !defined(_WIN64)
+		signal(SIGPIPE, SIG_IGN); // a client leaving early must not terminate the server.
+
+		int server = socket(AF_UNIX, SOCK_STREAM, 0);
+		sockaddr_un address = {};
+		address.sun_family = AF_UNIX;
+		strncpy(address.sun_path, socket_path, sizeof(address.sun_path) - 1);
+		unlink(socket_path);
+
+		if (server < 0 || bind(server, (sockaddr*)&address, sizeof(address)) < 0 || listen(server, 1) < 0) {
+			fprintf(stderr, "Server: failed to listen on %s.\n", socket_path);
+		}
+		else {
+			fprintf(stderr, "Server: listening on %s.\n", socket_path);
+
+			// one client at a time, until a client sends "quit".
+			bool serving = true;
+			while (serving) {
+				int client = accept(server, nullptr, nullptr);
+				if (client < 0) break;
+
+				FILE* in = fdopen(client, "r");
+				FILE* out = fdopen(dup(client), "w");
+				serving = serve(in, out);
+				fclose(out);
+				fclose(in);
+			}
+			unlink(socket_path);
+		}
+		if (server >= 0) close(server);
+#else
+		fprintf(stderr, "Server: Unix sockets are not supported on this platform; use stdin instead.\n");
+#endif
+	}
+
+	print_stats(stderr);
+	finalize();
+}
+
+// returns false on "quit".
+bool Application::serve(FILE* in, FILE* out) {
+	char request[1024];
+	while (fgets(request, sizeof(request), in)) {
+		bool serving = handle_request(request, out);
+		fflush(out);
+		if (!serving) return false;
+	}
+	return true;
+}
+
+// the type, the inlier count and the parameters of a result, as the responses have them.
+static void PrintResult(FILE* out, const FS_FEATURE_RESULT& r, int inliers) {
+	switch (r.type) {
+	case FS_FEATURE_TYPE::FS_TYPE_PLANE:
+		fprintf(out, "type=plane inliers=%d rms=%g ll=%g,%g,%g lr=%g,%g,%g ur=%g,%g,%g ul=%g,%g,%g\n", inliers, r.rms,
+			r.plane_param.ll[0], r.plane_param.ll[1], r.plane_param.ll[2], r.plane_param.lr[0], r.plane_param.lr[1], r.plane_param.lr[2],
+			r.plane_param.ur[0], r.plane_param.ur[1], r.plane_param.ur[2], r.plane_param.ul[0], r.plane_param.ul[1], r.plane_param.ul[2]);
+		break;
+	case FS_FEATURE_TYPE::FS_TYPE_SPHERE:
+		fprintf(out, "type=sphere inliers=%d rms=%g c=%g,%g,%g r=%g\n", inliers, r.rms,
+			r.sphere_param.c[0], r.sphere_param.c[1], r.sphere_param.c[2], r.sphere_param.r);
+		break;
+	case FS_FEATURE_TYPE::FS_TYPE_CYLINDER:
+		fprintf(out, "type=cylinder inliers=%d rms=%g b=%g,%g,%g t=%g,%g,%g r=%g\n", inliers, r.rms,
+			r.cylinder_param.b[0], r.cylinder_param.b[1], r.cylinder_param.b[2], r.cylinder_param.t[0], r.cylinder_param.t[1], r.cylinder_param.t[2], r.cylinder_param.r);
+		break;
+	case FS_FEATURE_TYPE::FS_TYPE_CONE:
+		fprintf(out, "type=cone inliers=%d rms=%g b=%g,%g,%g t=%g,%g,%g br=%g tr=%g\n", inliers, r.rms,
+			r.cone_param.b[0], r.cone_param.b[1], r.cone_param.b[2], r.cone_param.t[0], r.cone_param.t[1], r.cone_param.t[2], r.cone_param.br, r.cone_param.tr);
+		break;
+	case FS_FEATURE_TYPE::FS_TYPE_TORUS:
+		fprintf(out, "type=torus inliers=%d rms=%g c=%g,%g,%g n=%g,%g,%g mr=%g tr=%g\n", inliers, r.rms,
+			r.torus_param.c[0], r.torus_param.c[1], r.torus_param.c[2], r.torus_param.n[0], r.torus_param.n[1], r.torus_param.n[2], r.torus_param.mr, r.torus_param.tr);
+		break;
+	default:
+		fprintf(out, "type=none inliers=%d\n", inliers);
+	}
+}
+
+/* one request per line, one response per line:
+	pixel <x> <y> [type] [accuracy=<m>] [mean_dist=<m>] [touch_r=<m>]	seed at the normalized pixel (x, y) of the color image
+	point <x> <y> <z> [type] [...]										seed at the nearest point to (x, y, z)
+	stats																number of requests and throughput
+	save cloud|inliers <path>											binary PLY of the latest frame or the inliers of the latest result
+	dump <dir> <frames>													binary PLY of each of the next frames, and the throughput of the writer
+	profile [<index>]													list the stream profiles (and switch to one)
+	roi-bench <seeds> [type]											FindSurface on the whole cloud vs. the region around the seed
+	seg-bench <seeds> [type]											FindSurface on the whole cloud vs. the segment of the seed
+	pyramid-bench <seeds> [type]										FindSurface on the whole cloud vs. coarse to fine
+	fuse <frames>														accumulate the next frames into the voxel map (the seeds then fit it)
+	db [box <x0> <y0> <z0> <x1> <y1> <z1> | nearest <x> <y> <z>]		the primitives stored (with --store): their count, those in a box, or the nearest one
+	quit
+   type: any (default), plane, sphere, cylinder, cone, torus. */
+bool Application::handle_request(const char* request, FILE* out) {
+	char command[16];
+	int offset = 0;
+	if (sscanf(request, "%15s%n", command, &offset) < 1) return true;
+	const char* args = request + offset;
+
+	if (strcmp(command, "quit") == 0) { fprintf(out, "ok\n"); return false; }
+	if (strcmp(command, "stats") == 0) { print_stats(out); return true; }
+	if (strcmp(command, "save") == 0) {
+		char what[16], path[512];
+		if (sscanf(args, "%15s %511s", what, path) < 2 || (strcmp(what, "cloud") != 0 && strcmp(what, "inliers") != 0)) {
+			fprintf(out, "error bad-request save needs cloud|inliers <path>\n");
+			return true;
+		}
+		if (strcmp(what, "cloud") == 0 && rig.wait_for_frames(depth_points.empty() ? 1000 : 0)) update(0, 0.0);
+		if (export_ply(path, strcmp(what, "inliers") == 0)) fprintf(out, "ok\n");
+		else fprintf(out, "error busy\n");
+		return true;
+	}
+	if (strcmp(command, "dump") == 0) { dump_frames(args, out); return true; }
+	if (strcmp(command, "roi-bench") == 0 || strcmp(command, "seg-bench") == 0 || strcmp(command, "pyramid-bench") == 0) { benchmark_subsets(command, args, out); return true; }
+	if (strcmp(command, "fuse") == 0) { fuse_frames(args, out); return true; }
+	if (strcmp(command, "db") == 0) { query_store(args, out); return true; }
+	if (strcmp(command, "profile") == 0) {
+		int index;
+		if (sscanf(args, "%d", &index) == 1 && index != rig.profile() && !switch_profile(index)) { fprintf(out, "error bad-profile\n"); return true; }
+		fprintf(out, "ok profile=%d", rig.profile());
+		for (int k = 0; k < int(rig.profiles().size()); k++) fprintf(out, " %d:%s", k, rig.profiles()[k].name().c_str());
+		fprintf(out, "\n");
+		return true;
+	}
+
+	double t0 = scapture::Now();
+
+	// take the latest merged frame, if any has arrived since the last request.
+	if (rig.wait_for_frames(depth_points.empty() ? 1000 : 0)) update(0, 0.0);
+	if (depth_points.empty()) { fprintf(out, "error no-frame\n"); return true; }
+
+	int index = -1;
+	float depth = 0.f;
+	int n = 0;
+	if (strcmp(command, "pixel") == 0) {
+		float x, y;
+		if (sscanf(args, "%f %f%n", &x, &y, &n) < 2) { fprintf(out, "error bad-request pixel needs <x> <y>\n"); return true; }
+		index = cast_to_point_cloud(x, y, depth);
+		if (accumulating) index = use_fused_cloud(index);
+		index = seed_off_edges(index);
+	}
+	else if (strcmp(command, "point") == 0) {
+		smath::float3 seed;
+		if (sscanf(args, "%f %f %f%n", &seed[0], &seed[1], &seed[2], &n) < 3) { fprintf(out, "error bad-request point needs <x> <y> <z>\n"); return true; }
+		index = find_nearest_point(seed);
+		if (accumulating) index = use_fused_cloud(index);
+		index = seed_off_edges(index);
+		depth = smath::Length(reinterpret_cast<smath::float3&>(depth_points[index]));
+	}
+	else {
+		fprintf(out, "error bad-request unknown command \"%s\"\n", command);
+		return true;
+	}
+	args += n;
+
+	// the same defaults as the mouse click, unless overridden.
+	FS_FEATURE_TYPE request_type = FS_FEATURE_TYPE::FS_TYPE_ANY;
+	float accuracy = fs_params.accuracy_at(depth);
+	float mean_dist = default_mean_dist, touch_r = default_touch_r;
+
+	char token[64];
+	while (sscanf(args, "%63s%n", token, &n) == 1) {
+		args += n;
+		float value;
+		if (sparams::ParseType(token, request_type)) continue;
+		if (sscanf(token, "accuracy=%f", &value) == 1)		accuracy = value;
+		else if (sscanf(token, "mean_dist=%f", &value) == 1)	mean_dist = value;
+		else if (sscanf(token, "touch_r=%f", &value) == 1)		touch_r = value;
+		else {
+			fprintf(out, "error bad-request unknown argument \"%s\"\n", token);
+			return true;
+		}
+	}
+
+	setFindSurfaceParamFloat(fs, FS_PARAMS::FS_PARAM_ACCURACY, accuracy);
+	setFindSurfaceParamFloat(fs, FS_PARAMS::FS_PARAM_MEAN_DIST, mean_dist);
+	setFindSurfaceParamFloat(fs, FS_PARAMS::FS_PARAM_TOUCH_R, touch_r);
+
+	int res = find_surface(index, request_type);
+
+	request_count++;
+	request_time += scapture::Now() - t0;
+
+	switch (res) {
+	case FS_NOT_FOUND: fprintf(out, "error not-found\n"); return true;
+	case FS_UNACCEPTABLE_RESULT: fprintf(out, "error unacceptable-result\n"); return true;
+	case FS_LICENSE_EXPIRED: fprintf(out, "error license-expired\n"); return true;
+	case FS_LICENSE_UNKNOWN: fprintf(out, "error license-unknown\n"); return true;
+	}
+	if (res < 0) { fprintf(out, "error findsurface %d\n", res); return true; }
+
+	gather_inliers();
+	float arc = 0.f;
+	if (result.type == FS_FEATURE_TYPE::FS_TYPE_TORUS) {
+		smath::float3 begin;
+		sgeometry::GetArcExtent(inlier_points.data(), inlier_points.size(), sizeof(rs::float3),
+			smath::ToFloat3(result.torus_param.c), smath::ToFloat3(result.torus_param.n), begin, arc);
+	}
+	publish_result(arc);
+
+	fprintf(out, "ok ");
+	PrintResult(out, result, int(inlier_points.size())); // of the frame: the fit may have stopped on a coarser level
+
+	return true;
+}
+
+// db: the number of primitives stored. db box: the ids of those whose bounding boxes intersect the box, in the order
+// they were stored. db nearest: the one whose bounding box is the nearest to the point (distance 0 inside it).
+void Application::query_store(const char* args, FILE* out) {
+	if (!primitive_store.active()) { fprintf(out, "error no-store\n"); return; }
+	char what[16];
+	int n = 0;
+	float v[6];
+	if (sscanf(args, "%15s%n", what, &n) < 1) { fprintf(out, "ok count=%u\n", primitive_store.size()); return; }
+	args += n;
+
+	if (strcmp(what, "box") == 0 && sscanf(args, "%f %f %f %f %f %f", &v[0], &v[1], &v[2], &v[3], &v[4], &v[5]) == 6) {
+		float box_min[3] = { min(v[0], v[3]), min(v[1], v[4]), min(v[2], v[5]) };
+		float box_max[3] = { max(v[0], v[3]), max(v[1], v[4]), max(v[2], v[5]) };
+		std::vector<uint32_t> ids;
+		primitive_store.intersect(box_min, box_max, ids);
+		std::sort(ids.begin(), ids.end());
+		fprintf(out, "ok count=%d ids=", int(ids.size()));
+		for (size_t k = 0; k < ids.size(); k++) fprintf(out, k > 0 ? ",%u" : "%u", ids[k]);
+		fprintf(out, "\n");
+	}
+	else if (strcmp(what, "nearest") == 0 && sscanf(args, "%f %f %f", &v[0], &v[1], &v[2]) == 3) {
+		float distance;
+		int64_t id = primitive_store.nearest(v, &distance);
+		if (id < 0) { fprintf(out, "error empty\n"); return; }
+		const sdb::Record& record = primitive_store[uint32_t(id)];
+		FS_FEATURE_RESULT stored = {};
+		stored.type = FS_FEATURE_TYPE(record.type);
+		stored.rms = record.rms;
+		memcpy(&stored.plane_param, record.params, sizeof(record.params));
+		fprintf(out, "ok id=%lld distance=%g timestamp=%.3f ", (long long)id, distance, record.timestamp);
+		PrintResult(out, stored, int(record.inlier_count));
+	}
+	else fprintf(out, "error bad-request db needs [box <x0> <y0> <z0> <x1> <y1> <z1> | nearest <x> <y> <z>]\n");
+}
+
+// dump <dir> <frames>: writes the next frames as they arrive, and reports the throughput of the writer.
+void Application::dump_frames(const char* args, FILE* out) {
+	char dir[512];
+	int frames;
+	if (sscanf(args, "%511s %d", dir, &frames) < 2 || frames <= 0) {
+		fprintf(out, "error bad-request dump needs <dir> <frames>\n");
+		return;
+	}
+
+	ply_writer.wait();
+	ply_writer.reset_stats();
+	double t0 = scapture::Now();
+	for (int k = 0; k < frames; k++) {
+		if (!rig.wait_for_frames(1000)) break;
+		update(0, 0.0);
+		export_ply(std::string(dir) + "/frame_" + std::to_string(k) + ".ply", false);
+	}
+	ply_writer.wait();
+	double seconds = (scapture::Now() - t0) / 1000.0;
+
+	sply::PlyWriter::Stats stats = ply_writer.stats();
+	fprintf(out, "ok frames=%d written=%d dropped=%d MB=%.1f writer=%.1fMB/s fps=%.1f\n",
+		frames, stats.files, stats.dropped, stats.bytes / (1024.0*1024.0), stats.mb_per_second(), seconds > 0 ? stats.files / seconds : 0.0);
+}
+
+// roi-bench <seeds> [type]: the same seeds of the latest frame, fitted with the whole cloud and with the region around them.
+// seg-bench <seeds> [type]: the same, with the segment of the seed (the frame is segmented at the first seed only).
+// pyramid-bench <seeds> [type]: the same, coarse to fine, with the time of each stage and the errors of the parameters
+// against the whole cloud (the pyramid is built at the first seed only).
+// agreement: the inliers found by both over the inliers found by either, averaged over the seeds found by both.
+void Application::benchmark_subsets(const char* command, const char* args, FILE* out) {
+	bool segments = strcmp(command, "seg-bench") == 0;
+	bool coarse = strcmp(command, "pyramid-bench") == 0;
+	int seeds;
+	char token[16] = "any";
+	FS_FEATURE_TYPE bench_type = FS_FEATURE_TYPE::FS_TYPE_ANY;
+	if (sscanf(args, "%d %15s", &seeds, token) < 1 || seeds <= 0 || !sparams::ParseType(token, bench_type)) {
+		fprintf(out, "error bad-request %s needs <seeds> [type]\n", command);
+		return;
+	}
+	if (rig.wait_for_frames(depth_points.empty() ? 1000 : 0)) update(0, 0.0);
+	if (depth_points.empty()) { fprintf(out, "error no-frame\n"); return; }
+
+	slatency::Histogram full_ms, roi_ms;
+	int found_full = 0, found_roi = 0, found_both = 0, tries = 0;
+	double agreement = 0.0, roi_size = 0.0;
+	std::vector<unsigned char> full_flags;
+	FS_FEATURE_RESULT full_result = {};
+	bool roi = use_roi, segment = use_segments, pyramid_on = use_pyramid;
+	PyramidStats stages = {};
+	int early = 0;
+	double errors[ssweep::ERRORS] = {};
+	int error_counts[ssweep::ERRORS] = {};
+
+	for (int k = 0; k < seeds; k++) {
+		int index = int((k*7919LL + 17) % depth_points.size()); // spread over the frame
+		float depth = smath::Length(reinterpret_cast<smath::float3&>(depth_points[index]));
+		setFindSurfaceParamFloat(fs, FS_PARAMS::FS_PARAM_ACCURACY, fs_params.accuracy_at(depth));
+
+		use_roi = false;
+		use_segments = false;
+		use_pyramid = false;
+		double t0 = scapture::Now();
+		bool full = find_surface(index, bench_type) >= 0;
+		full_ms.add(scapture::Now() - t0);
+		if (full) {
+			full_flags = inlier_flags;
+			full_result = result;
+		}
+
+		use_roi = !segments && !coarse;
+		use_segments = segments;
+		use_pyramid = coarse;
+		t0 = scapture::Now();
+		bool region = find_surface(index, bench_type) >= 0;
+		roi_ms.add(scapture::Now() - t0);
+		tries += roi_tries;
+		if (segments) roi_size += roi_points.size();
+		else if (coarse) {
+			roi_size += pyramid_stats.band_points;
+			stages.build_ms += pyramid_stats.build_ms;
+			stages.coarse_ms += pyramid_stats.coarse_ms;
+			stages.band_ms += pyramid_stats.band_ms;
+			stages.refine_ms += pyramid_stats.refine_ms;
+			stages.coarse_points = pyramid_stats.coarse_points;
+			early += pyramid_stats.early;
+		}
+		else roi_size += roi_tries > 0 ? roi_points.size() : depth_points.size();
+
+		if (coarse && full && region && result.type == full_result.type) {
+			float e[ssweep::ERRORS];
+			ssweep::MeasureErrors(full_result, result, e);
+			for (int i = 0; i < ssweep::ERRORS; i++) {
+				if (e[i] != e[i]) continue; // NAN: not of this type
+				errors[i] += e[i];
+				error_counts[i]++;
+			}
+		}
+
+		found_full += full;
+		found_roi += region;
+		if (full && region) {
+			int both = 0, either = 0;
+			for (size_t i = 0; i < full_flags.size(); i++) {
+				both += !full_flags[i] && !inlier_flags[i];
+				either += !full_flags[i] || !inlier_flags[i];
+			}
+			agreement += either > 0 ? double(both) / either : 1.0;
+			found_both++;
+		}
+	}
+	use_roi = roi;
+	use_segments = segment;
+	use_pyramid = pyramid_on;
+
+	if (coarse) {
+		auto mean_error = [&](int i) { return error_counts[i] > 0 ? errors[i] / error_counts[i] : 0.0; };
+		fprintf(out, "ok seeds=%d points=%d full=%.3fms,p90=%.3fms pyramid=%.3fms,p90=%.3fms speedup=%.2f found=%d,%d,both=%d agreement=%.3f "
+			"early=%d build=%.3fms coarse=%.3fms band=%.3fms refine=%.3fms coarse_points=%d band_points=%.0f position=%.2fmm axis=%.2fdeg radius=%.2fmm\n",
+			seeds, int(depth_points.size()), full_ms.mean(), full_ms.percentile(0.9), roi_ms.mean(), roi_ms.percentile(0.9),
+			roi_ms.mean() > 0 ? full_ms.mean() / roi_ms.mean() : 0.0, found_full, found_roi, found_both,
+			found_both > 0 ? agreement / found_both : 0.0, early, stages.build_ms / seeds, stages.coarse_ms / seeds, stages.band_ms / seeds,
+			stages.refine_ms / seeds, stages.coarse_points, roi_size / seeds, mean_error(0), mean_error(1), mean_error(2));
+		return;
+	}
+	if (segments) {
+		fprintf(out, "ok seeds=%d points=%d full=%.3fms,p90=%.3fms segment=%.3fms,p90=%.3fms speedup=%.2f found=%d,%d,both=%d agreement=%.3f segment_points=%.0f segmentation=%.3fms\n",
+			seeds, int(depth_points.size()), full_ms.mean(), full_ms.percentile(0.9), roi_ms.mean(), roi_ms.percentile(0.9),
+			roi_ms.mean() > 0 ? full_ms.mean() / roi_ms.mean() : 0.0, found_full, found_roi, found_both,
+			found_both > 0 ? agreement / found_both : 0.0, roi_size / seeds, segmenter.segment_ms);
+		return;
+	}
+	fprintf(out, "ok seeds=%d points=%d full=%.3fms,p90=%.3fms roi=%.3fms,p90=%.3fms speedup=%.2f found=%d,%d,both=%d agreement=%.3f roi_points=%.0f tries=%.2f\n",
+		seeds, int(depth_points.size()), full_ms.mean(), full_ms.percentile(0.9), roi_ms.mean(), roi_ms.percentile(0.9),
+		roi_ms.mean() > 0 ? full_ms.mean() / roi_ms.mean() : 0.0, found_full, found_roi, found_both,
+		found_both > 0 ? agreement / found_both : 0.0, roi_size / seeds, double(tries) / seeds);
+}
+
+// since the previous print: a loop idle (without frames nor input) should neither redraw nor wake up.
+void Application::print_loop_stats(FILE* out) {
+	double now = scapture::Now();
+	double seconds = max(now - loop_stats.begin, 1.0) / 1000.0;
+	fprintf(out, "Loop: %.1f redraws/s, %.1f frames/s, %.1f wakeups/s, busy %.1f%% of the time (over %.1f s).\n",
+		loop_stats.redraws / seconds, loop_stats.frames / seconds, loop_stats.wakeups / seconds,
+		100.0*(1.0 - loop_stats.waiting / (1000.0*seconds)), seconds);
+	const sgl::RenderQueue::Stats& queue = render_queue.stats;
+	double redraws = max(loop_stats.redraws, 1);
+	fprintf(out, "Render queue: per redraw %.1f packets in %.1f passes, %.1f changes (%.1f programs, %.1f vertex arrays, %.1f textures, %.1f states, %.1f uniforms; %.1f unchanged uniforms left out).\n",
+		queue.packets / redraws, queue.flushes / redraws, queue.changes() / redraws, queue.programs / redraws, queue.vertex_arrays / redraws,
+		queue.textures / redraws, queue.states / redraws, queue.uniforms / redraws, queue.uniforms_skipped / redraws);
+	render_queue.stats = sgl::RenderQueue::Stats();
+	loop_stats = LoopStats();
+	loop_stats.begin = now;
+}
+
+void Application::print_stats(FILE* out) {
+	double elapsed = scapture::Now() - serve_begin;
+	fprintf(out, "ok requests=%d throughput=%.2f/s busy=%.2f/s mean=%.3fms\n",
+		request_count,
+		elapsed > 0 ? 1000.0*request_count / elapsed : 0.0,				// over the whole session (including idle time)
+		request_time > 0 ? 1000.0*request_count / request_time : 0.0,		// while handling requests
+		request_count > 0 ? request_time / request_count : 0.0);
+}
+
 void Application::prompt_usage() {
 	fprintf(stdout, "Keyboard input\n");
 	fprintf(stdout, "1: Plane\n");
@@ -794,6 +2070,22 @@ void Application::prompt_usage() {
 	fprintf(stdout, "O: switch to object view (point cloud)\n");
 	fprintf(stdout, "HOME: reset depth camera view\n");
 	fprintf(stdout, "END: reset object view\n");
+	fprintf(stdout, "BACKSPACE: remove the latest primitive\n");
+	fprintf(stdout, "DELETE: remove all primitives\n");
+	fprintf(stdout, "I: switch between meshes and ray-cast impostors for spheres, cylinders and cones\n");
+	fprintf(stdout, "B: benchmark the geometry rendering (meshes vs. impostors)\n");
+	fprintf(stdout, "R: start/stop recording every source into replay files\n");
+	fprintf(stdout, "A: switch the stream profile to hold the latency budget (on/off)\n");
+	fprintf(stdout, "[ / ]: step the stream profile down/up\n");
+	fprintf(stdout, "F: fit the region around the seed only, or the whole point cloud\n");
+	fprintf(stdout, "G: fit the segment of the seed only (cut at depth jumps and creases)\n");
+	fprintf(stdout, "K: fit coarse to fine (a 1/4 resolution level of the depth image first)\n");
+	fprintf(stdout, "N: estimate the normals of the points (to shade them and to move the seeds off edges)\n");
+	fprintf(stdout, "T: print the latency histograms (capture to photon, click to result)\n");
+	fprintf(stdout, "M: accumulate the frames into a voxel map and fit it, or fit the latest frame (Shift+M: clear the map)\n");
+	fprintf(stdout, "P: save the point cloud (binary PLY, in the background)\n");
+	fprintf(stdout, "Shift+P: start/stop saving every frame\n");
+	fprintf(stdout, "L: save the inliers of the latest primitive\n");
 	fprintf(stdout, "ESC: exit\n");
 	fprintf(stdout, "Mouse input\n");
 	fprintf(stdout, "Left click: find primitives (in color camera view)\n");
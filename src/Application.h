@@ -1,6 +1,9 @@
 #pragma once
+#include <algorithm>
 #include <numeric>
 #include <functional>
+#include <future>
+#include <unordered_map>
 
 #if defined(_MSC_VER)
 
@@ -24,47 +27,156 @@
 
 #endif
 
+#include "capture.h"
+#include "result_publisher.h"
+#include "primitive_store.h"
+#include "ply_writer.h"
+#include "latency.h"
+#include "fs_params.h"
+#include "fusion.h"
+#include "segmentation.h"
+#include "normals.h"
+#include "pyramid.h"
 #include "smath.h"
 #include "sgeometry.h"
 #include "shader_resources.h"
 #include "opengl_wrapper.h"
+#include "offscreen.h"
 #include "Renderer.h"
 #include "camera.h"
 
-using ubyte3 = struct { unsigned char r, g, b; };
-
 class Application {
 
 	// FindSurface ***************************
 	FIND_SURFACE_CONTEXT fs;
 	FS_FEATURE_RESULT result = {};
 	FS_FEATURE_TYPE type = FS_FEATURE_TYPE::FS_TYPE_ANY;
+	sparams::Params fs_params;
+
+	// region of interest: FindSurface is given the points around the seed only, taken from the tiles near it,
+	// and the region grows when the fit reaches its border.
+	bool use_roi = false;
+	std::vector<rs::float3> roi_points;
+	std::vector<int> roi_indices;		// into depth_points
+	int roi_tries = 0;					// of the latest fit
+	std::vector<unsigned char> inlier_flags; // of depth_points by the latest fit (0: inlier)
 
 	bool init_FindSurface();
 	void run_FindSurface(float x, float y);
+	int find_surface(int index, FS_FEATURE_TYPE type);
+	int gather_roi(int index, float radius); // returns the index of the seed in roi_points
+	int fit_subset(int subset_seed, FS_FEATURE_TYPE type); // roi_points, into inlier_flags of depth_points
+	void benchmark_subsets(const char* command, const char* args, FILE* out);
+
+	// segmentation: FindSurface is given the segment of the seed (cut at depth jumps and creases) in the depth image
+	// it was seen in, and the points of the other sources in the bounding box of the segment.
+	bool use_segments = false;
+	ssegment::Segmenter segmenter;
+	std::shared_ptr<scapture::Frame> segmented_frame; // the last one segmented
+	int gather_segment(int index); // into roi_points; returns the index of the seed in them, or -1
+	int merged_frame_of(int index, int& offset) const; // the merged frame of a point of depth_points, and its first point
+
+	// coarse to fine: FindSurface is first run on a coarse level of the depth pyramid of the frame of the seed, then at
+	// full resolution on the points near the coarse surface, unless they already fit it within the tolerance.
+	bool use_pyramid = false;
+	std::vector<spyramid::Level> pyramid;
+	std::shared_ptr<scapture::Frame> pyramid_frame; // the last one built
+	std::vector<rs::float3> coarse_points;
+	struct PyramidStats {
+		double build_ms, coarse_ms, band_ms, refine_ms;
+		int coarse_points, band_points;
+		bool early; // the coarse result was kept
+	} pyramid_stats = {};
+
+	int fit_pyramid(int index, FS_FEATURE_TYPE type);
+
+	// accumulation: the frames are fused into a voxel map, whose surface is fitted instead of the latest frame.
+	sfusion::VoxelMap fusion;
+	bool accumulating = false;
+	std::vector<rs::float3> fused_points;
+	std::vector<ubyte3> fused_colors;
+	std::vector<scapture::Tile> fused_tiles;
+	bool cloud_fused = false; // depth_points hold the fused cloud, not the merged frames
+
+	int use_fused_cloud(int index); // returns the index of the fused point nearest to depth_points[index]
+	void toggle_accumulate();
+	void fuse_frames(const char* args, FILE* out);
+
+	// normals: of every point of the merged frames (zero on edges), to shade the cloud and to move the seeds off edges.
+	bool use_normals = false;
+	snormal::Estimator normal_estimator;
+	std::vector<rs::float3> depth_normals;	// of depth_points, unless empty
+	double normals_ms = 0.0;				// of the latest frame (all its sources)
+	int normals_pixels = 0;
+
+	void estimate_normals();
+	void toggle_normals();
+	int seed_off_edges(int index); // returns the index of the seed to fit from
+
+	// results shared with other processes ***************************
+	sipc::ResultPublisher publisher;
+	bool publish_points = false;
+	sdb::PrimitiveStore primitive_store; // every result, kept across sessions
+
+	void publish_result(float arc); // into the ring and the store (arc: of a torus result, or 0)
+	void query_store(const char* args, FILE* out);
+
+	// point cloud export ***************************
+	sply::PlyWriter ply_writer;
+	bool dumping = false;		// every frame into dump_dir
+	std::string dump_dir = ".";
+	int dump_index = 0, export_index = 0;
+
+	void gather_inliers();
+	bool export_ply(const std::string& path, bool inliers);
+	void toggle_dump();
+	void dump_frames(const char* args, FILE* out);
 	void release_FindSurface();
 
+	// detected primitives (kept until cleared) ***************************
+	struct Primitive {
+		FS_FEATURE_RESULT result;
+		PrimitiveInstance instance;
+		smath::float3 bounding_center;
+		float bounding_radius;
+	};
+	std::vector<Primitive> primitives;
+	std::vector<int> primitive_lods; // level of detail of each primitive when the instance buffer was last written
+	bool primitives_changed = false; // the instance buffer is stale (until upload_primitives(), in COLOR or OBJECT mode)
+
+	void undo_primitive();
+	void clear_primitives();
+	void upload_primitives();
+
 	// Intel RealSense ***************************
 	rs::context ctx;
-	rs::device* dev = nullptr;
-	rs::intrinsics depth_intrin;
-	rs::extrinsics depth_to_color;
+	scapture::Rig rig;			// one capture thread per source, merged into depth_points
+	rs::intrinsics depth_intrin;	// of the reference source (the first one), which the color view shows
 	rs::extrinsics color_to_depth;
 	rs::intrinsics color_intrin;
-	float scale = 0.f;
 
-	bool init_RealSense();
+	// stream profile: stepped by the controller to hold its latency budget, or by hand.
+	scapture::ProfileController profile_controller;
+	bool adaptive_profile = false;
+
+	bool init_RealSense(const char* rig_config); // on a background task at startup
 	int cast_to_point_cloud(double tx, double ty, float& depth);
+	bool switch_profile(int index);
+	void apply_profile(); // when the merged frames come with other intrinsics
 	void release_RealSense();
 
 	// data container ***************************
 	std::vector<rs::float3> depth_points;
 	std::vector<ubyte3> depth_colors;
 
+	std::vector<scapture::Tile> depth_tiles; // each tile is a contiguous range of depth_points
+
 	std::vector<rs::float3> inlier_points;
 	std::vector<ubyte3> inlier_colors;
 
-	uint8_t* color_image = nullptr;
+	std::vector<uint8_t> color_image;
+	unsigned long long frame_serial = 0; // of the merged frame, and of the ones last sent to the GPU
+	unsigned long long depth_serial = 0, color_serial = 0;
 
 	void init_data();
 
@@ -76,7 +188,13 @@ class Application {
 	CylinderRenderer cylinder_renderer;
 	ConeRenderer cone_renderer;
 	TorusRenderer torus_renderer;
+	ImpostorRenderer impostor_renderer;
+	bool use_impostors = false;
+	sgl::Program shaded_programs[3]; // of the sphere, cylinder and cone meshes, filled and shaded as the impostors are
+	bool filled_meshes = false;		 // drawn with shaded_programs instead of in wireframe (benchmark_geometry)
 	ImageRenderer image_renderer;
+	InsetRenderer object_inset; // the inliers and the primitives, in the corner of the color image
+	sgl::RenderQueue render_queue; // every draw of the renderers, flushed per pass
 
 	std::map<const char*, sgl::Program> programs;
 	std::map<const char*, sgl::VertexArray> vertex_arrays;
@@ -88,21 +206,59 @@ class Application {
 	sgl::Buffer PBOs[2];
 
 	void init_OpenGL();
+	void allocate_images(); // in the size of the color images
 	void release_OpenGL();
 
 	smath::float3 hit_position = {};
 	scamera::Trackball trackball = {};
 	scamera::Trackball trackball2 = {};
 
+	// headless detection server ***************************
+	bool headless = false;	// no window, no GL context
+	float default_mean_dist = 0.f, default_touch_r = 0.f;
+	int request_count = 0;
+	double serve_begin = 0.0, request_time = 0.0; // in ms.
+
+	bool serve(FILE* in, FILE* out);
+	bool handle_request(const char* request, FILE* out);
+	int find_nearest_point(smath::float3 seed);
+	void print_stats(FILE* out);
+
+	// latency (capture to photon) ***************************
+	slatency::Tracker latency;
+	std::deque<std::pair<GLsync, slatency::FrameTag>> fences; // inserted after the swaps, oldest first
+
+	void poll_fences();
+
 	// GLEW, GLFW ***************************
 	GLFWwindow* window = nullptr;
+	double startup_begin = 0.0;	// in ms.
+	bool first_frame_shown = false;
+
+	bool init_window(); // and OpenGL
 	int width = 1280, height = 960;
+	void framebuffer_size(int& width, int& height); // of the window, or of the offscreen framebuffer
+
+	// offscreen: no window, drawn into a framebuffer of a fixed size (for benchmark_render()).
+	bool use_offscreen = false;
+	sgl::OffscreenContext offscreen;
+
+	bool init_offscreen(); // and OpenGL
 	const char* title = "FindSurface Demo (Intel RealSense Devices)";
 
 	// circular queue for averaging frame rate (in ms.)
 	int t_index = 0; 
 	double ms_log[60];
 
+	// render on demand ***************************
+	bool redraw = true; // asked by the input, the window or the primitives, besides new frames and camera motions
+	struct LoopStats {
+		double begin = 0.0, waiting = 0.0; // in ms.
+		int wakeups = 0, redraws = 0, frames = 0;
+	} loop_stats;
+
+	void print_loop_stats(FILE* out);
+
 	enum class SCREEN_MODE { DEPTH, COLOR, OBJECT } screen_mode = SCREEN_MODE::COLOR;
 	
 	// behaviors ***************************
@@ -110,9 +266,11 @@ class Application {
 	void render(int frame, double time_elapsed);
 	
 	void render_depth();
-	void render_color();
+	void render_color(unsigned int state = sgl::DEPTH_TEST);
 	void render_inlier();
 	void render_geometry();
+	void make_test_primitives(int count); // a grid of spheres, cylinders and cones in front of the object view
+	void benchmark_geometry();
 	void finalize();
 
 public:
@@ -125,6 +283,18 @@ public:
 
 	// 
 	void prompt_usage();
-	bool init();
+	void set_params(const sparams::Params& params) { fs_params = params; } // before init
+	bool init(const char* rig_config = nullptr, bool headless = false);
 	void run();
+	void serve(const char* socket_path = nullptr); // headless: serve detection requests on stdin/stdout or a Unix socket
+	bool open_result_ring(const char* name, bool with_points); // publish every result (and the point cloud, optionally) into shared memory
+	bool open_primitive_store(const char* path) { return primitive_store.open(path); } // append every result to a file
+	void set_latency_budget(double ms); // and switch the stream profile to hold it
+	void set_roi(bool on) { use_roi = on; }
+	void set_segments(bool on) { use_segments = on; }
+	void set_normals(bool on) { use_normals = on; }
+	void set_pyramid(bool on) { use_pyramid = on; }
+	void set_fusion(const sfusion::VoxelMap::Params& params, bool on) { fusion.params = params; accumulating = on; } // before init
+	void set_offscreen(int width, int height) { use_offscreen = true; this->width = width; this->height = height; } // before init
+	void benchmark_render(int frames, FILE* out); // offscreen: frames/s and GPU time of each screen mode over the frames of the rig
 };
\ No newline at end of file
@@ -1,155 +1,144 @@
 #pragma once
 #include "smath.h"
 #include "opengl_wrapper.h"
+#include "render_queue.h"
+#include "sgeometry.h"
+
+// the uniforms set through the render queue.
+static const int VIEW_MATRIX = sgl::RenderQueue::Intern("view_matrix");
+static const int PROJECTION_MATRIX = sgl::RenderQueue::Intern("projection_matrix");
+static const int SHADED = sgl::RenderQueue::Intern("shaded");
+static const int COLOR_TEXTURE = sgl::RenderQueue::Intern("color_texture");
+static const int INSET_TEXTURE = sgl::RenderQueue::Intern("inset_texture");
 
 struct Renderer {
 	sgl::Program program;
 	sgl::VertexArray vertex_array;
 };
 
+// per-instance attributes of a detected primitive (locations 2 ~ 7 of the geometry shaders).
+struct PrimitiveInstance {
+	smath::mat4 model_matrix;	// row-major
+	smath::float4 params;		// cone: (top radius, bottom radius), torus: (mean radius, tube radius, arc angle)
+								// w: shape of the impostor path (0: sphere, 1: cylinder, 2: cone)
+	smath::float4 color;
+};
+
 struct GeometryRenderer : Renderer {
 	sgl::VertexBuffer position_buffer;
 	sgl::IndexBuffer index_buffer;
+	sgl::VertexBuffer instance_buffer;
 
 	smath::mat4 view_matrix;
 	smath::mat4 projection_matrix;
-};
 
-struct PlaneRenderer : GeometryRenderer {
-	sgl::DrawArrays draw;
+	// range of the instances of this type in instance_buffer, for each level of detail.
+	GLuint base_instance[sgeometry::LOD_COUNT] = {};
+	GLsizei instance_count[sgeometry::LOD_COUNT] = {};
 
-	float* quad[4] = { nullptr, };
-	
-	void render() {
-		vertex_array.Bind();
-		program.Use();
-		program.Uniform3f("color", 1, 0, 0);
-		program.Uniform3fv("quad[0]", quad[0]);
-		program.Uniform3fv("quad[1]", quad[1]);
-		program.Uniform3fv("quad[2]", quad[2]);
-		program.Uniform3fv("quad[3]", quad[0]);
-		program.Uniform3fv("quad[4]", quad[2]);
-		program.Uniform3fv("quad[5]", quad[3]);
-		program.UniformMatrix4fv("view_matrix", view_matrix);
-		program.UniformMatrix4fv("projection_matrix", projection_matrix);
-
-		draw();
-
-		program.Use(false);
-		vertex_array.Bind(false);
+	bool empty() const {
+		for (int lod = 0; lod < sgeometry::LOD_COUNT; lod++) if (instance_count[lod] > 0) return false;
+		return true;
 	}
-};
 
-struct SphereRenderer : GeometryRenderer {
-	sgl::DrawElementsBaseVertex draw;
-
-	smath::mat4 model_matrix;
-	void render() {
-		vertex_array.Bind();
-		program.Use();
-		
-		program.Uniform3f("color", 1, 0, 0);
-		program.UniformMatrix4fv("model_matrix", model_matrix);
-		program.UniformMatrix4fv("view_matrix", view_matrix);
-		program.UniformMatrix4fv("projection_matrix", projection_matrix);
-
-		draw();
-
-		program.Use(false);
-		vertex_array.Bind(false);
+	// a packet per level of detail with instances, sharing the program and the uniforms.
+	template <typename Draw> void submit_lods(sgl::RenderQueue& queue, const Draw (&draw)[sgeometry::LOD_COUNT], unsigned int state) {
+		for (int lod = 0; lod < sgeometry::LOD_COUNT; lod++) {
+			if (instance_count[lod] == 0) continue;
+			Draw lod_draw = draw[lod];
+			lod_draw.instancecount = instance_count[lod];
+			lod_draw.baseinstance = base_instance[lod];
+			queue.submit(program.ID, vertex_array.ID, 0, state, [lod_draw]() mutable { lod_draw(); });
+			queue.UniformMatrix4fv(VIEW_MATRIX, view_matrix);
+			queue.UniformMatrix4fv(PROJECTION_MATRIX, projection_matrix);
+		}
 	}
 };
 
-struct CylinderRenderer : GeometryRenderer {
-	sgl::DrawElementsBaseVertex draw;
+struct PlaneRenderer : GeometryRenderer {
+	sgl::DrawArraysInstancedBaseInstance draw[sgeometry::LOD_COUNT]; // the same quad for all levels
 
-	smath::mat4 model_matrix;
-	void render() {
-		vertex_array.Bind();
-		program.Use();
+	void submit(sgl::RenderQueue& queue, unsigned int state) { submit_lods(queue, draw, state); }
+};
+
+struct SphereRenderer : GeometryRenderer {
+	sgl::DrawElementsInstancedBaseVertexBaseInstance draw[sgeometry::LOD_COUNT];
 
-		program.Uniform3f("color", 1, 0, 0);
-		program.UniformMatrix4fv("model_matrix", model_matrix);
-		program.UniformMatrix4fv("view_matrix", view_matrix);
-		program.UniformMatrix4fv("projection_matrix", projection_matrix);
+	void submit(sgl::RenderQueue& queue, unsigned int state) { submit_lods(queue, draw, state); }
+};
 
-		draw();
+struct CylinderRenderer : GeometryRenderer {
+	sgl::DrawElementsInstancedBaseVertexBaseInstance draw[sgeometry::LOD_COUNT];
 
-		program.Use(false);
-		vertex_array.Bind(false);
-	}
+	void submit(sgl::RenderQueue& queue, unsigned int state) { submit_lods(queue, draw, state); }
 };
 
 struct ConeRenderer : GeometryRenderer {
-	sgl::DrawElementsBaseVertex draw;
-
-	float top_radius;
-	float bottom_radius;
-	smath::mat4 model_matrix;
-	void render() {
-		vertex_array.Bind();
-		program.Use();
-
-		program.Uniform3f("color", 1, 0, 0);
-		program.Uniform1f("top_radius", top_radius);
-		program.Uniform1f("bottom_radius", bottom_radius);
-		program.UniformMatrix4fv("model_matrix", model_matrix);
-		program.UniformMatrix4fv("view_matrix", view_matrix);
-		program.UniformMatrix4fv("projection_matrix", projection_matrix);
-
-		draw();
-
-		program.Use(false);
-		vertex_array.Bind(false);
-	}
+	sgl::DrawElementsInstancedBaseVertexBaseInstance draw[sgeometry::LOD_COUNT];
+
+	void submit(sgl::RenderQueue& queue, unsigned int state) { submit_lods(queue, draw, state); }
 };
 
 struct TorusRenderer : GeometryRenderer {
-	sgl::DrawElementsBaseVertex draw;
-
-	float angle;
-	float mean_radius;
-	float tube_radius;
-	smath::mat4 model_matrix;
-	void render() {
-		vertex_array.Bind();
-		program.Use();
-
-		program.Uniform3f("color", 1, 0, 0);
-		program.Uniform1f("mean_radius", mean_radius);
-		program.Uniform1f("tube_radius", tube_radius);
-		program.UniformMatrix4fv("model_matrix", model_matrix);
-		program.UniformMatrix4fv("view_matrix", view_matrix);
-		program.UniformMatrix4fv("projection_matrix", projection_matrix);
-
-		int count = int(std::ceil((draw.count / 60)*angle / (2.f*smath::PI))) * 60;
-		glDrawElementsBaseVertex(draw.mode, count, draw.type, draw.indices, draw.basevertex);
-
-		program.Use(false);
-		vertex_array.Bind(false);
+	sgl::DrawElementsInstancedBaseVertexBaseInstance draw[sgeometry::LOD_COUNT];
+
+	// the arc angle of each instance is applied in the vertex shader.
+	void submit(sgl::RenderQueue& queue, unsigned int state) { submit_lods(queue, draw, state); }
+};
+
+// Alternate path for spheres, cylinders and cones: one screen-aligned quad per instance,
+// and the analytic surface is intersected in the fragment shader (writing gl_FragDepth).
+struct ImpostorRenderer : Renderer {
+	smath::mat4 view_matrix;
+	smath::mat4 projection_matrix;
+
+	GLuint base_instance = 0;
+	GLsizei instance_count = 0;
+
+	sgl::DrawArraysInstancedBaseInstance draw;
+
+	void submit(sgl::RenderQueue& queue, unsigned int state) {
+		if (instance_count == 0) return;
+		sgl::DrawArraysInstancedBaseInstance quads = draw;
+		quads.instancecount = instance_count;
+		quads.baseinstance = base_instance;
+		queue.submit(program.ID, vertex_array.ID, 0, state, [quads]() mutable { quads(); });
+		queue.UniformMatrix4fv(VIEW_MATRIX, view_matrix);
+		queue.UniformMatrix4fv(PROJECTION_MATRIX, projection_matrix);
 	}
 };
 
 struct PointCloudRenderer : Renderer {
 	sgl::VertexBuffer position_buffer;
 	sgl::VertexBuffer color_buffer;
+	sgl::VertexBuffer normal_buffer; // at location 2, read only if shaded (zero normals are not shaded)
+	bool shaded = false;
 
 	smath::mat4 view_matrix;
 	smath::mat4 projection_matrix;
 
 	sgl::DrawArrays draw;
 
-	void render() {
-		vertex_array.Bind();
-		program.Use();
-
-		program.UniformMatrix4fv("view_matrix", view_matrix);
-		program.UniformMatrix4fv("projection_matrix", projection_matrix);
-
-		glDrawArrays(draw.mode, 0, position_buffer.count);
-
-		program.Use(false);
-		vertex_array.Bind(false);
+	// if tiled, only these ranges of the buffers are drawn (by a single glMultiDrawArrays).
+	bool tiled = false;
+	std::vector<GLint> firsts;
+	std::vector<GLsizei> counts;
+
+	// drawn when the queue is flushed: the ranges are read then.
+	void submit(sgl::RenderQueue& queue, unsigned int state) {
+		queue.submit(program.ID, vertex_array.ID, 0, state, [this]() {
+			// (the normals are an attribute of the vertex array, enabled while it is bound.)
+			if (shaded) glEnableVertexAttribArray(2);
+			else glDisableVertexAttribArray(2);
+
+			if (tiled) {
+				if (!firsts.empty()) glMultiDrawArrays(draw.mode, firsts.data(), counts.data(), GLsizei(firsts.size()));
+			}
+			else glDrawArrays(draw.mode, 0, position_buffer.count);
+		});
+		queue.UniformMatrix4fv(VIEW_MATRIX, view_matrix);
+		queue.UniformMatrix4fv(PROJECTION_MATRIX, projection_matrix);
+		queue.Uniform1i(SHADED, int(shaded));
 	}
 };
 
@@ -159,41 +148,114 @@ struct ImageRenderer : Renderer {
 
 	sgl::DrawArrays draw;
 
-	void render(int width, int height, uint8_t* color_image) {
-		// 1. PBO ping pong
-		static int index = 0;
-		int next_index = 0;
-
-		index = (index + 1) % 2;
-		next_index = (index + 1) % 2;
-
-		// 2. color image data captured from Intel RealSense device will be transferred from PBO to texture
-		// The data was sent to PBO by the code below when the previous frame is rendered.
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, texture);
-		PBO[index].Bind();
+	int index = 0;			// the PBO transferred to the texture last
+	bool pending = false;	// the other one holds an image not transferred yet
+
+	// new_image is false when color_image is the one passed last: nothing is sent to the GPU then.
+	void upload(int width, int height, uint8_t* color_image, bool new_image = true) {
+		if (new_image) {
+			// 1. PBO ping pong
+			index = (index + 1) % 2;
+			int next_index = (index + 1) % 2;
+
+			// 2. color image data captured from Intel RealSense device will be transferred from PBO to texture
+			// The data was sent to PBO by the code below when the previous frame is rendered.
+			glActiveTexture(GL_TEXTURE0);
+			glBindTexture(GL_TEXTURE_2D, texture);
+			PBO[index].Bind();
+
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+
+			// 3. data transfer from memory (CPU) to PBO (GPU)
+			// Now we send new data to PBO, and it will be transferred to the texture when the next frame is rendered.
+			GLsizeiptr data_size = width*height * 3;
+			PBO[next_index].Data(data_size, nullptr, GL_STREAM_DRAW);
+
+			GLubyte*ptr = (GLubyte*)PBO[next_index].Map(GL_WRITE_ONLY);
+			if (ptr) {
+				memcpy(ptr, color_image, data_size);
+				PBO[next_index].Unmap();
+			}
+			pending = true;
+		}
+		else if (pending) {
+			// no next frame to wait for: the image sent last is transferred now (the next one will transfer it again).
+			glActiveTexture(GL_TEXTURE0);
+			glBindTexture(GL_TEXTURE_2D, texture);
+			PBO[(index + 1) % 2].Bind();
+
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+			pending = false;
+		}
+	}
 
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+	// 4. render the color image to screen.
+	void submit(sgl::RenderQueue& queue, unsigned int state) {
+		queue.submit(program.ID, vertex_array.ID, texture, state, []() { glDrawArrays(GL_TRIANGLES, 0, 6); });
+		queue.Uniform1i(COLOR_TEXTURE, 0);
+	}
+};
+// a view rendered into a texture, drawn as a quad as long as its contents are unchanged.
+struct InsetRenderer : Renderer {
+	GLuint framebuffer = 0;
+	GLuint texture = 0;
+	GLuint depth_buffer = 0;
+	int width = 0, height = 0;
+	bool dirty = true; // to be rendered again before it is drawn
+	GLuint screen = 0; // the framebuffer bound again by end() (0: the window's)
+
+	void init() {
+		glGenFramebuffers(1, &framebuffer);
+		glGenTextures(1, &texture);
+		glGenRenderbuffers(1, &depth_buffer);
+	}
 
-		// 3. data transfer from memory (CPU) to PBO (GPU)
-		// Now we send new data to PBO, and it will be transferred to the texture when the next frame is rendered.
-		GLsizeiptr data_size = width*height * 3;
-		PBO[next_index].Data(data_size, nullptr, GL_STREAM_DRAW);
+	void release() {
+		glDeleteFramebuffers(1, &framebuffer);
+		glDeleteTextures(1, &texture);
+		glDeleteRenderbuffers(1, &depth_buffer);
+	}
 
-		GLubyte*ptr = (GLubyte*)PBO[next_index].Map(GL_WRITE_ONLY);
-		if (ptr) {
-			memcpy(ptr, color_image, data_size);
-			PBO[next_index].Unmap();
+	// binds the framebuffer, in the size of the inset on screen, if the contents are dirty (or the size has changed):
+	// they are rendered then, until end(). returns false if the texture is up to date.
+	bool begin(int width, int height) {
+		if (width != this->width || height != this->height) {
+			this->width = width;
+			this->height = height;
+
+			glBindTexture(GL_TEXTURE_2D, texture);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+			glBindTexture(GL_TEXTURE_2D, 0);
+
+			glBindRenderbuffer(GL_RENDERBUFFER, depth_buffer);
+			glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+			glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+			glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+			glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth_buffer);
+			if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) fprintf(stderr, "OpenGL: the inset framebuffer is incomplete.\n");
+			glBindFramebuffer(GL_FRAMEBUFFER, screen);
+			dirty = true;
 		}
+		if (!dirty) return false;
 
-		// 4. render the color image to screen.
-		program.Use(true);
-		program.Uniform1i("color_texture", 0);
-		vertex_array.Bind(true);
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glViewport(0, 0, width, height);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		return true;
+	}
 
-		glDrawArrays(GL_TRIANGLES, 0, 6);
+	void end() {
+		glBindFramebuffer(GL_FRAMEBUFFER, screen);
+		dirty = false;
+	}
 
-		vertex_array.Bind(false);
-		program.Use(false);
+	// the texture onto the current viewport.
+	void submit(sgl::RenderQueue& queue, unsigned int state) {
+		queue.submit(program.ID, vertex_array.ID, texture, state, []() { glDrawArrays(GL_TRIANGLES, 0, 6); });
+		queue.Uniform1i(INSET_TEXTURE, 0);
 	}
-};
\ No newline at end of file
+};
@@ -10,6 +10,46 @@ namespace scamera {
 	void Camera::updateViewMatrix() { view_matrix = LookAt(eye, at, up); }
 	void Camera::updateProjectionMatrix() { projection_matrix = Orthographic(width, height, dnear, dfar); }
 
+	Camera::Parameters Camera::parameters() const {
+		return Parameters{ eye[0], eye[1], eye[2], at[0], at[1], at[2], up[0], up[1], up[2], width, height, dnear, dfar };
+	}
+
+	bool Camera::update() {
+		Parameters current = parameters();
+		if (updated && current == updated_from) return false;
+		updateViewMatrix();
+		updateProjectionMatrix();
+		updated_from = current;
+		updated = true;
+		return true;
+	}
+
+	bool Camera::isVisible(float3 lo, float3 hi, float* extent) {
+		mat4 m = projection_matrix*view_matrix;
+
+		// the box is outside of the frustum if all of its corners are outside of the same clipping plane.
+		int outside[6] = {};
+		float x0 = FLT_MAX, y0 = FLT_MAX, x1 = -FLT_MAX, y1 = -FLT_MAX;
+		for (int k = 0; k < 8; k++) {
+			float4 c = m*float4{ (k & 1) ? hi[0] : lo[0], (k & 2) ? hi[1] : lo[1], (k & 4) ? hi[2] : lo[2], 1 };
+			if (c[0] < -c[3]) outside[0]++;
+			if (c[0] > c[3]) outside[1]++;
+			if (c[1] < -c[3]) outside[2]++;
+			if (c[1] > c[3]) outside[3]++;
+			if (c[2] < -c[3]) outside[4]++;
+			if (c[2] > c[3]) outside[5]++;
+
+			if (c[3] > FLT_EPSILON) {
+				x0 = min(x0, c[0] / c[3]); x1 = max(x1, c[0] / c[3]);
+				y0 = min(y0, c[1] / c[3]); y1 = max(y1, c[1] / c[3]);
+			}
+		}
+		for (int p = 0; p < 6; p++) if (outside[p] == 8) return false;
+
+		if (extent) *extent = x1 < x0 ? 2.f : max(x1 - x0, y1 - y0);
+		return true;
+	}
+
 
 	void Trackball::reset() {
 		curr = prev = home;
@@ -38,7 +78,7 @@ namespace scamera {
 		}
 	}
 
-	void Trackball::update(double elapsed_time) {
+	bool Trackball::update(double elapsed_time) {
 		if (movement.any()) {
 			float distance = float(Length(home.dir())*elapsed_time*translate_speed);
 			float3 n = -Normalize(curr.dir());
@@ -53,8 +93,7 @@ namespace scamera {
 			if (movement.down) { curr.eye = curr.eye - v*distance; }
 		}
 
-		curr.updateViewMatrix();
-		curr.updateProjectionMatrix();
+		return curr.update();
 	}
 
 	void Trackball::pan(float x, float y) {
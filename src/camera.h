@@ -1,4 +1,5 @@
 #pragma once
+#include <array>
 #include "smath.h"
 
 namespace scamera {
@@ -14,6 +15,20 @@ namespace scamera {
 
 		void updateViewMatrix();
 		void updateProjectionMatrix();
+
+		// rebuilds both matrices if eye, at, up or the projection changed since the last update (the camera is dirty);
+		// returns whether they did.
+		bool update();
+
+		// frustum test of an axis-aligned box (in world space) against view_matrix and projection_matrix.
+		// extent receives the larger of the width and height of the projected box in NDC (when visible).
+		bool isVisible(float3 lo, float3 hi, float* extent = nullptr);
+
+	private:
+		using Parameters = std::array<float, 13>;
+		Parameters parameters() const;
+		Parameters updated_from = {};
+		bool updated = false;
 	};
 
 	struct Trackball {
@@ -45,7 +60,7 @@ namespace scamera {
 		void reset();
 		void mouse(float x, float y, Behavior behavior);
 		void motion(float x, float y);
-		void update(double elapsed_time);
+		bool update(double elapsed_time); // returns whether the matrices changed
 
 		void zoom(float sign);
 
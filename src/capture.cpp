@@ -0,0 +1,762 @@
+#include <random>
+
+#include "capture.h"
+#include "depth_codec.h"
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+namespace scapture {
+
+	double Now() {
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	double WallClock(double host) {
+		double now = std::chrono::duration<double, std::milli>(std::chrono::system_clock::now().time_since_epoch()).count();
+		return now - (Now() - host);
+	}
+
+	// stream profiles ***************************
+
+	static double Cost(const StreamProfile& profile) { return double(profile.depth_pixels())*profile.fps; }
+
+	int Source::closest_profile(const StreamProfile& target) const {
+		int closest = -1;
+		for (int k = 0; k < int(profiles.size()); k++) {
+			if (closest < 0 || fabs(Cost(profiles[k]) - Cost(target)) < fabs(Cost(profiles[closest]) - Cost(target))) closest = k;
+		}
+		return closest;
+	}
+
+	static void SortProfiles(std::vector<StreamProfile>& profiles) {
+		std::sort(profiles.begin(), profiles.end(), [](const StreamProfile& a, const StreamProfile& b) {
+			return Cost(a) < Cost(b) || (Cost(a) == Cost(b) && a.depth_pixels() < b.depth_pixels());
+		});
+	}
+
+	// the depth modes (z16), each with a color mode (rgb8) of its frame rate: the smallest one as wide as the depth image.
+	static std::vector<StreamProfile> ListProfiles(rs::device* dev) {
+		std::vector<StreamProfile> profiles;
+		for (int d = 0; d < dev->get_stream_mode_count(rs::stream::depth); d++) {
+			StreamProfile profile = {};
+			rs::format format;
+			dev->get_stream_mode(rs::stream::depth, d, profile.depth_width, profile.depth_height, format, profile.fps);
+			if (format != rs::format::z16) continue;
+
+			for (int c = 0; c < dev->get_stream_mode_count(rs::stream::color); c++) {
+				int width, height, fps;
+				dev->get_stream_mode(rs::stream::color, c, width, height, format, fps);
+				if (format != rs::format::rgb8 || fps != profile.fps) continue;
+
+				bool wide = width >= profile.depth_width, chosen_wide = profile.color_width >= profile.depth_width;
+				bool smaller = width*height < profile.color_width*profile.color_height;
+				if (profile.color_width == 0 || (wide && (!chosen_wide || smaller)) || (!wide && !chosen_wide && !smaller)) {
+					profile.color_width = width;
+					profile.color_height = height;
+				}
+			}
+			if (profile.color_width == 0) continue;
+
+			bool listed = false;
+			for (const StreamProfile& p : profiles) listed = listed || (p.depth_width == profile.depth_width && p.depth_height == profile.depth_height && p.fps == profile.fps);
+			if (!listed) profiles.push_back(profile);
+		}
+		SortProfiles(profiles);
+		return profiles;
+	}
+
+	// device ***************************
+
+	bool DeviceSource::start() {
+		if (profiles.empty()) profiles = ListProfiles(dev);
+
+		if (profile < 0) {
+			dev->enable_stream(rs::stream::depth, rs::preset::best_quality);
+			dev->enable_stream(rs::stream::color, rs::preset::best_quality);
+		}
+		else {
+			const StreamProfile& p = profiles[profile];
+			dev->enable_stream(rs::stream::depth, p.depth_width, p.depth_height, rs::format::z16, p.fps);
+			dev->enable_stream(rs::stream::color, p.color_width, p.color_height, rs::format::rgb8, p.fps);
+		}
+		dev->start();
+
+		depth_intrin = dev->get_stream_intrinsics(rs::stream::depth);
+		depth_to_color = dev->get_extrinsics(rs::stream::depth, rs::stream::rectified_color);
+		color_to_depth = dev->get_extrinsics(rs::stream::rectified_color, rs::stream::depth);
+		color_intrin = dev->get_stream_intrinsics(rs::stream::rectified_color);
+		scale = dev->get_depth_scale();
+
+		// the profile the preset has chosen.
+		if (profile < 0) {
+			int fps = dev->get_stream_framerate(rs::stream::depth);
+			for (int k = 0; k < int(profiles.size()); k++) {
+				if (profiles[k].depth_width == depth_intrin.width && profiles[k].depth_height == depth_intrin.height && profiles[k].fps == fps) profile = k;
+			}
+		}
+
+		return true;
+	}
+
+	bool DeviceSource::switch_profile(int index) {
+		if (index < 0 || index >= int(profiles.size())) return false;
+
+		int previous = profile;
+		stop();
+		profile = index;
+		try {
+			return start();
+		}
+		catch (const rs::error& e) {
+			fprintf(stderr, "RealSense: %s failed to stream %s (%s).\n", name().c_str(), profiles[index].name().c_str(), e.what());
+			profile = previous;
+			return start();
+		}
+	}
+
+	void DeviceSource::stop() {
+		if (dev->is_streaming()) dev->stop();
+	}
+
+	bool DeviceSource::next(const uint16_t*& depth_image, const uint8_t*& color_image, double& timestamp) {
+		dev->wait_for_frames();
+		timestamp = Now(); // device clocks are not comparable across devices.
+		device_timestamp = dev->get_frame_timestamp(rs::stream::depth);
+
+		depth_image = (const uint16_t*)dev->get_frame_data(rs::stream::depth);
+		color_image = (const uint8_t*)dev->get_frame_data(rs::stream::rectified_color);
+		return true;
+	}
+
+	std::string DeviceSource::name() const {
+		return std::string(dev->get_name()) + " (" + dev->get_serial() + ")";
+	}
+
+	// replay ***************************
+
+	static const int REPLAY_FPS = 30; // nominal frame rate of the replays
+
+	// the intrinsics of every (factor)th pixel of every (factor)th row.
+	static rs::intrinsics Subsample(rs::intrinsics intrin, int factor) {
+		intrin.width /= factor;
+		intrin.height /= factor;
+		intrin.ppx /= factor;
+		intrin.ppy /= factor;
+		intrin.fx /= factor;
+		intrin.fy /= factor;
+		return intrin;
+	}
+
+	bool ReplaySource::start() {
+		file = fopen(path.c_str(), "rb");
+		if (file == nullptr) {
+			fprintf(stderr, "Replay: failed to open %s.\n", path.c_str());
+			return false;
+		}
+
+		char magic[4] = {};
+		bool ok = fread(magic, 1, 4, file) == 4 && memcmp(magic, "RSR", 3) == 0 && (magic[3] == '1' || magic[3] == '2');
+		version = magic[3] - '0';
+		ok = ok && fread(&depth_intrin, sizeof(rs::intrinsics), 1, file) == 1;
+		ok = ok && fread(&color_intrin, sizeof(rs::intrinsics), 1, file) == 1;
+		ok = ok && fread(&depth_to_color, sizeof(rs::extrinsics), 1, file) == 1;
+		ok = ok && fread(&color_to_depth, sizeof(rs::extrinsics), 1, file) == 1;
+		ok = ok && fread(&scale, sizeof(float), 1, file) == 1;
+		data_begin = ftell(file);
+		ok = ok && fread(&first_timestamp, sizeof(double), 1, file) == 1;
+		if (!ok) {
+			fprintf(stderr, "Replay: %s is not a replay file.\n", path.c_str());
+			stop();
+			return false;
+		}
+		fseek(file, data_begin, SEEK_SET);
+
+		depth.resize(depth_intrin.width*depth_intrin.height);
+		color.resize(color_intrin.width*color_intrin.height * 3);
+		recorded_depth_intrin = depth_intrin;
+		recorded_color_intrin = color_intrin;
+
+		profiles.clear();
+		for (int factor : { 4, 2, 1 }) {
+			for (int step : { 2, 1 }) {
+				StreamProfile p = { depth_intrin.width / factor, depth_intrin.height / factor, color_intrin.width / factor, color_intrin.height / factor, REPLAY_FPS / step };
+				profiles.push_back(p);
+			}
+		}
+		SortProfiles(profiles);
+		switch_profile(profile < 0 ? int(profiles.size()) - 1 : profile);
+
+		origin = first_timestamp;
+		played_origin = Now();
+		last_timestamp = first_timestamp;
+
+		return true;
+	}
+
+	void ReplaySource::stop() {
+		if (file) fclose(file);
+		file = nullptr;
+	}
+
+	bool ReplaySource::switch_profile(int index) {
+		if (index < 0 || index >= int(profiles.size())) return false;
+
+		profile = index;
+		subsample = recorded_depth_intrin.width / profiles[index].depth_width;
+		frame_step = REPLAY_FPS / profiles[index].fps;
+		depth_intrin = Subsample(recorded_depth_intrin, subsample);
+		color_intrin = Subsample(recorded_color_intrin, subsample);
+		return true;
+	}
+
+	bool ReplaySource::read(double& recorded) {
+		bool ok = fread(&recorded, sizeof(double), 1, file) == 1;
+		if (!ok) {
+			// loop: play the file again, one frame interval after the last frame.
+			double length = last_timestamp - first_timestamp;
+			played_origin += length + (length > 0 ? 33.0 : 0.0);
+			fseek(file, data_begin, SEEK_SET);
+			ok = fread(&recorded, sizeof(double), 1, file) == 1;
+		}
+		if (version == 1) ok = ok && fread(depth.data(), sizeof(uint16_t), depth.size(), file) == depth.size();
+		else {
+			uint32_t size = 0;
+			ok = ok && fread(&size, sizeof(uint32_t), 1, file) == 1;
+			encoded.resize(size);
+			ok = ok && fread(encoded.data(), 1, size, file) == size;
+			ok = ok && scodec::DecodeDepth(encoded.data(), size, depth.data(), recorded_depth_intrin.width, recorded_depth_intrin.height);
+		}
+		ok = ok && fread(color.data(), 1, color.size(), file) == color.size();
+		return ok;
+	}
+
+	bool ReplaySource::next(const uint16_t*& depth_image, const uint8_t*& color_image, double& timestamp) {
+		double recorded = 0;
+		for (int k = 0; k < frame_step; k++) {
+			if (!read(recorded)) return false;
+		}
+
+		// pace the frames as they were recorded.
+		timestamp = played_origin + (recorded - origin);
+		double wait = timestamp - Now();
+		if (paced && wait > 0) std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(wait));
+		last_timestamp = recorded;
+		device_timestamp = recorded;
+
+		if (subsample == 1) {
+			depth_image = depth.data();
+			color_image = color.data();
+			return true;
+		}
+
+		subsampled_depth.resize(depth_intrin.width*depth_intrin.height);
+		for (int y = 0; y < depth_intrin.height; y++) {
+			const uint16_t* row = depth.data() + y*subsample*recorded_depth_intrin.width;
+			for (int x = 0; x < depth_intrin.width; x++) subsampled_depth[y*depth_intrin.width + x] = row[x*subsample];
+		}
+		subsampled_color.resize(color_intrin.width*color_intrin.height * 3);
+		for (int y = 0; y < color_intrin.height; y++) {
+			const uint8_t* row = color.data() + y*subsample*recorded_color_intrin.width * 3;
+			for (int x = 0; x < color_intrin.width; x++) memcpy(&subsampled_color[(y*color_intrin.width + x) * 3], row + x*subsample * 3, 3);
+		}
+
+		depth_image = subsampled_depth.data();
+		color_image = subsampled_color.data();
+		return true;
+	}
+
+	bool ReplayWriter::open(const std::string& path, const Source& source) {
+		file = fopen(path.c_str(), "wb");
+		if (file == nullptr) return false;
+
+		fwrite("RSR2", 1, 4, file);
+		fwrite(&source.depth_intrin, sizeof(rs::intrinsics), 1, file);
+		fwrite(&source.color_intrin, sizeof(rs::intrinsics), 1, file);
+		fwrite(&source.depth_to_color, sizeof(rs::extrinsics), 1, file);
+		fwrite(&source.color_to_depth, sizeof(rs::extrinsics), 1, file);
+		fwrite(&source.scale, sizeof(float), 1, file);
+		return true;
+	}
+
+	void ReplayWriter::write(const Source& source, double timestamp, const uint16_t* depth_image, const uint8_t* color_image) {
+		// ~1/3 ms. per frame (at 480x360) on the capture thread, for about half the size.
+		encoded.clear();
+		uint32_t size = uint32_t(scodec::EncodeDepth(depth_image, source.depth_intrin.width, source.depth_intrin.height, encoded));
+		fwrite(&timestamp, sizeof(double), 1, file);
+		fwrite(&size, sizeof(uint32_t), 1, file);
+		fwrite(encoded.data(), 1, size, file);
+		fwrite(color_image, 1, source.color_intrin.width*source.color_intrin.height * 3, file);
+	}
+
+	void ReplayWriter::close() {
+		if (file) fclose(file);
+		file = nullptr;
+	}
+
+	struct SyntheticSource : Source {
+		bool start() override { return true; }
+		void stop() override {}
+		bool switch_profile(int) override { return false; }
+		bool next(const uint16_t*&, const uint8_t*&, double&) override { return false; }
+		std::string name() const override { return "synthetic"; }
+	};
+
+	bool WriteSyntheticReplay(const std::string& path, int frames) {
+		using namespace smath;
+		const int W = 640, H = 480;
+		const float F = 580.f;
+		SyntheticSource source;
+		source.depth_intrin.width = source.color_intrin.width = W;
+		source.depth_intrin.height = source.color_intrin.height = H;
+		source.depth_intrin.fx = source.depth_intrin.fy = source.color_intrin.fx = source.color_intrin.fy = F;
+		source.depth_intrin.ppx = source.color_intrin.ppx = W / 2.f;
+		source.depth_intrin.ppy = source.color_intrin.ppy = H / 2.f;
+		source.depth_to_color.rotation[0] = source.depth_to_color.rotation[4] = source.depth_to_color.rotation[8] = 1.f;
+		source.color_to_depth = source.depth_to_color;
+		source.scale = 0.001f;
+
+		ReplayWriter writer;
+		if (!writer.open(path, source)) {
+			fprintf(stderr, "Replay: failed to create %s.\n", path.c_str());
+			return false;
+		}
+
+		const float3 center = { 0.1f, 0.f, 1.5f };
+		const float radius = 0.3f;
+		std::mt19937 random(3);
+		std::normal_distribution<float> noise(0.f, 1.f);
+		std::vector<uint16_t> depth(W*H);
+		std::vector<uint8_t> color(W*H * 3);
+		for (int f = 0; f < frames; f++) {
+			for (int y = 0; y < H; y++) {
+				for (int x = 0; x < W; x++) {
+					float3 ray = { (x - W / 2.f) / F, (y - H / 2.f) / F, 1.f }; // z = 1
+					float z = 3.f;			// the wall
+					uint8_t shade = 160;
+					if (ray[1] > 0.f && 0.6f / ray[1] < z) { z = 0.6f / ray[1]; shade = 96; } // the floor
+					float b = Dot(ray, center), a = Dot(ray, ray), c = Dot(center, center) - radius*radius;
+					float disc = b*b - a*c;
+					if (disc >= 0.f && (b - sqrtf(disc)) / a < z) { z = (b - sqrtf(disc)) / a; shade = 224; }
+					z += noise(random)*z*z*0.001f;
+					depth[y*W + x] = uint16_t(z*1000.f + 0.5f);
+					memset(&color[(y*W + x) * 3], shade, 3);
+				}
+			}
+			writer.write(source, 1000.0*f / 30.0, depth.data(), color.data());
+		}
+		writer.close();
+		return true;
+	}
+
+	// deprojection ***************************
+
+	void Deproject(const Source& source, const uint16_t* depth_image, const uint8_t* color_image, const smath::mat4& extrinsic, Frame& frame) {
+		const rs::intrinsics& depth_intrin = source.depth_intrin;
+		const rs::intrinsics& color_intrin = source.color_intrin;
+
+		frame.points.clear();
+		frame.colors.clear();
+		frame.tiles.clear();
+		frame.depth_intrin = depth_intrin;
+		frame.color_intrin = color_intrin;
+		frame.depth_image.assign(depth_image, depth_image + depth_intrin.width*depth_intrin.height);
+		frame.scale = source.scale;
+		frame.depth_to_color = source.depth_to_color;
+		frame.extrinsic = extrinsic;
+
+		// We have to filter out *dead* pixels that do not have depth values due to measurement errors,
+		// such as obsorbing IR of black surfaces or too much far distant surfaces.
+		int depth_width = depth_intrin.width;
+		int depth_height = depth_intrin.height;
+		for (int ty = 0; ty < depth_height; ty += TILE_SIZE) {
+			for (int tx = 0; tx < depth_width; tx += TILE_SIZE) {
+				int tile_width = min(TILE_SIZE, depth_width - tx);
+				int tile_height = min(TILE_SIZE, depth_height - ty);
+
+				Tile tile = {};
+				tile.first = int(frame.points.size());
+				tile.lo = smath::float3{ FLT_MAX, FLT_MAX, FLT_MAX };
+				tile.hi = smath::float3{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+				// from the coarsest grid to the finest one, skipping the pixels taken by the coarser grids.
+				for (int level = TILE_LEVELS - 1; level >= 0; level--) {
+					int step = 1 << level;
+					for (int y = 0; y < tile_height; y += step) {
+						for (int x = 0; x < tile_width; x += step) {
+							if (level < TILE_LEVELS - 1 && x % (2 * step) == 0 && y % (2 * step) == 0) continue;
+
+							int dx = tx + x, dy = ty + y;
+							uint16_t depth_value = depth_image[dy*depth_width + dx];
+							float depth_in_meters = depth_value * source.scale;
+
+							if (depth_value == 0) continue; // zero depth means it is one of the dead pixels.
+
+							rs::float2 depth_pixel = { float(dx), float(dy) };
+							rs::float3 depth_point = depth_intrin.deproject(depth_pixel, depth_in_meters);
+							rs::float3 color_point = source.depth_to_color.transform(depth_point);
+							rs::float2 color_pixel = color_intrin.project(color_point);
+
+							ubyte3 depth_color = {};
+							const int cx = int(std::round(color_pixel.x)), cy = int(std::round(color_pixel.y));
+							if (cx >= 0 && cx < color_intrin.width && cy >= 0 && cy < color_intrin.height) {
+								depth_color = *((const ubyte3*)(color_image + 3 * (cy*color_intrin.width + cx)));
+							}
+
+							rs::float3 point = Transform(extrinsic, depth_point);
+							frame.points.push_back(point);
+							frame.colors.push_back(depth_color);
+
+							tile.lo = smath::float3{ min(tile.lo[0], point.x), min(tile.lo[1], point.y), min(tile.lo[2], point.z) };
+							tile.hi = smath::float3{ max(tile.hi[0], point.x), max(tile.hi[1], point.y), max(tile.hi[2], point.z) };
+						}
+					}
+					tile.count[level] = int(frame.points.size()) - tile.first;
+				}
+
+				if (tile.count[0] > 0) frame.tiles.push_back(tile);
+			}
+		}
+
+		frame.color_image.assign(color_image, color_image + color_intrin.width*color_intrin.height * 3);
+	}
+
+	void PixelPoints(const Frame& frame, std::vector<int>& pixel_points) {
+		int depth_width = frame.depth_intrin.width;
+		int depth_height = frame.depth_intrin.height;
+		pixel_points.assign(depth_width*depth_height, -1);
+		if (frame.depth_image.size() < pixel_points.size()) return;
+
+		int index = 0;
+		for (int ty = 0; ty < depth_height; ty += TILE_SIZE) {
+			for (int tx = 0; tx < depth_width; tx += TILE_SIZE) {
+				int tile_width = min(TILE_SIZE, depth_width - tx);
+				int tile_height = min(TILE_SIZE, depth_height - ty);
+				for (int level = TILE_LEVELS - 1; level >= 0; level--) {
+					int step = 1 << level;
+					for (int y = 0; y < tile_height; y += step) {
+						for (int x = 0; x < tile_width; x += step) {
+							if (level < TILE_LEVELS - 1 && x % (2 * step) == 0 && y % (2 * step) == 0) continue;
+							int pixel = (ty + y)*depth_width + tx + x;
+							if (frame.depth_image[pixel] != 0) pixel_points[pixel] = index++;
+						}
+					}
+				}
+			}
+		}
+	}
+
+	// rig ***************************
+
+	bool Rig::init(rs::context& ctx, const char* config) {
+		captures.clear();
+
+		auto add = [this](Source* source, const smath::mat4& extrinsic) {
+			std::unique_ptr<Capture> capture(new Capture);
+			capture->source.reset(source);
+			capture->extrinsic = extrinsic;
+			captures.push_back(std::move(capture));
+		};
+
+		if (config == nullptr) {
+			for (int k = 0; k < ctx.get_device_count(); k++) add(new DeviceSource(ctx.get_device(k)), smath::Identity4x4());
+		}
+		else {
+			FILE* file = fopen(config, "r");
+			if (file == nullptr) {
+				fprintf(stderr, "Rig: failed to open %s.\n", config);
+				return false;
+			}
+
+			char line[1024];
+			int line_number = 0;
+			while (fgets(line, sizeof(line), file)) {
+				line_number++;
+
+				char kind[16], target[768];
+				int offset = 0;
+				if (line[strspn(line, " \t\r\n")] == '#' || sscanf(line, "%15s %767s%n", kind, target, &offset) < 2) continue;
+
+				smath::mat4 extrinsic = smath::Identity4x4();
+				float* m = extrinsic.data();
+				int n = sscanf(line + offset, "%f %f %f %f %f %f %f %f %f %f %f %f", m, m + 1, m + 2, m + 3, m + 4, m + 5, m + 6, m + 7, m + 8, m + 9, m + 10, m + 11);
+				if (n > 0 && n != 12) {
+					fprintf(stderr, "Rig: %s(%d): the transform needs 12 numbers.\n", config, line_number);
+					continue;
+				}
+
+				if (strcmp(kind, "device") == 0) {
+					int index = atoi(target);
+					if (index < 0 || index >= ctx.get_device_count()) {
+						fprintf(stderr, "Rig: %s(%d): there is no RealSense device %d.\n", config, line_number, index);
+						continue;
+					}
+					add(new DeviceSource(ctx.get_device(index)), extrinsic);
+				}
+				else if (strcmp(kind, "replay") == 0) add(new ReplaySource(target), extrinsic);
+				else fprintf(stderr, "Rig: %s(%d): unknown source \"%s\".\n", config, line_number, kind);
+			}
+			fclose(file);
+		}
+
+		// start every source at once; the ones failing to start are dropped.
+		for (auto it = captures.begin(); it != captures.end();) {
+			if ((*it)->source->start()) it++;
+			else it = captures.erase(it);
+		}
+
+		if (captures.empty()) {
+			fprintf(stderr, "Rig: there is no source to capture from.\n");
+			return false;
+		}
+
+		current_profile = captures[0]->source->profile;
+
+		// replays of one session are played with the same time origin.
+		double origin = DBL_MAX, played_origin = Now();
+		for (auto& capture : captures) {
+			ReplaySource* replay = dynamic_cast<ReplaySource*>(capture->source.get());
+			if (replay) origin = min(origin, replay->first_timestamp);
+		}
+		for (auto& capture : captures) {
+			ReplaySource* replay = dynamic_cast<ReplaySource*>(capture->source.get());
+			if (replay) { replay->origin = origin; replay->played_origin = played_origin; }
+		}
+
+		for (size_t k = 0; k < captures.size(); k++) fprintf(stderr, "Rig: source %d: %s\n", int(k), captures[k]->source->name().c_str());
+
+		return true;
+	}
+
+	void Rig::start() {
+		running = true;
+		for (auto& capture : captures) {
+			Capture* c = capture.get();
+			c->thread = std::thread([this, c]() { capture_loop(*c); });
+		}
+	}
+
+	void Rig::stop() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			running = false;
+		}
+		arrived.notify_all();
+
+		for (auto& capture : captures) {
+			if (capture->thread.joinable()) capture->thread.join();
+			capture->source->stop();
+			capture->writer.close();
+		}
+	}
+
+	void Rig::capture_loop(Capture& capture) {
+		Source& source = *capture.source;
+		std::shared_ptr<Frame> frame;
+
+		while (true) {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (!running) break;
+			}
+
+			int requested = capture.requested_profile.exchange(-1);
+			if (requested >= 0 && requested != source.profile) {
+				std::lock_guard<std::mutex> lock(capture.writer_mutex); // the replay file keeps the intrinsics it began with
+				if (capture.writer.file) fprintf(stderr, "Rig: %s keeps its stream profile while recording.\n", source.name().c_str());
+				else if (!source.switch_profile(requested)) fprintf(stderr, "Rig: %s failed to switch to %s.\n", source.name().c_str(), source.profiles[requested].name().c_str());
+			}
+
+			const uint16_t* depth_image;
+			const uint8_t* color_image;
+			double timestamp;
+			if (!source.next(depth_image, color_image, timestamp)) {
+				fprintf(stderr, "Rig: %s stopped.\n", source.name().c_str());
+				break;
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(capture.writer_mutex);
+				if (capture.writer.file) capture.writer.write(source, timestamp, depth_image, color_image);
+			}
+
+			if (!frame) frame = std::make_shared<Frame>();
+			double t0 = Now();
+			Deproject(source, depth_image, color_image, capture.extrinsic, *frame);
+			frame->timestamp = timestamp;
+			frame->device_timestamp = source.device_timestamp;
+			frame->deproject_ms = Now() - t0;
+
+			{
+				std::lock_guard<std::mutex> lock(capture.mutex);
+				capture.frames.push_back(frame);
+				capture.frame_count++;
+				frame.reset();
+
+				// reuse the storage of the oldest frame unless it is being merged.
+				if (capture.frames.size() > Capture::HISTORY) {
+					if (capture.frames.front().use_count() == 1) frame = capture.frames.front();
+					capture.frames.pop_front();
+				}
+			}
+			std::function<void()> callback;
+			{
+				std::lock_guard<std::mutex> lock(mutex); // so that a waiter between its check and its wait does not miss this.
+				if (&capture == captures[0].get()) callback = arrival_callback;
+			}
+			arrived.notify_all();
+			if (callback) callback();
+		}
+	}
+
+	void Rig::on_arrival(std::function<void()> callback) {
+		std::lock_guard<std::mutex> lock(mutex);
+		arrival_callback = callback;
+	}
+
+	bool Rig::wait_for_frames(int timeout_ms) {
+		Capture& reference = *captures[0];
+
+		std::unique_lock<std::mutex> lock(mutex);
+		return arrived.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this, &reference]() -> bool {
+			std::lock_guard<std::mutex> capture_lock(reference.mutex);
+			return !running || reference.frame_count > merged_count;
+		}) && running;
+	}
+
+	int Rig::merge(std::vector<rs::float3>& points, std::vector<ubyte3>& colors, std::vector<Tile>& tiles, std::vector<uint8_t>& color_image) {
+		std::vector<std::deque<std::shared_ptr<Frame>>> histories(captures.size());
+		for (size_t k = 0; k < captures.size(); k++) {
+			Capture& capture = *captures[k];
+			std::lock_guard<std::mutex> lock(capture.mutex);
+			histories[k] = capture.frames;
+			if (k == 0) merged_count = capture.frame_count;
+		}
+		if (histories[0].empty()) return 0;
+
+		// the frame of each other source closest in time to the reference frame, if it is in the sync window.
+		auto match = [this, &histories](const std::shared_ptr<Frame>& reference, std::vector<std::shared_ptr<Frame>>& matched) {
+			matched.assign(1, reference);
+			for (size_t k = 1; k < histories.size(); k++) {
+				std::shared_ptr<Frame> closest;
+				double closest_dt = sync_window;
+				for (auto& frame : histories[k]) {
+					double dt = fabs(frame->timestamp - reference->timestamp);
+					if (dt <= closest_dt) { closest = frame; closest_dt = dt; }
+				}
+				if (closest) matched.push_back(closest);
+			}
+		};
+
+		// the latest reference frame may have arrived before its counterparts,
+		// so the newest reference frame that matches the most sources is taken.
+		std::vector<std::shared_ptr<Frame>> matched, candidate;
+		for (auto it = histories[0].rbegin(); it != histories[0].rend() && matched.size() < captures.size(); it++) {
+			match(*it, candidate);
+			if (candidate.size() > matched.size()) matched.swap(candidate);
+		}
+		std::shared_ptr<Frame> reference = matched[0];
+
+		points.clear();
+		colors.clear();
+		tiles.clear();
+		for (auto& frame : matched) {
+			int offset = int(points.size());
+			points.insert(points.end(), frame->points.cbegin(), frame->points.cend());
+			colors.insert(colors.end(), frame->colors.cbegin(), frame->colors.cend());
+			for (Tile tile : frame->tiles) {
+				tile.first += offset;
+				tiles.push_back(tile);
+			}
+		}
+		color_image = reference->color_image;
+		merged = matched;
+
+		merged_reference.timestamp = reference->timestamp;
+		merged_reference.device_timestamp = reference->device_timestamp;
+		merged_reference.deproject_ms = reference->deproject_ms;
+		merged_reference.depth_intrin = reference->depth_intrin;
+		merged_reference.color_intrin = reference->color_intrin;
+
+		return int(matched.size());
+	}
+
+	bool Rig::set_profile(int index) {
+		if (index < 0 || index >= int(profiles().size()) || index == current_profile) return false;
+		if (is_recording) {
+			fprintf(stderr, "Rig: the stream profile is kept while recording.\n");
+			return false;
+		}
+
+		captures[0]->requested_profile = index;
+		for (size_t k = 1; k < captures.size(); k++) {
+			int closest = captures[k]->source->closest_profile(profiles()[index]);
+			if (closest >= 0) captures[k]->requested_profile = closest;
+		}
+		current_profile = index;
+		return true;
+	}
+
+	void Rig::record(bool on) {
+		if (on == is_recording) return;
+
+		for (size_t k = 0; k < captures.size(); k++) {
+			Capture& capture = *captures[k];
+			std::lock_guard<std::mutex> lock(capture.writer_mutex);
+			if (on) {
+				std::string path = "capture" + std::to_string(k) + ".rsr";
+				if (!capture.writer.open(path, *capture.source)) fprintf(stderr, "Rig: failed to open %s.\n", path.c_str());
+			}
+			else capture.writer.close();
+		}
+		is_recording = on;
+	}
+
+	// profile controller ***************************
+
+	int ProfileController::update(const Stages& stages, int current, const std::vector<StreamProfile>& profiles) {
+		if (current < 0 || current >= int(profiles.size())) return current;
+		if (skipped < cooldown) {
+			skipped++;
+			return current;
+		}
+
+		sum.deproject += stages.deproject;
+		sum.queue += stages.queue;
+		sum.update += stages.update;
+		sum.render += stages.render;
+		if (++count < window) return current;
+
+		mean.deproject = sum.deproject / count;
+		mean.queue = sum.queue / count;
+		mean.update = sum.update / count;
+		mean.render = sum.render / count;
+		sum = Stages();
+		count = 0;
+
+		// the capture threads and the main thread work in parallel, so the busier one bounds the frame rate.
+		const StreamProfile& profile = profiles[current];
+		double busiest = max(mean.deproject, mean.update + mean.render);
+		if (current > 0 && (mean.total() > budget || busiest > 1000.0 / profile.fps)) {
+			// the latency depends on the resolution only, so it takes the next profile with fewer pixels.
+			int next = current - 1;
+			if (mean.total() > budget) {
+				while (next > 0 && profiles[next].depth_pixels() >= profile.depth_pixels()) next--;
+			}
+			skipped = 0;
+			return next;
+		}
+
+		if (current + 1 < int(profiles.size())) {
+			// every stage but queuing scales with the number of points.
+			const StreamProfile& next = profiles[current + 1];
+			double ratio = double(next.depth_pixels()) / profile.depth_pixels();
+			double expected = (mean.total() - mean.queue)*ratio + mean.queue;
+			if (expected < headroom*budget && busiest*ratio < headroom*1000.0 / next.fps) {
+				skipped = 0;
+				return current + 1;
+			}
+		}
+		return current;
+	}
+}
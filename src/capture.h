@@ -0,0 +1,279 @@
+#pragma once
+#include <cstdio>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <string>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+#if defined(_MSC_VER)
+#include "3rdparty\librealsense\includes\rs.hpp"
+#else
+#include <librealsense/rs.hpp>
+#endif
+
+#include "smath.h"
+
+struct ubyte3 { unsigned char r, g, b; };
+
+namespace scapture {
+
+	// the depth image is deprojected tile by tile, so that each tile is a contiguous range of the points.
+	// in a tile, the pixels on the coarser grids come first, so a prefix of the range is a uniform subsample.
+	static const int TILE_SIZE = 32;
+	static const int TILE_LEVELS = 3;
+	struct Tile {
+		int first;
+		int count[TILE_LEVELS];	// count[level]: number of points on the grid of every (2^level)th pixel
+		smath::float3 lo, hi;	// bounding box
+	};
+
+	// a deprojected frame of a source, in the common frame of the rig.
+	struct Frame {
+		double timestamp = 0;	// host time when the frame arrived (in ms.)
+		double device_timestamp = 0;
+		double deproject_ms = 0;
+		rs::intrinsics depth_intrin = {}, color_intrin = {}; // of the stream profile the frame was captured with
+		std::vector<rs::float3> points;
+		std::vector<ubyte3> colors;
+		std::vector<Tile> tiles;
+		std::vector<uint8_t> color_image;
+
+		// the images as captured and the pose of the depth camera, for fusion.
+		std::vector<uint16_t> depth_image;
+		float scale = 0.f;
+		rs::extrinsics depth_to_color = {};
+		smath::mat4 extrinsic = smath::Identity4x4(); // to the common frame
+	};
+
+	// resolutions and frame rate of the depth and color streams.
+	struct StreamProfile {
+		int depth_width, depth_height;
+		int color_width, color_height;
+		int fps;
+
+		int depth_pixels() const { return depth_width*depth_height; }
+		std::string name() const { return std::to_string(depth_width) + "x" + std::to_string(depth_height) + "@" + std::to_string(fps); }
+	};
+
+	// a source of depth and color images: a RealSense device or a replay file.
+	struct Source {
+		rs::intrinsics depth_intrin = {};
+		rs::intrinsics color_intrin = {};
+		rs::extrinsics depth_to_color = {};
+		rs::extrinsics color_to_depth = {};
+		float scale = 0.f;
+
+		// the profiles the source can switch to, from the cheapest one (depth pixels per second); empty if it cannot switch.
+		std::vector<StreamProfile> profiles;
+		int profile = -1; // index into profiles; -1 before the source starts with its default
+
+		double device_timestamp = 0; // of the last frame by the clock of the source (in ms.), set by next()
+
+		virtual ~Source() {}
+		virtual bool start() = 0;
+		virtual void stop() = 0;
+
+		// switch the streams to profiles[index], updating the intrinsics. called between frames.
+		virtual bool switch_profile(int index) = 0;
+		int closest_profile(const StreamProfile& target) const;
+
+		// blocks until the next frame arrives. the images are valid until the next call.
+		virtual bool next(const uint16_t*& depth_image, const uint8_t*& color_image, double& timestamp) = 0;
+		virtual std::string name() const = 0;
+	};
+
+	struct DeviceSource : Source {
+		rs::device* dev;
+
+		DeviceSource(rs::device* dev) : dev(dev) {}
+		bool start() override;
+		void stop() override;
+		bool switch_profile(int index) override;
+		bool next(const uint16_t*& depth_image, const uint8_t*& color_image, double& timestamp) override;
+		std::string name() const override;
+	};
+
+	/* replay file: "RSR2", depth_intrin, color_intrin, depth_to_color, color_to_depth, scale,
+	   then per frame: timestamp (double), size of the encoded depth image (uint32_t), the depth image
+	   encoded by scodec::EncodeDepth, color image (rgb8).
+	   "RSR1" files (still read) have the raw depth image (uint16_t) instead of the size and the encoded image.
+	   the profiles are simulated: the images subsampled by 4, 2 or 1, and every frame or every other frame played. */
+	struct ReplaySource : Source {
+		std::string path;
+		FILE* file = nullptr;
+		long data_begin = 0;
+		int version = 0;
+		bool paced = true; // as recorded; otherwise as fast as the frames are read
+		std::vector<uint16_t> depth;
+		std::vector<uint8_t> encoded;
+		std::vector<uint8_t> color;
+
+		// as recorded, and the subsampling and the frame skipping of the current profile.
+		rs::intrinsics recorded_depth_intrin = {}, recorded_color_intrin = {};
+		int subsample = 1, frame_step = 1;
+		std::vector<uint16_t> subsampled_depth;
+		std::vector<uint8_t> subsampled_color;
+
+		// recorded time of the first frame and the host time it is played at.
+		// replays of one session share them, so that their frames keep the recorded offsets.
+		double first_timestamp = 0, last_timestamp = 0;
+		double origin = 0, played_origin = 0;
+
+		ReplaySource(const std::string& path) : path(path) {}
+		~ReplaySource() { stop(); }
+		bool start() override;
+		void stop() override;
+		bool switch_profile(int index) override;
+		bool next(const uint16_t*& depth_image, const uint8_t*& color_image, double& timestamp) override;
+		std::string name() const override { return path; }
+
+	private:
+		bool read(double& recorded);
+	};
+
+	struct ReplayWriter {
+		FILE* file = nullptr;
+		std::vector<uint8_t> encoded;
+
+		bool open(const std::string& path, const Source& source);
+		void write(const Source& source, double timestamp, const uint16_t* depth_image, const uint8_t* color_image);
+		void close();
+	};
+
+	// a replay of a synthetic scene of known surfaces, the same every time (fixed noise), for checks of the detection
+	// server: 640x480 at 30 fps, a floor 0.6 m. below the camera (y down), a wall 3 m. ahead, and a sphere of radius
+	// 0.3 m. at (0.1, 0, 1.5), with noise growing with the square of the distance (1 mm. at 1 m.).
+	bool WriteSyntheticReplay(const std::string& path, int frames);
+
+	// deproject a depth image into tiles, transformed by extrinsic (a rigid transform to the common frame).
+	void Deproject(const Source& source, const uint16_t* depth_image, const uint8_t* color_image, const smath::mat4& extrinsic, Frame& frame);
+
+	// the index into frame.points of every pixel of its depth image (-1 for the dead ones), in the order of Deproject.
+	void PixelPoints(const Frame& frame, std::vector<int>& pixel_points);
+
+	inline rs::float3 Transform(const smath::mat4& m, rs::float3 p) {
+		return rs::float3{
+			m[0] * p.x + m[1] * p.y + m[2] * p.z + m[3],
+			m[4] * p.x + m[5] * p.y + m[6] * p.z + m[7],
+			m[8] * p.x + m[9] * p.y + m[10] * p.z + m[11]
+		};
+	}
+
+	double Now(); // host time in ms.
+	double WallClock(double host); // of a host time, in ms since the Unix epoch (comparable across sessions).
+
+	// a source running on its own capture (and deprojection) thread.
+	struct Capture {
+		static const int HISTORY = 4; // number of the latest frames kept for matching
+
+		std::unique_ptr<Source> source;
+		smath::mat4 extrinsic = smath::Identity4x4(); // from the depth camera of the source to the common frame
+
+		std::thread thread;
+		std::mutex mutex;
+		std::deque<std::shared_ptr<Frame>> frames; // the latest frames (oldest first)
+		unsigned long long frame_count = 0;
+
+		std::mutex writer_mutex;
+		ReplayWriter writer; // open while recording
+
+		std::atomic<int> requested_profile{ -1 }; // applied by the capture thread before its next frame
+	};
+
+	// N sources started at once, whose clouds are merged in the common frame.
+	class Rig {
+	public:
+		float sync_window = 20.f; // frames of the other sources farther than this from the reference frame (in ms.) are left out.
+
+		/* config: one source per line, "device <index>" or "replay <path>",
+		   optionally followed by 12 numbers, the 3x4 row-major transform to the common frame.
+		   without config, every connected device is used with the identity transform. */
+		~Rig() { stop(); }
+
+		bool init(rs::context& ctx, const char* config);
+		void start();
+		void stop();
+
+		// blocks until the reference source (the first one) has a new frame, or timeout.
+		bool wait_for_frames(int timeout_ms);
+
+		// merge the latest frame of the reference source with the closest frames of the others.
+		// returns the number of merged sources.
+		int merge(std::vector<rs::float3>& points, std::vector<ubyte3>& colors, std::vector<Tile>& tiles, std::vector<uint8_t>& color_image);
+
+		// the frames last merged, the reference one first (their storage is not reused until the next merge).
+		const std::vector<std::shared_ptr<Frame>>& merged_frames() const { return merged; }
+
+		// record the raw images of every source into "capture<k>.rsr" files.
+		void record(bool on);
+		bool recording() const { return is_recording; }
+
+		size_t size() const { return captures.size(); }
+		const Source& reference() const { return *captures[0]->source; }
+		const smath::mat4& reference_extrinsic() const { return captures[0]->extrinsic; }
+
+		// the reference frame last merged.
+		double merged_timestamp() const { return merged_reference.timestamp; }
+		double merged_device_timestamp() const { return merged_reference.device_timestamp; }
+		double merged_deproject_ms() const { return merged_reference.deproject_ms; }
+		const rs::intrinsics& merged_depth_intrin() const { return merged_reference.depth_intrin; }
+		const rs::intrinsics& merged_color_intrin() const { return merged_reference.color_intrin; }
+
+		// the stream profiles of the reference source; the other sources take their closest profiles.
+		// a switch is applied by the capture threads, and shows in the intrinsics of the merged frames.
+		const std::vector<StreamProfile>& profiles() const { return captures[0]->source->profiles; }
+		int profile() const { return current_profile; }
+		bool set_profile(int index);
+
+		// called on the capture thread of the reference source after each of its frames (e.g. to wake up a window waiting on events).
+		void on_arrival(std::function<void()> callback);
+
+	private:
+		std::vector<std::unique_ptr<Capture>> captures;
+		std::mutex mutex;
+		std::condition_variable arrived;
+		unsigned long long merged_count = 0;
+		Frame merged_reference; // without the points
+		std::vector<std::shared_ptr<Frame>> merged;
+		int current_profile = -1;
+		std::function<void()> arrival_callback;
+		bool running = false;
+		bool is_recording = false;
+
+		void capture_loop(Capture& capture);
+	};
+
+	// steps the stream profile down when the frames miss the latency budget (from their arrival to the end of
+	// their rendering) or arrive faster than they are processed, and up when the next profile is expected to fit.
+	class ProfileController {
+	public:
+		struct Stages {
+			double deproject = 0;	// on the capture thread
+			double queue = 0;		// from the deprojected frame to its merging
+			double update = 0;		// merging and passing to FindSurface
+			double render = 0;
+			double total() const { return deproject + queue + update + render; }
+		};
+
+		double budget = 33.0;	// in ms.
+		double headroom = 0.7;	// steps up when the expected latency of the next profile is below headroom*budget
+		int window = 30;		// frames averaged per decision
+		int cooldown = 30;		// frames ignored after a switch, which are still in the pipeline
+
+		// returns the profile to switch to (current to keep it).
+		int update(const Stages& stages, int current, const std::vector<StreamProfile>& profiles);
+		void reset() { sum = Stages(); count = 0; skipped = 0; }
+		const Stages& last_mean() const { return mean; } // of the last decision
+
+	private:
+		Stages sum, mean;
+		int count = 0, skipped = 0;
+	};
+}
@@ -0,0 +1,313 @@
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <random>
+#include <thread>
+#include "depth_codec.h"
+
+namespace scodec {
+
+	/* layout: uint16_t width, height, bands, 0, uint32_t end of each band (from the first band), then the bands.
+	   a band is the residuals of its rows, one after another, in blocks of 128: the bit width B of the block (1 byte),
+	   then 4*B words of the 128 residuals in 4 interleaved lanes (value i in lane i%4), so packing and unpacking
+	   shift all the lanes by the same amount and vectorize as they are. */
+	static const size_t HEADER = 8;
+	static const int LANES = 4;
+	static const int MAX_BITS = 17; // zigzag of a 16-bit difference, plus one
+
+	/* the inner loops are also compiled for AVX2 and AVX-512, picked at load time (GCC 12 and later, x86-64): the
+	   baseline SSE2 has no narrowing of 32-bit lanes to 16 bits, which reconstruction does on every pixel. */
+#if defined(__GNUC__) && __GNUC__ >= 12 && defined(__x86_64__) && !defined(__clang__)
+#define SCODEC_CLONES __attribute__((target_clones("arch=x86-64-v4", "arch=x86-64-v3", "default")))
+#else
+#define SCODEC_CLONES
+#endif
+
+	static inline uint32_t Bits(uint32_t x) {
+		uint32_t n = 0;
+		while (x) { n++; x >>= 1; }
+		return n;
+	}
+
+	static inline void Store32(uint8_t* p, uint32_t x) {
+		p[0] = uint8_t(x); p[1] = uint8_t(x >> 8); p[2] = uint8_t(x >> 16); p[3] = uint8_t(x >> 24);
+	}
+
+	static inline uint32_t Load32(const uint8_t* p) {
+		return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24;
+	}
+
+	// bit packing ***************************
+
+	template <int B> SCODEC_CLONES static void Pack(const uint32_t* __restrict r, uint32_t* __restrict out) {
+		uint32_t acc[LANES] = { 0, 0, 0, 0 };
+		int filled = 0;
+		for (int i = 0; i < BLOCK / LANES; i++) {
+			for (int l = 0; l < LANES; l++) acc[l] |= r[LANES*i + l] << filled;
+			filled += B;
+			if (filled >= 32) {
+				filled -= 32;
+				for (int l = 0; l < LANES; l++) {
+					out[l] = acc[l];
+					acc[l] = filled ? r[LANES*i + l] >> (B - filled) : 0;
+				}
+				out += LANES;
+			}
+		}
+	}
+
+	template <int B> SCODEC_CLONES static void Unpack(const uint32_t* __restrict in, uint32_t* __restrict r) {
+		const uint32_t mask = (uint32_t(1) << B) - 1;
+		int filled = 0;
+		for (int i = 0; i < BLOCK / LANES; i++) {
+			for (int l = 0; l < LANES; l++) {
+				uint32_t v = in[l] >> filled;
+				if (filled + B > 32) v |= in[LANES + l] << (32 - filled);
+				r[LANES*i + l] = v & mask;
+			}
+			filled += B;
+			if (filled >= 32) {
+				filled -= 32;
+				in += LANES;
+			}
+		}
+	}
+
+	template <> void Pack<0>(const uint32_t* __restrict, uint32_t* __restrict) {}
+	template <> void Unpack<0>(const uint32_t* __restrict, uint32_t* __restrict r) { memset(r, 0, BLOCK * sizeof(uint32_t)); }
+
+	typedef void(*PackFunc)(const uint32_t*, uint32_t*);
+	static const PackFunc PACK[MAX_BITS + 1] = {
+		Pack<0>, Pack<1>, Pack<2>, Pack<3>, Pack<4>, Pack<5>, Pack<6>, Pack<7>, Pack<8>,
+		Pack<9>, Pack<10>, Pack<11>, Pack<12>, Pack<13>, Pack<14>, Pack<15>, Pack<16>, Pack<17>
+	};
+	static const PackFunc UNPACK[MAX_BITS + 1] = {
+		Unpack<0>, Unpack<1>, Unpack<2>, Unpack<3>, Unpack<4>, Unpack<5>, Unpack<6>, Unpack<7>, Unpack<8>,
+		Unpack<9>, Unpack<10>, Unpack<11>, Unpack<12>, Unpack<13>, Unpack<14>, Unpack<15>, Unpack<16>, Unpack<17>
+	};
+
+	// encoding ***************************
+
+	// the last valid pixel above each pixel predicts it; 0 (a dead pixel) costs nothing.
+	SCODEC_CLONES static void Residuals(const uint16_t* __restrict depth, int32_t* __restrict pred, uint32_t* __restrict r, int n) {
+		for (int k = 0; k < n; k++) {
+			int32_t v = depth[k];
+			int32_t d = v - pred[k];
+			uint32_t z = ((uint32_t(d) << 1) ^ uint32_t(d >> 31)) + 1;
+			r[k] = v ? z : 0;
+			pred[k] = v ? v : pred[k];
+		}
+	}
+
+	// the rows of a band are contiguous, so the blocks run over them, split where a row ends.
+	static void EncodeBand(const uint16_t* depth, int width, int rows, std::vector<uint8_t>& out) {
+		const size_t count = size_t(width)*rows;
+		std::vector<int32_t> pred(width, 0);
+		uint32_t block[BLOCK];
+		uint8_t packed[1 + 4 * LANES*MAX_BITS];
+		uint32_t words[LANES*MAX_BITS];
+
+		for (size_t pixel = 0; pixel < count;) {
+			int k = 0;
+			while (k < BLOCK && pixel < count) {
+				int x = int(pixel % width);
+				int n = BLOCK - k < width - x ? BLOCK - k : width - x;
+				Residuals(depth + pixel, pred.data() + x, block + k, n);
+				k += n;
+				pixel += n;
+			}
+			for (; k < BLOCK; k++) block[k] = 0;
+
+			uint32_t any = 0;
+			for (int i = 0; i < BLOCK; i++) any |= block[i];
+			uint32_t bits = Bits(any);
+			PACK[bits](block, words);
+
+			packed[0] = uint8_t(bits);
+			for (uint32_t i = 0; i < LANES*bits; i++) Store32(packed + 1 + 4 * i, words[i]);
+			out.insert(out.end(), packed, packed + 1 + 4 * LANES*bits);
+		}
+	}
+
+	size_t EncodeDepth(const uint16_t* depth, int width, int height, std::vector<uint8_t>& out, int threads) {
+		const size_t base = out.size();
+		if (threads < 1) threads = 1;
+
+		out.resize(base + HEADER + 4 * BANDS);
+		uint8_t* p = out.data() + base;
+		p[0] = uint8_t(width); p[1] = uint8_t(width >> 8);
+		p[2] = uint8_t(height); p[3] = uint8_t(height >> 8);
+		p[4] = uint8_t(BANDS); p[5] = 0; p[6] = 0; p[7] = 0;
+
+		const size_t data = out.size();
+		std::vector<size_t> ends(BANDS);
+		if (threads == 1) {
+			for (int b = 0; b < BANDS; b++) {
+				int row_begin = height*b / BANDS, row_end = height*(b + 1) / BANDS;
+				EncodeBand(depth + size_t(row_begin)*width, width, row_end - row_begin, out);
+				ends[b] = out.size() - data;
+			}
+		}
+		else {
+			// each band into its own buffer, then one after another.
+			std::vector<std::vector<uint8_t>> bands(BANDS);
+			auto encode = [&](int first) {
+				for (int b = first; b < BANDS; b += threads) {
+					int row_begin = height*b / BANDS, row_end = height*(b + 1) / BANDS;
+					EncodeBand(depth + size_t(row_begin)*width, width, row_end - row_begin, bands[b]);
+				}
+			};
+
+			std::vector<std::thread> workers;
+			for (int t = 1; t < threads; t++) workers.emplace_back(encode, t);
+			encode(0);
+			for (auto& worker : workers) worker.join();
+
+			for (int b = 0; b < BANDS; b++) {
+				out.insert(out.end(), bands[b].begin(), bands[b].end());
+				ends[b] = out.size() - data;
+			}
+		}
+
+		for (int b = 0; b < BANDS; b++) Store32(out.data() + base + HEADER + 4 * b, uint32_t(ends[b]));
+		return out.size() - base;
+	}
+
+	// decoding ***************************
+
+	SCODEC_CLONES static void Reconstruct(const uint32_t* __restrict r, int32_t* __restrict pred, uint16_t* __restrict depth, int n) {
+		for (int k = 0; k < n; k++) {
+			uint32_t u = r[k] - 1;
+			int32_t v = pred[k] + int32_t((u >> 1) ^ (0u - (u & 1)));
+			v = r[k] ? v : 0;
+			pred[k] = r[k] ? v : pred[k];
+			depth[k] = uint16_t(v);
+		}
+	}
+
+	static bool DecodeBand(const uint8_t* in, const uint8_t* end, uint16_t* depth, int width, int rows) {
+		const size_t count = size_t(width)*rows;
+		std::vector<int32_t> pred(width, 0);
+		uint32_t block[BLOCK];
+		uint32_t words[LANES*MAX_BITS];
+
+		for (size_t pixel = 0; pixel < count;) {
+			if (in >= end) return false;
+			uint32_t bits = *in++;
+			size_t bytes = 4 * LANES*bits;
+			if (bits > uint32_t(MAX_BITS) || size_t(end - in) < bytes) return false;
+			memcpy(words, in, bytes);
+			UNPACK[bits](words, block);
+			in += bytes;
+
+			int k = 0;
+			while (k < BLOCK && pixel < count) {
+				int x = int(pixel % width);
+				int n = BLOCK - k < width - x ? BLOCK - k : width - x;
+				Reconstruct(block + k, pred.data() + x, depth + pixel, n);
+				k += n;
+				pixel += n;
+			}
+		}
+		return in == end;
+	}
+
+	bool DecodeDepth(const uint8_t* data, size_t size, uint16_t* depth, int width, int height, int threads) {
+		if (size < HEADER + 4 * BANDS) return false;
+		if ((data[0] | data[1] << 8) != width || (data[2] | data[3] << 8) != height || data[4] != BANDS) return false;
+		if (threads < 1) threads = 1;
+
+		const uint8_t* table = data + HEADER;
+		const uint8_t* bands = table + 4 * BANDS;
+		// the ends of the bands: non-decreasing, up to the last one, which is the end of the frame.
+		const size_t last = Load32(table + 4 * (BANDS - 1));
+		if (last + size_t(bands - data) != size) return false;
+		size_t previous = 0;
+		for (int b = 0; b < BANDS; b++) {
+			size_t end = Load32(table + 4 * b);
+			if (end < previous || end > last) return false;
+			previous = end;
+		}
+
+		std::vector<char> ok(BANDS, 0);
+		auto decode = [&](int first) {
+			for (int b = first; b < BANDS; b += threads) {
+				size_t begin = b > 0 ? Load32(table + 4 * (b - 1)) : 0;
+				size_t end = Load32(table + 4 * b);
+				int row_begin = height*b / BANDS, row_end = height*(b + 1) / BANDS;
+				ok[b] = DecodeBand(bands + begin, bands + end, depth + size_t(row_begin)*width, width, row_end - row_begin);
+			}
+		};
+
+		std::vector<std::thread> workers;
+		for (int t = 1; t < threads; t++) workers.emplace_back(decode, t);
+		decode(0);
+		for (auto& worker : workers) worker.join();
+
+		for (char b : ok) if (!b) return false;
+		return true;
+	}
+
+	// benchmark ***************************
+
+	static void Measure(const char* name, const std::vector<std::vector<uint16_t>>& frames, int width, int height) {
+		typedef std::chrono::steady_clock clock;
+		const int REPEAT = 20;
+		size_t raw = 0, encoded = 0;
+		double encode_s = 0, decode_s = 0, encode4_s = 0;
+		bool lossless = true;
+
+		std::vector<uint8_t> buffer;
+		std::vector<uint16_t> decoded(size_t(width)*height);
+		for (auto& frame : frames) {
+			buffer.clear();
+			auto t0 = clock::now();
+			for (int k = 0; k < REPEAT; k++) { buffer.clear(); EncodeDepth(frame.data(), width, height, buffer); }
+			auto t1 = clock::now();
+			for (int k = 0; k < REPEAT; k++) DecodeDepth(buffer.data(), buffer.size(), decoded.data(), width, height);
+			auto t2 = clock::now();
+			std::vector<uint8_t> buffer4;
+			for (int k = 0; k < REPEAT; k++) { buffer4.clear(); EncodeDepth(frame.data(), width, height, buffer4, 4); }
+			auto t3 = clock::now();
+
+			lossless = lossless && decoded == frame && buffer4 == buffer;
+			raw += frame.size() * sizeof(uint16_t);
+			encoded += buffer.size();
+			encode_s += std::chrono::duration<double>(t1 - t0).count() / REPEAT;
+			decode_s += std::chrono::duration<double>(t2 - t1).count() / REPEAT;
+			encode4_s += std::chrono::duration<double>(t3 - t2).count() / REPEAT;
+		}
+
+		const double MB = 1024.0*1024.0;
+		fprintf(stdout, "%-10s %3d frames: ratio %.2fx, encode %.0f MB/s (%.0f MB/s with 4 threads), decode %.0f MB/s, %s\n",
+			name, int(frames.size()), double(raw) / encoded, raw / MB / encode_s, raw / MB / encode4_s, raw / MB / decode_s, lossless ? "lossless" : "MISMATCH");
+	}
+
+	void BenchmarkDepthCodec(const std::vector<std::vector<uint16_t>>& frames, int width, int height) {
+
+		// synthetic scene: a sloped floor, a wall, a sphere, sensor noise growing with distance, and holes.
+		const int W = 480, H = 360;
+		std::vector<std::vector<uint16_t>> synthetic;
+		std::mt19937 random(7);
+		std::normal_distribution<float> noise(0.f, 1.f);
+		std::uniform_real_distribution<float> uniform(0.f, 1.f);
+		for (int f = 0; f < 8; f++) {
+			std::vector<uint16_t> depth(W*H);
+			for (int y = 0; y < H; y++) {
+				for (int x = 0; x < W; x++) {
+					float z = y > H / 2 ? 800.f + 4000.f*(H - y) / H : 3000.f;		// floor and wall (in mm.)
+					float dx = x - 240.f - 4.f*f, dy = y - 150.f;
+					if (dx*dx + dy*dy < 80.f*80.f) z = 1500.f - sqrtf(80.f*80.f - dx*dx - dy*dy)*2.f;
+					z += noise(random)*z*z*1e-6f;										// noise ~ z^2
+					bool hole = uniform(random) < 0.03f || (x < 40 && y < 200);			// dead pixels and a shadow
+					depth[y*W + x] = hole ? 0 : uint16_t(z);
+				}
+			}
+			synthetic.push_back(depth);
+		}
+		Measure("synthetic", synthetic, W, H);
+
+		if (!frames.empty()) Measure("recorded", frames, width, height);
+	}
+}
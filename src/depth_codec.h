@@ -0,0 +1,24 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+namespace scodec {
+
+	/* lossless codec of depth images (uint16_t, 0 for dead pixels).
+	   each pixel is predicted by the last valid pixel above it, so that the columns are independent and vectorize;
+	   the residuals (0 for dead pixels, so that holes cost nearly nothing) are zigzag-coded and bit-packed
+	   in blocks of 128 with a bit width per block.
+	   the rows are split into bands which are encoded (and decoded) independently, in parallel if asked. */
+	static const int BLOCK = 128;
+	static const int BANDS = 8;
+
+	// appends the encoded image to out, and returns its size in bytes.
+	size_t EncodeDepth(const uint16_t* depth, int width, int height, std::vector<uint8_t>& out, int threads = 1);
+
+	// returns false if data is not an encoded image of width x height.
+	bool DecodeDepth(const uint8_t* data, size_t size, uint16_t* depth, int width, int height, int threads = 1);
+
+	// ratio and speed on a synthetic scene, and on the depth images of the given frames (if any).
+	void BenchmarkDepthCodec(const std::vector<std::vector<uint16_t>>& frames, int width, int height);
+}
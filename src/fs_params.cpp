@@ -0,0 +1,84 @@
+#include "fs_params.h"
+#include <cstdio>
+#include <cstring>
+
+namespace sparams {
+
+	bool ReadKeyValues(const char* path, const std::function<bool(const std::string& key, const char* values)>& visit) {
+		FILE* file = fopen(path, "r");
+		if (file == nullptr) {
+			fprintf(stderr, "Config: failed to open %s.\n", path);
+			return false;
+		}
+
+		bool ok = true;
+		char line[1024];
+		int line_number = 0;
+		while (fgets(line, sizeof(line), file)) {
+			line_number++;
+
+			char key[64];
+			int offset = 0;
+			if (line[strspn(line, " \t\r\n")] == '#' || sscanf(line, "%63s%n", key, &offset) < 1) continue;
+			if (!visit(key, line + offset)) {
+				fprintf(stderr, "Config: %s(%d): bad line \"%s\".\n", path, line_number, key);
+				ok = false;
+			}
+		}
+		fclose(file);
+		return ok;
+	}
+
+	static const struct { const char* name; FS_FEATURE_TYPE type; } TYPES[] = {
+		{ "any", FS_FEATURE_TYPE::FS_TYPE_ANY }, { "plane", FS_FEATURE_TYPE::FS_TYPE_PLANE }, { "sphere", FS_FEATURE_TYPE::FS_TYPE_SPHERE },
+		{ "cylinder", FS_FEATURE_TYPE::FS_TYPE_CYLINDER }, { "cone", FS_FEATURE_TYPE::FS_TYPE_CONE }, { "torus", FS_FEATURE_TYPE::FS_TYPE_TORUS }
+	};
+
+	bool ParseType(const char* name, FS_FEATURE_TYPE& type) {
+		for (const auto& t : TYPES) {
+			if (strcmp(name, t.name) == 0) { type = t.type; return true; }
+		}
+		return false;
+	}
+
+	const char* TypeName(FS_FEATURE_TYPE type) {
+		for (const auto& t : TYPES) {
+			if (t.type == type) return t.name;
+		}
+		return "none";
+	}
+
+	float* Params::find(const std::string& key) {
+		if (key == "accuracy") return &accuracy;
+		if (key == "accuracy_base") return &accuracy_base;
+		if (key == "accuracy_slope") return &accuracy_slope;
+		if (key == "mean_dist") return &mean_dist;
+		if (key == "touch_r") return &touch_r;
+		return nullptr;
+	}
+
+	bool Params::set(const char* assignment) {
+		const char* equal = strchr(assignment, '=');
+		if (equal == nullptr) return false;
+		float* value = find(std::string(assignment, equal));
+		return value && sscanf(equal + 1, "%f", value) == 1;
+	}
+
+	// "<key> <value>" per line, e.g. "touch_r 0.06".
+	bool Params::load(const char* path) {
+		return ReadKeyValues(path, [this](const std::string& key, const char* values) {
+			float* value = find(key);
+			return value && sscanf(values, "%f", value) == 1;
+		});
+	}
+
+	void Params::apply(FIND_SURFACE_CONTEXT fs) const {
+		setFindSurfaceParamFloat(fs, FS_PARAMS::FS_PARAM_ACCURACY, accuracy);
+		setFindSurfaceParamFloat(fs, FS_PARAMS::FS_PARAM_MEAN_DIST, mean_dist);
+		setFindSurfaceParamFloat(fs, FS_PARAMS::FS_PARAM_TOUCH_R, touch_r);
+	}
+
+	void Params::print(FILE* out) const {
+		fprintf(out, "FindSurface: accuracy=%g (%g + %g*(depth - 1) at a seed) mean_dist=%g touch_r=%g\n", accuracy, accuracy_base, accuracy_slope, mean_dist, touch_r);
+	}
+}
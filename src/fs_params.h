@@ -0,0 +1,38 @@
+#pragma once
+#include <cstdio>
+#include <string>
+#include <functional>
+
+#if defined(_MSC_VER)
+#include "libFindSurface\include\FindSurface.h"
+#else
+#include <FindSurface.h>
+#endif
+
+namespace sparams {
+
+	// reads "<key> <values...>" lines of a text file ('#' starts a comment line).
+	// visit is called with the key and the rest of the line, and returns false for an unknown key or bad values.
+	bool ReadKeyValues(const char* path, const std::function<bool(const std::string& key, const char* values)>& visit);
+
+	// "any", "plane", "sphere", "cylinder", "cone", "torus"
+	bool ParseType(const char* name, FS_FEATURE_TYPE& type);
+	const char* TypeName(FS_FEATURE_TYPE type);
+
+	// parameters of FindSurface (in m.), from a config file or the command line.
+	struct Params {
+		float accuracy = 0.003f;		// until the first seed
+		float accuracy_base = 0.006f;	// at a seed: point clouds tend to have measurement errors proportional to distance,
+		float accuracy_slope = 0.002f;	// so the accuracy is accuracy_base + accuracy_slope*(depth - 1 m.)
+		float mean_dist = 0.01f;
+		float touch_r = 0.045f;
+
+		float accuracy_at(float depth) const { return accuracy_base + accuracy_slope*(depth - 1.f); }
+
+		float* find(const std::string& key); // nullptr for an unknown key
+		bool set(const char* assignment); // "<key>=<value>"
+		bool load(const char* path);
+		void apply(FIND_SURFACE_CONTEXT fs) const;
+		void print(FILE* out) const;
+	};
+}
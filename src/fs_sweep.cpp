@@ -0,0 +1,475 @@
+#include "fs_sweep.h"
+#include <cstring>
+#include <cmath>
+#include <random>
+
+#include "capture.h"
+#include "latency.h"
+
+namespace ssweep {
+
+	using namespace smath;
+
+	static const int AXES = 4;
+	static const char* AXIS_KEYS[AXES] = { "accuracy_base", "accuracy_slope", "mean_dist", "touch_r" };
+
+	// the rows of the tables, by the true type of the seed (synthetic) or the type asked (replay).
+	static const FS_FEATURE_TYPE ROWS[] = {
+		FS_FEATURE_TYPE::FS_TYPE_ANY, FS_FEATURE_TYPE::FS_TYPE_PLANE, FS_FEATURE_TYPE::FS_TYPE_SPHERE,
+		FS_FEATURE_TYPE::FS_TYPE_CYLINDER, FS_FEATURE_TYPE::FS_TYPE_CONE, FS_FEATURE_TYPE::FS_TYPE_TORUS
+	};
+	static const int ROW_COUNT = sizeof(ROWS) / sizeof(ROWS[0]);
+
+	static int Row(FS_FEATURE_TYPE type) {
+		for (int k = 0; k < ROW_COUNT; k++) if (ROWS[k] == type) return k;
+		return 0;
+	}
+
+	struct Settings {
+		std::vector<float> axes[AXES];
+		int seeds = 20, seed_sets = 1, frames = 3, threads = 0;
+		std::vector<FS_FEATURE_TYPE> types;
+		bool ask_any = false;
+		std::string csv;
+
+		bool load(const char* path);
+	};
+
+	bool Settings::load(const char* path) {
+		return sparams::ReadKeyValues(path, [this](const std::string& key, const char* values) {
+			char token[512];
+			int n = 0;
+			for (int a = 0; a < AXES; a++) {
+				if (key != AXIS_KEYS[a]) continue;
+				float value;
+				while (sscanf(values, "%f%n", &value, &n) == 1) { axes[a].push_back(value); values += n; }
+				return !axes[a].empty();
+			}
+			if (key == "seeds") return sscanf(values, "%d", &seeds) == 1 && seeds > 0;
+			if (key == "seed_sets") return sscanf(values, "%d", &seed_sets) == 1 && seed_sets > 0;
+			if (key == "frames") return sscanf(values, "%d", &frames) == 1 && frames > 0;
+			if (key == "threads") return sscanf(values, "%d", &threads) == 1 && threads >= 0;
+			if (key == "csv") { if (sscanf(values, "%511s", token) < 1) return false; csv = token; return true; }
+			if (key == "ask") {
+				if (sscanf(values, "%511s", token) < 1 || (strcmp(token, "any") != 0 && strcmp(token, "exact") != 0)) return false;
+				ask_any = strcmp(token, "any") == 0;
+				return true;
+			}
+			if (key == "types") {
+				FS_FEATURE_TYPE type;
+				while (sscanf(values, "%511s%n", token, &n) == 1) {
+					if (!sparams::ParseType(token, type)) return false;
+					types.push_back(type);
+					values += n;
+				}
+				return true;
+			}
+			return false;
+		});
+	}
+
+	// frames and seeds ***************************
+
+	struct Cloud {
+		std::vector<rs::float3> points;
+		std::vector<int> labels; // the primitive of each point (synthetic scene only)
+	};
+
+	struct Seed {
+		int index;
+		int truth;				// index of the primitive, or -1 without ground truth
+		FS_FEATURE_TYPE type;	// asked
+	};
+
+	static void Basis(float3 axis, float3& e1, float3& e2) {
+		float3 other = fabsf(axis[0]) < 0.9f ? float3{ 1.f, 0.f, 0.f } : float3{ 0.f, 1.f, 0.f };
+		e1 = Normalize(Cross(axis, other));
+		e2 = Cross(axis, e1);
+	}
+
+	static float3 F3(const float* v) { return float3{ v[0], v[1], v[2] }; }
+	static void Store(float* v, float3 f) { v[0] = f[0]; v[1] = f[1]; v[2] = f[2]; }
+
+	/* a plane, a sphere, a cylinder, a cone and a torus in front of the depth camera (x right, y down, z forward),
+	   sampled as densely as a 640x480 depth image would (a point per 1/475 rad.), front faces only.
+	   the frames add noise along the rays, growing with the square of the depth (1 mm. at 1 m.). */
+	static void MakeScene(int frames, std::vector<FS_FEATURE_RESULT>& truths, std::vector<Cloud>& clouds) {
+		static const float ANGULAR_STEP = 1.f / 475.f;
+		static const float NOISE = 0.001f;
+		static const float PI = 3.14159265f;
+
+		truths.clear();
+		std::vector<float3> samples;
+		std::vector<int> labels;
+		auto add = [&](float3 p, float3 normal) {
+			if (Dot(normal, p) >= 0.f) return; // back face
+			samples.push_back(p);
+			labels.push_back(int(truths.size()) - 1);
+		};
+		FS_FEATURE_RESULT truth;
+		float3 e1, e2;
+
+		{ // plane
+			float3 c = { 0.f, 0.f, 2.6f }, n = Normalize(float3{ 0.25f, 0.f, -1.f });
+			float w = 2.4f, h = 1.6f, step = ANGULAR_STEP*c[2];
+			Basis(n, e1, e2);
+			truth = {}; truth.type = FS_FEATURE_TYPE::FS_TYPE_PLANE;
+			Store(truth.plane_param.ll, c - e1*(w / 2) - e2*(h / 2)); Store(truth.plane_param.lr, c + e1*(w / 2) - e2*(h / 2));
+			Store(truth.plane_param.ur, c + e1*(w / 2) + e2*(h / 2)); Store(truth.plane_param.ul, c - e1*(w / 2) + e2*(h / 2));
+			truths.push_back(truth);
+			for (float u = -w / 2; u <= w / 2; u += step) for (float v = -h / 2; v <= h / 2; v += step) add(c + e1*u + e2*v, n);
+		}
+		{ // sphere
+			float3 c = { 0.35f, -0.15f, 1.5f };
+			float r = 0.15f, step = ANGULAR_STEP*c[2];
+			truth = {}; truth.type = FS_FEATURE_TYPE::FS_TYPE_SPHERE;
+			Store(truth.sphere_param.c, c); truth.sphere_param.r = r;
+			truths.push_back(truth);
+			Basis(float3{ 0.f, 0.f, 1.f }, e1, e2);
+			for (float theta = step / r; theta < PI; theta += step / r) {
+				int count = max(1, int(2 * PI*r*sinf(theta) / step));
+				for (int k = 0; k < count; k++) {
+					float phi = 2 * PI*k / count;
+					float3 dir = float3{ 0.f, 0.f, 1.f }*cosf(theta) + (e1*cosf(phi) + e2*sinf(phi))*sinf(theta);
+					add(c + dir*r, dir);
+				}
+			}
+		}
+		{ // cylinder (upright)
+			float3 b = { -0.45f, 0.35f, 1.7f }, t = { -0.45f, -0.15f, 1.7f };
+			float r = 0.1f, step = ANGULAR_STEP*b[2], length = Length(t - b);
+			float3 a = Normalize(t - b);
+			truth = {}; truth.type = FS_FEATURE_TYPE::FS_TYPE_CYLINDER;
+			Store(truth.cylinder_param.b, b); Store(truth.cylinder_param.t, t); truth.cylinder_param.r = r;
+			truths.push_back(truth);
+			Basis(a, e1, e2);
+			int count = int(2 * PI*r / step);
+			for (float h = 0.f; h <= length; h += step) {
+				for (int k = 0; k < count; k++) {
+					float3 dir = e1*cosf(2 * PI*k / count) + e2*sinf(2 * PI*k / count);
+					add(b + a*h + dir*r, dir);
+				}
+			}
+		}
+		{ // cone (upright, narrowing upwards)
+			float3 b = { 0.45f, 0.4f, 2.0f }, t = { 0.45f, 0.05f, 2.0f };
+			float br = 0.15f, tr = 0.06f, step = ANGULAR_STEP*b[2], length = Length(t - b);
+			float3 a = Normalize(t - b);
+			truth = {}; truth.type = FS_FEATURE_TYPE::FS_TYPE_CONE;
+			Store(truth.cone_param.b, b); Store(truth.cone_param.t, t); truth.cone_param.br = br; truth.cone_param.tr = tr;
+			truths.push_back(truth);
+			Basis(a, e1, e2);
+			for (float h = 0.f; h <= length; h += step) {
+				float r = br + (tr - br)*h / length;
+				int count = int(2 * PI*r / step);
+				for (int k = 0; k < count; k++) {
+					float3 dir = e1*cosf(2 * PI*k / count) + e2*sinf(2 * PI*k / count);
+					add(b + a*h + dir*r, Normalize(dir*length + a*(br - tr)));
+				}
+			}
+		}
+		{ // torus (facing the camera, tilted)
+			float3 c = { -0.05f, 0.25f, 1.3f }, n = Normalize(float3{ 0.f, -1.f, -0.6f });
+			float mr = 0.12f, tr = 0.04f, step = ANGULAR_STEP*c[2];
+			truth = {}; truth.type = FS_FEATURE_TYPE::FS_TYPE_TORUS;
+			Store(truth.torus_param.c, c); Store(truth.torus_param.n, n); truth.torus_param.mr = mr; truth.torus_param.tr = tr;
+			truths.push_back(truth);
+			Basis(n, e1, e2);
+			for (float theta = 0.f; theta < 2 * PI; theta += step / tr) {
+				float ring = mr + tr*cosf(theta);
+				int count = int(2 * PI*ring / step);
+				for (int k = 0; k < count; k++) {
+					float3 radial = e1*cosf(2 * PI*k / count) + e2*sinf(2 * PI*k / count);
+					add(c + radial*ring + n*(tr*sinf(theta)), radial*cosf(theta) + n*sinf(theta));
+				}
+			}
+		}
+
+		clouds.resize(frames);
+		for (int f = 0; f < frames; f++) {
+			std::mt19937 random(f + 1);
+			std::normal_distribution<float> normal;
+			Cloud& cloud = clouds[f];
+			cloud.points.resize(samples.size());
+			cloud.labels = labels;
+			for (size_t k = 0; k < samples.size(); k++) {
+				float3 p = samples[k];
+				p = p + Normalize(p)*(NOISE*p[2] * p[2] * normal(random));
+				cloud.points[k] = rs::float3{ p[0], p[1], p[2] };
+			}
+		}
+	}
+
+	static bool LoadReplays(const std::vector<const char*>& paths, int frames, std::vector<Cloud>& clouds) {
+		for (const char* path : paths) {
+			scapture::ReplaySource replay(path);
+			replay.paced = false;
+			if (!replay.start()) return false;
+
+			const uint16_t* depth_image;
+			const uint8_t* color_image;
+			double timestamp;
+			scapture::Frame frame;
+			for (int k = 0; k < frames && replay.next(depth_image, color_image, timestamp); k++) {
+				scapture::Deproject(replay, depth_image, color_image, smath::Identity4x4(), frame);
+				if (frame.points.empty()) continue;
+				clouds.push_back(Cloud());
+				clouds.back().points.swap(frame.points);
+			}
+		}
+		return !clouds.empty();
+	}
+
+	// seeds[cloud][set]
+	static std::vector<std::vector<std::vector<Seed>>> MakeSeeds(const Settings& settings, const std::vector<Cloud>& clouds, const std::vector<FS_FEATURE_RESULT>& truths) {
+		std::vector<std::vector<std::vector<Seed>>> seeds(clouds.size());
+		for (size_t f = 0; f < clouds.size(); f++) {
+			const Cloud& cloud = clouds[f];
+			std::vector<std::vector<int>> members(truths.size());
+			for (size_t k = 0; k < cloud.labels.size(); k++) members[cloud.labels[k]].push_back(int(k));
+
+			for (int set = 0; set < settings.seed_sets; set++) {
+				std::mt19937 random(unsigned(1000 * set + f));
+				std::vector<Seed> list;
+				if (!truths.empty()) {
+					for (int t = 0; t < int(truths.size()); t++) {
+						if (members[t].empty()) continue;
+						std::uniform_int_distribution<int> pick(0, int(members[t].size()) - 1);
+						FS_FEATURE_TYPE type = settings.ask_any ? FS_FEATURE_TYPE::FS_TYPE_ANY : truths[t].type;
+						for (int k = 0; k < settings.seeds; k++) list.push_back(Seed{ members[t][pick(random)], t, type });
+					}
+				}
+				else {
+					std::uniform_int_distribution<int> pick(0, int(cloud.points.size()) - 1);
+					for (FS_FEATURE_TYPE type : settings.types) {
+						for (int k = 0; k < settings.seeds; k++) list.push_back(Seed{ pick(random), -1, type });
+					}
+				}
+				seeds[f].push_back(list);
+			}
+		}
+		return seeds;
+	}
+
+	// errors of the parameters ***************************
+
+	static const char* ERROR_NAMES[ERRORS] = { "position mm", "axis deg", "radius mm" };
+
+	static float Angle(float3 a, float3 b) {
+		float c = fabsf(Dot(Normalize(a), Normalize(b)));
+		return acosf(min(c, 1.f)) * 180.f / 3.14159265f;
+	}
+
+	static float DistanceToLine(float3 p, float3 origin, float3 axis) {
+		float3 d = p - origin;
+		return Length(d - axis*Dot(d, axis));
+	}
+
+	// position: of the center (or of the middle of the axis, from the true axis); axis: of the normal or the axis;
+	// radius: of the sphere or the cylinder, of the cone at the middle of the fitted axis, the larger of the torus.
+	void MeasureErrors(const FS_FEATURE_RESULT& truth, const FS_FEATURE_RESULT& fit, float errors[ERRORS]) {
+		errors[0] = errors[1] = errors[2] = NAN;
+		switch (truth.type) {
+		case FS_FEATURE_TYPE::FS_TYPE_PLANE: {
+			const auto& t = truth.plane_param;
+			const auto& f = fit.plane_param;
+			float3 tn = Cross(F3(t.lr) - F3(t.ll), F3(t.ul) - F3(t.ll));
+			float3 fn = Cross(F3(f.lr) - F3(f.ll), F3(f.ul) - F3(f.ll));
+			float3 fc = (F3(f.ll) + F3(f.lr) + F3(f.ur) + F3(f.ul)) / 4.f;
+			errors[0] = fabsf(Dot(fc - F3(t.ll), Normalize(tn)));
+			errors[1] = Angle(tn, fn);
+			break;
+		}
+		case FS_FEATURE_TYPE::FS_TYPE_SPHERE:
+			errors[0] = Length(F3(fit.sphere_param.c) - F3(truth.sphere_param.c));
+			errors[2] = fabsf(fit.sphere_param.r - truth.sphere_param.r);
+			break;
+		case FS_FEATURE_TYPE::FS_TYPE_CYLINDER: {
+			const auto& t = truth.cylinder_param;
+			const auto& f = fit.cylinder_param;
+			float3 axis = Normalize(F3(t.t) - F3(t.b));
+			errors[0] = DistanceToLine((F3(f.b) + F3(f.t)) / 2.f, F3(t.b), axis);
+			errors[1] = Angle(axis, F3(f.t) - F3(f.b));
+			errors[2] = fabsf(f.r - t.r);
+			break;
+		}
+		case FS_FEATURE_TYPE::FS_TYPE_CONE: {
+			const auto& t = truth.cone_param;
+			const auto& f = fit.cone_param;
+			float3 axis = Normalize(F3(t.t) - F3(t.b));
+			float length = Length(F3(t.t) - F3(t.b));
+			float3 middle = (F3(f.b) + F3(f.t)) / 2.f;
+			float h = Dot(middle - F3(t.b), axis);
+			errors[0] = DistanceToLine(middle, F3(t.b), axis);
+			errors[1] = Angle(axis, F3(f.t) - F3(f.b));
+			errors[2] = fabsf((f.br + f.tr) / 2.f - (t.br + (t.tr - t.br)*h / length));
+			break;
+		}
+		case FS_FEATURE_TYPE::FS_TYPE_TORUS:
+			errors[0] = Length(F3(fit.torus_param.c) - F3(truth.torus_param.c));
+			errors[1] = Angle(F3(truth.torus_param.n), F3(fit.torus_param.n));
+			errors[2] = max(fabsf(fit.torus_param.mr - truth.torus_param.mr), fabsf(fit.torus_param.tr - truth.torus_param.tr));
+			break;
+		default: break;
+		}
+		errors[0] *= 1000.f; // mm.
+		errors[2] *= 1000.f;
+	}
+
+	// the sweep ***************************
+
+	struct Cell {
+		slatency::Histogram ms;
+		int tries = 0, successes = 0;
+		double error_sum[ERRORS] = {};
+		int error_count[ERRORS] = {};
+
+		double success_rate() const { return tries > 0 ? double(successes) / tries : 0.0; }
+		double error(int k) const { return error_count[k] > 0 ? error_sum[k] / error_count[k] : NAN; }
+	};
+
+	bool RunSweep(const char* sweep_path, const std::vector<const char*>& replay_paths, const sparams::Params& base) {
+		Settings settings;
+		if (!settings.load(sweep_path)) return false;
+		if (settings.types.empty()) settings.types.push_back(FS_FEATURE_TYPE::FS_TYPE_ANY);
+
+		float base_values[AXES] = { base.accuracy_base, base.accuracy_slope, base.mean_dist, base.touch_r };
+		int combos = 1;
+		for (int a = 0; a < AXES; a++) {
+			if (settings.axes[a].empty()) settings.axes[a].push_back(base_values[a]);
+			combos *= int(settings.axes[a].size());
+		}
+		auto params_of = [&](int combo) {
+			sparams::Params params = base;
+			for (int a = 0; a < AXES; a++) {
+				*params.find(AXIS_KEYS[a]) = settings.axes[a][combo % settings.axes[a].size()];
+				combo /= int(settings.axes[a].size());
+			}
+			return params;
+		};
+
+		std::vector<FS_FEATURE_RESULT> truths;
+		std::vector<Cloud> clouds;
+		if (replay_paths.empty()) MakeScene(settings.frames, truths, clouds);
+		else if (!LoadReplays(replay_paths, settings.frames, clouds)) {
+			fprintf(stderr, "Sweep: no frame to fit.\n");
+			return false;
+		}
+		std::vector<std::vector<std::vector<Seed>>> seeds = MakeSeeds(settings, clouds, truths);
+
+		size_t points = 0;
+		for (const Cloud& cloud : clouds) points += cloud.points.size();
+		int threads = settings.threads > 0 ? settings.threads : max(1, int(std::thread::hardware_concurrency()));
+		threads = min(threads, combos);
+		fprintf(stdout, "Sweep: %d combinations, %d frames (%s, %d points on average), %d seed sets, %d threads.\n", combos, int(clouds.size()),
+			truths.empty() ? "replay" : "synthetic", int(points / clouds.size()), settings.seed_sets, threads);
+
+		// each combination is fitted by one thread, with its own context; so are its cells written.
+		std::vector<std::vector<Cell>> cells(combos, std::vector<Cell>(ROW_COUNT));
+		std::atomic<int> next(0);
+		std::atomic<bool> failed(false);
+		auto work = [&]() {
+			FIND_SURFACE_CONTEXT fs;
+			if (createFindSurface(&fs) < 0) { failed = true; return; }
+
+			FS_FEATURE_RESULT result;
+			for (int combo; (combo = next++) < combos && !failed;) {
+				sparams::Params params = params_of(combo);
+				params.apply(fs);
+				for (size_t f = 0; f < clouds.size(); f++) {
+					const Cloud& cloud = clouds[f];
+					cleanUpFindSurface(fs);
+					setPointCloudFloat(fs, cloud.points.data(), static_cast<unsigned int>(cloud.points.size()), 0);
+
+					for (const std::vector<Seed>& set : seeds[f]) {
+						for (const Seed& seed : set) {
+							setFindSurfaceParamFloat(fs, FS_PARAMS::FS_PARAM_ACCURACY, params.accuracy_at(cloud.points[seed.index].z));
+							double t0 = scapture::Now();
+							int res = findSurface(fs, seed.type, seed.index, &result);
+							double ms = scapture::Now() - t0;
+							if (res == FS_LICENSE_EXPIRED || res == FS_LICENSE_UNKNOWN) { failed = true; break; }
+
+							Cell& cell = cells[combo][Row(seed.truth < 0 ? seed.type : truths[seed.truth].type)];
+							cell.ms.add(ms);
+							cell.tries++;
+							if (res < 0) continue;
+							if (seed.truth < 0) { cell.successes++; continue; }
+							if (result.type != truths[seed.truth].type) continue;
+
+							cell.successes++;
+							float errors[ERRORS];
+							MeasureErrors(truths[seed.truth], result, errors);
+							for (int k = 0; k < ERRORS; k++) {
+								if (std::isnan(errors[k])) continue;
+								cell.error_sum[k] += errors[k];
+								cell.error_count[k]++;
+							}
+						}
+					}
+				}
+			}
+			cleanUpFindSurface(fs);
+			releaseFindSurface(fs);
+		};
+
+		double t0 = scapture::Now();
+		std::vector<std::thread> workers;
+		for (int k = 1; k < threads; k++) workers.push_back(std::thread(work));
+		work();
+		for (std::thread& worker : workers) worker.join();
+		if (failed) {
+			fprintf(stderr, "Sweep: FindSurface failed (license or context).\n");
+			return false;
+		}
+		fprintf(stdout, "Sweep: %.1f s.\n", (scapture::Now() - t0) / 1000.0);
+
+		FILE* csv = nullptr;
+		if (!settings.csv.empty()) {
+			csv = fopen(settings.csv.c_str(), "w");
+			if (csv == nullptr) fprintf(stderr, "Sweep: failed to open %s.\n", settings.csv.c_str());
+			else fprintf(csv, "type,accuracy_base,accuracy_slope,mean_dist,touch_r,tries,success,mean_ms,p90_ms,position_mm,axis_deg,radius_mm,pareto\n");
+		}
+
+		// a table per type; '*' marks the combinations no other one beats in both success rate and mean latency.
+		for (int row = 0; row < ROW_COUNT; row++) {
+			if (cells[0][row].tries == 0) continue;
+			fprintf(stdout, "\n%s (%s asked)\n", sparams::TypeName(ROWS[row]),
+				truths.empty() ? sparams::TypeName(ROWS[row]) : settings.ask_any ? "any type" : "the type");
+			fprintf(stdout, "  %13s %14s %9s %7s %7s %8s %8s %8s", "accuracy_base", "accuracy_slope", "mean_dist", "touch_r", "tries", "success", "mean ms", "p90 ms");
+			for (int k = 0; k < ERRORS; k++) fprintf(stdout, " %11s", ERROR_NAMES[k]);
+			fprintf(stdout, "\n");
+
+			for (int combo = 0; combo < combos; combo++) {
+				const Cell& cell = cells[combo][row];
+				bool pareto = true;
+				for (int other = 0; other < combos && pareto; other++) {
+					const Cell& o = cells[other][row];
+					bool no_worse = o.success_rate() >= cell.success_rate() && o.ms.mean() <= cell.ms.mean();
+					bool better = o.success_rate() > cell.success_rate() || o.ms.mean() < cell.ms.mean();
+					if (no_worse && better) pareto = false;
+				}
+
+				sparams::Params params = params_of(combo);
+				fprintf(stdout, "%c %13g %14g %9g %7g %7d %7.1f%% %8.3f %8.3f", pareto ? '*' : ' ', params.accuracy_base, params.accuracy_slope, params.mean_dist, params.touch_r,
+					cell.tries, 100.0*cell.success_rate(), cell.ms.mean(), cell.ms.percentile(0.9));
+				for (int k = 0; k < ERRORS; k++) {
+					if (std::isnan(cell.error(k))) fprintf(stdout, " %11s", "-");
+					else fprintf(stdout, " %11.2f", cell.error(k));
+				}
+				fprintf(stdout, "\n");
+
+				if (csv) {
+					fprintf(csv, "%s,%g,%g,%g,%g,%d,%g,%g,%g", sparams::TypeName(ROWS[row]), params.accuracy_base, params.accuracy_slope, params.mean_dist, params.touch_r,
+						cell.tries, cell.success_rate(), cell.ms.mean(), cell.ms.percentile(0.9));
+					for (int k = 0; k < ERRORS; k++) {
+						if (std::isnan(cell.error(k))) fprintf(csv, ",");
+						else fprintf(csv, ",%g", cell.error(k));
+					}
+					fprintf(csv, ",%d\n", pareto ? 1 : 0);
+				}
+			}
+		}
+		if (csv) fclose(csv);
+		return true;
+	}
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include <vector>
+
+#include "fs_params.h"
+
+namespace ssweep {
+
+	/* FindSurface over every combination of a grid of parameters, on the same seeds of the same frames:
+	   the frames of replay files (seeds anywhere, no ground truth) or of a synthetic scene of known primitives.
+	   the combinations are spread over threads, each with its own FindSurface context.
+	   prints a table per type (latency, success rate and, on the synthetic scene, the errors of the parameters)
+	   and writes them into a CSV file if asked.
+
+	   the sweep file has a "<key> <values...>" line per setting:
+	     accuracy_base, accuracy_slope, mean_dist, touch_r <values...>	(the base parameters otherwise)
+	     seeds <n>				per primitive (synthetic) or per type (replay), in every frame
+	     seed_sets <n>			different seeds of the same frames
+	     frames <n>				per replay file, or of the synthetic scene (other noise)
+	     types <types...>		asked on replay frames (any by default)
+	     ask any|exact			asked on the synthetic scene: any type, or the true one (default)
+	     threads <n>			the number of cores by default
+	     csv <path> */
+	bool RunSweep(const char* sweep_path, const std::vector<const char*>& replay_paths, const sparams::Params& base);
+
+	// the errors of fit against truth (of the same type): of the position (in mm.), of the axis or the normal (in degrees)
+	// and of the radius (in mm.); NAN where they do not apply.
+	static const int ERRORS = 3;
+	void MeasureErrors(const FS_FEATURE_RESULT& truth, const FS_FEATURE_RESULT& fit, float errors[ERRORS]);
+}
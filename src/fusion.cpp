@@ -0,0 +1,331 @@
+#include "fusion.h"
+#include <cmath>
+#include <cfloat>
+#include <climits>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+namespace sfusion {
+	using namespace smath;
+
+	uint64_t VoxelMap::Key(int x, int y, int z) {
+		// 21 bits per coordinate: +-1M blocks (5 km at 5 mm voxels).
+		const int64_t BIAS = 1 << 20, MASK = (1 << 21) - 1;
+		return uint64_t((x + BIAS) & MASK) | uint64_t((y + BIAS) & MASK) << 21 | uint64_t((z + BIAS) & MASK) << 42;
+	}
+
+	void VoxelMap::reset() {
+		capacity = max(params.memory_budget / sizeof(Block), size_t(1));
+		blocks.clear();
+		blocks.reserve(capacity); // address space only, until the blocks are used
+		free_blocks.clear();
+		table.clear();
+		table.reserve(capacity);
+		touched.clear();
+		frame = 0;
+		counters = Stats();
+	}
+
+	int VoxelMap::threads() const {
+		return params.threads > 0 ? params.threads : max(1, int(std::thread::hardware_concurrency()));
+	}
+
+	const VoxelMap::Block* VoxelMap::find(int x, int y, int z) const {
+		auto it = table.find(Key(x, y, z));
+		return it != table.end() ? &blocks[it->second] : nullptr;
+	}
+
+	// the block at (x, y, z), marked as touched by the current frame; -1 if the pool is full of such blocks.
+	int VoxelMap::allocate(int x, int y, int z) {
+		auto it = table.find(Key(x, y, z));
+		if (it != table.end()) {
+			Block& block = blocks[it->second];
+			if (block.used != frame) {
+				block.used = frame;
+				touched.push_back(it->second);
+			}
+			return it->second;
+		}
+
+		if (free_blocks.empty() && blocks.size() >= capacity) evict();
+		int index;
+		if (!free_blocks.empty()) {
+			index = free_blocks.back();
+			free_blocks.pop_back();
+		}
+		else if (blocks.size() < capacity) {
+			index = int(blocks.size());
+			blocks.emplace_back();
+		}
+		else return -1;
+
+		Block& block = blocks[index];
+		block.x = x; block.y = y; block.z = z;
+		block.used = frame;
+		std::fill(block.sdf, block.sdf + VOXELS, 1.f);
+		std::fill(block.weight, block.weight + VOXELS, 0.f);
+		std::fill(block.color, block.color + VOXELS, ubyte3{});
+		table[Key(x, y, z)] = index;
+		touched.push_back(index);
+		return index;
+	}
+
+	// the least recently integrated eighth of the blocks (not touched by the current frame) go back to the pool at once.
+	void VoxelMap::evict() {
+		std::vector<int> candidates;
+		candidates.reserve(table.size());
+		for (const auto& entry : table) {
+			if (blocks[entry.second].used != frame) candidates.push_back(entry.second);
+		}
+		if (candidates.empty()) return;
+
+		size_t count = max(candidates.size() / 8, size_t(1));
+		std::nth_element(candidates.begin(), candidates.begin() + (count - 1), candidates.end(), [this](int a, int b) { return blocks[a].used < blocks[b].used; });
+		for (size_t k = 0; k < count; k++) {
+			const Block& block = blocks[candidates[k]];
+			table.erase(Key(block.x, block.y, block.z));
+			free_blocks.push_back(candidates[k]);
+		}
+		counters.evicted += count;
+	}
+
+	void VoxelMap::integrate(const std::vector<std::shared_ptr<scapture::Frame>>& frames) {
+		if (capacity == 0) reset();
+		double t0 = scapture::Now();
+		frame++;
+		touched.clear();
+
+		// 1. the blocks within the truncation of the points, from the coarsest grid of the tiles
+		// (every 4th pixel, much denser than the blocks at the working distances).
+		const float block_size = params.voxel_size*BLOCK;
+		const float truncation = params.truncation;
+		for (const auto& view : frames) {
+			const mat4& e = view->extrinsic;
+			const float max_depth2 = params.max_depth*params.max_depth;
+			int last[6] = { INT_MAX };
+			for (const scapture::Tile& tile : view->tiles) {
+				for (int k = tile.first; k < tile.first + tile.count[scapture::TILE_LEVELS - 1]; k++) {
+					const rs::float3& p = view->points[k];
+					float dx = p.x - e[3], dy = p.y - e[7], dz = p.z - e[11];
+					if (dx*dx + dy*dy + dz*dz > max_depth2) continue;
+
+					int range[6] = {
+						int(std::floor((p.x - truncation) / block_size)), int(std::floor((p.x + truncation) / block_size)),
+						int(std::floor((p.y - truncation) / block_size)), int(std::floor((p.y + truncation) / block_size)),
+						int(std::floor((p.z - truncation) / block_size)), int(std::floor((p.z + truncation) / block_size))
+					};
+					if (std::equal(range, range + 6, last)) continue; // the same blocks as the previous point
+					std::copy(range, range + 6, last);
+
+					for (int z = range[4]; z <= range[5]; z++)
+						for (int y = range[2]; y <= range[3]; y++)
+							for (int x = range[0]; x <= range[1]; x++) allocate(x, y, z);
+				}
+			}
+		}
+
+		// 2. each block by one thread, against every view.
+		const int CHUNK = 16;
+		std::atomic<int> next(0);
+		auto work = [this, &frames, &next]() {
+			for (int begin; (begin = next.fetch_add(CHUNK)) < int(touched.size());) {
+				int end = min(begin + CHUNK, int(touched.size()));
+				for (int k = begin; k < end; k++) {
+					for (const auto& view : frames) integrate(blocks[touched[k]], *view);
+				}
+			}
+		};
+		int workers_count = min(threads(), int(touched.size() + CHUNK - 1) / CHUNK);
+		std::vector<std::thread> workers;
+		for (int k = 1; k < workers_count; k++) workers.push_back(std::thread(work));
+		work();
+		for (std::thread& worker : workers) worker.join();
+
+		counters.frames++;
+		counters.integrate_ms += scapture::Now() - t0;
+	}
+
+	// projective: every voxel is projected into the depth image and takes the distance to the surface along the ray
+	// (approximated by the difference of the depths). the distortion of the depth stream is neglected.
+	void VoxelMap::integrate(Block& block, const scapture::Frame& view) const {
+		const rs::intrinsics& depth_intrin = view.depth_intrin;
+		const rs::intrinsics& color_intrin = view.color_intrin;
+		if (view.depth_image.size() < size_t(depth_intrin.width*depth_intrin.height)) return;
+
+		// from the common frame to the depth camera: the transpose of the rotation of extrinsic (row-major).
+		const mat4& e = view.extrinsic;
+		const float vs = params.voxel_size;
+		float3 origin = {
+			(block.x*BLOCK + 0.5f)*vs - e[3],
+			(block.y*BLOCK + 0.5f)*vs - e[7],
+			(block.z*BLOCK + 0.5f)*vs - e[11]
+		};
+		float3 base = {
+			e[0] * origin[0] + e[4] * origin[1] + e[8] * origin[2],
+			e[1] * origin[0] + e[5] * origin[1] + e[9] * origin[2],
+			e[2] * origin[0] + e[6] * origin[1] + e[10] * origin[2]
+		};
+		const float3 step_x = { e[0] * vs, e[1] * vs, e[2] * vs };
+		const float3 step_y = { e[4] * vs, e[5] * vs, e[6] * vs };
+		const float3 step_z = { e[8] * vs, e[9] * vs, e[10] * vs };
+
+		const float fx = depth_intrin.fx, fy = depth_intrin.fy, ppx = depth_intrin.ppx, ppy = depth_intrin.ppy;
+		const int width = depth_intrin.width, height = depth_intrin.height;
+		const uint16_t* depth_image = view.depth_image.data();
+		const bool has_color = view.color_image.size() >= size_t(color_intrin.width*color_intrin.height * 3);
+		const float truncation = params.truncation;
+
+		for (int z = 0; z < BLOCK; z++) {
+			for (int y = 0; y < BLOCK; y++) {
+				// a row of voxels: their positions and pixels are computed together (vectorized), then looked up one by one.
+				float3 row = base + step_y*float(y) + step_z*float(z);
+				float cx[BLOCK], cy[BLOCK], cz[BLOCK], u[BLOCK], v[BLOCK];
+				for (int x = 0; x < BLOCK; x++) {
+					cx[x] = row[0] + step_x[0] * float(x);
+					cy[x] = row[1] + step_x[1] * float(x);
+					cz[x] = row[2] + step_x[2] * float(x);
+					float inverse_z = 1.f / max(cz[x], FLT_EPSILON);
+					u[x] = fx*cx[x] * inverse_z + ppx + 0.5f;
+					v[x] = fy*cy[x] * inverse_z + ppy + 0.5f;
+				}
+
+				for (int x = 0; x < BLOCK; x++) {
+					if (cz[x] <= 0.f || u[x] < 0.f || v[x] < 0.f || u[x] >= float(width) || v[x] >= float(height)) continue;
+					uint16_t depth_value = depth_image[int(v[x])*width + int(u[x])];
+					if (depth_value == 0) continue;
+					float depth = depth_value*view.scale;
+					if (depth > params.max_depth) continue;
+
+					float sdf = depth - cz[x];
+					if (sdf < -truncation) continue; // behind the surface: not seen
+
+					int k = (z*BLOCK + y)*BLOCK + x;
+					float weight = block.weight[k];
+					block.sdf[k] = (block.sdf[k] * weight + min(sdf / truncation, 1.f)) / (weight + 1.f);
+					block.weight[k] = min(weight + 1.f, params.max_weight);
+
+					if (has_color && fabs(sdf) < 0.5f*truncation) {
+						rs::float3 color_point = view.depth_to_color.transform(rs::float3{ cx[x], cy[x], cz[x] });
+						if (color_point.z <= 0.f) continue;
+						int pu = int(color_intrin.fx*color_point.x / color_point.z + color_intrin.ppx + 0.5f);
+						int pv = int(color_intrin.fy*color_point.y / color_point.z + color_intrin.ppy + 0.5f);
+						if (pu < 0 || pv < 0 || pu >= color_intrin.width || pv >= color_intrin.height) continue;
+						const uint8_t* rgb = view.color_image.data() + 3 * (pv*color_intrin.width + pu);
+						ubyte3& color = block.color[k];
+						color.r = uint8_t((color.r*weight + rgb[0]) / (weight + 1.f));
+						color.g = uint8_t((color.g*weight + rgb[1]) / (weight + 1.f));
+						color.b = uint8_t((color.b*weight + rgb[2]) / (weight + 1.f));
+					}
+				}
+			}
+		}
+	}
+
+	void VoxelMap::extract(std::vector<rs::float3>& points, std::vector<ubyte3>& colors, std::vector<scapture::Tile>& tiles) {
+		double t0 = scapture::Now();
+		points.clear();
+		colors.clear();
+		tiles.clear();
+
+		// in the order of the keys, so that the cloud does not depend on the threads.
+		std::vector<std::pair<uint64_t, int>> in_use(table.cbegin(), table.cend());
+		std::sort(in_use.begin(), in_use.end());
+
+		struct Output {
+			std::vector<rs::float3> points;
+			std::vector<ubyte3> colors;
+			std::vector<scapture::Tile> tiles;
+		};
+		int count = max(min(threads(), int(in_use.size())), 1);
+		std::vector<Output> outputs(count);
+
+		// the crossings of the edges to the next voxels along x, y and z (in the next blocks on the last ones).
+		auto work = [this, &in_use, &outputs, count](int thread) {
+			Output& out = outputs[thread];
+			const float vs = params.voxel_size;
+			const float min_weight = params.min_weight;
+			size_t begin = in_use.size()*thread / count, end = in_use.size()*(thread + 1) / count;
+			for (size_t b = begin; b < end; b++) {
+				const Block& block = blocks[in_use[b].second];
+				const Block* next[3] = { find(block.x + 1, block.y, block.z), find(block.x, block.y + 1, block.z), find(block.x, block.y, block.z + 1) };
+				const int corner[3] = { block.x*BLOCK, block.y*BLOCK, block.z*BLOCK };
+
+				scapture::Tile tile = {};
+				tile.first = int(out.points.size());
+				tile.lo = float3{ FLT_MAX, FLT_MAX, FLT_MAX };
+				tile.hi = float3{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+				for (int z = 0; z < BLOCK; z++) {
+					for (int y = 0; y < BLOCK; y++) {
+						for (int x = 0; x < BLOCK; x++) {
+							int k = (z*BLOCK + y)*BLOCK + x;
+							float s0 = block.sdf[k];
+							if (block.weight[k] < min_weight || fabs(s0) >= 1.f) continue;
+
+							int local[3] = { x, y, z };
+							for (int axis = 0; axis < 3; axis++) {
+								const Block* other = &block;
+								int n[3] = { x, y, z };
+								if (++n[axis] == BLOCK) {
+									other = next[axis];
+									n[axis] = 0;
+								}
+								if (other == nullptr) continue;
+								int j = (n[2] * BLOCK + n[1])*BLOCK + n[0];
+								float s1 = other->sdf[j];
+								if (other->weight[j] < min_weight || fabs(s1) >= 1.f || (s0 < 0.f) == (s1 < 0.f)) continue;
+
+								float f = s0 / (s0 - s1);
+								float position[3];
+								for (int a = 0; a < 3; a++) position[a] = (corner[a] + local[a] + 0.5f + (a == axis ? f : 0.f))*vs;
+								rs::float3 p = { position[0], position[1], position[2] };
+								out.points.push_back(p);
+								out.colors.push_back(f < 0.5f ? block.color[k] : other->color[j]);
+								tile.lo = float3{ min(tile.lo[0], p.x), min(tile.lo[1], p.y), min(tile.lo[2], p.z) };
+								tile.hi = float3{ max(tile.hi[0], p.x), max(tile.hi[1], p.y), max(tile.hi[2], p.z) };
+							}
+						}
+					}
+				}
+
+				int n = int(out.points.size()) - tile.first;
+				if (n == 0) continue;
+				for (int level = 0; level < scapture::TILE_LEVELS; level++) tile.count[level] = n;
+				out.tiles.push_back(tile);
+			}
+		};
+		std::vector<std::thread> workers;
+		for (int k = 1; k < count; k++) workers.push_back(std::thread(work, k));
+		work(0);
+		for (std::thread& worker : workers) worker.join();
+
+		for (const Output& out : outputs) {
+			int offset = int(points.size());
+			points.insert(points.end(), out.points.cbegin(), out.points.cend());
+			colors.insert(colors.end(), out.colors.cbegin(), out.colors.cend());
+			for (scapture::Tile tile : out.tiles) {
+				tile.first += offset;
+				tiles.push_back(tile);
+			}
+		}
+
+		counters.extracted = int(points.size());
+		counters.extract_ms = scapture::Now() - t0;
+	}
+
+	VoxelMap::Stats VoxelMap::stats() const {
+		Stats s = counters;
+		s.blocks = int(table.size());
+		s.capacity = int(capacity);
+		// the buckets and the nodes of the table (a key, an index and a link each) besides the blocks.
+		s.memory = blocks.size()*sizeof(Block) + table.bucket_count()*sizeof(void*) + table.size()*(sizeof(uint64_t) + sizeof(int) + sizeof(void*));
+		return s;
+	}
+
+	void VoxelMap::print(FILE* out) const {
+		Stats s = stats();
+		fprintf(out, "Fusion: %d frames at %.1f frames/s (integration), %d of %d blocks (%.1f MB of %.0f MB, %lld evicted), the last extraction %d points in %.1f ms.\n",
+			s.frames, s.fps(), s.blocks, s.capacity, s.memory / (1024.0*1024.0), params.memory_budget / (1024.0*1024.0), s.evicted, s.extracted, s.extract_ms);
+	}
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include <cstdio>
+#include <cstdint>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+
+#include "capture.h"
+
+namespace sfusion {
+
+	/* a truncated signed distance field over a sparse map of voxel blocks, fused from successive frames of a rig
+	   whose poses are known (the extrinsics of the rig config: static cameras, or the replays they were recorded by).
+	   the blocks live in a pool of a fixed memory budget; when it is full, the least recently integrated ones are evicted.
+	   only the blocks around the points of a frame are integrated, in parallel, each by one thread. */
+	class VoxelMap {
+	public:
+		static const int BLOCK = 8;	// voxels per side of a block
+		static const int VOXELS = BLOCK*BLOCK*BLOCK;
+
+		struct Params {
+			float voxel_size = 0.005f;		// in m.
+			float truncation = 0.02f;		// of the signed distances (in m.), less than a block
+			float max_weight = 64.f;		// of the running averages: the older frames fade out past it
+			float min_weight = 3.f;			// of the voxels extracted
+			float max_depth = 4.f;			// farther depths are left out (in m.)
+			size_t memory_budget = size_t(256) << 20; // of the blocks (in bytes)
+			int threads = 0;				// the number of cores by default
+		};
+
+		struct Stats {
+			int frames = 0;
+			double integrate_ms = 0.0;		// spent in integrate(), over the frames
+			int blocks = 0, capacity = 0;
+			size_t memory = 0;				// of the blocks and the table (in bytes)
+			long long evicted = 0;
+			int extracted = 0;				// points of the last extraction
+			double extract_ms = 0.0;
+			double fps() const { return integrate_ms > 0 ? 1000.0*frames / integrate_ms : 0.0; }
+		};
+
+		Params params;
+
+		void reset(); // empties the map (and takes the changes of params)
+		void integrate(const std::vector<std::shared_ptr<scapture::Frame>>& frames);
+
+		// the zero crossings of the field, one tile per block (all the levels of a tile are its whole range).
+		void extract(std::vector<rs::float3>& points, std::vector<ubyte3>& colors, std::vector<scapture::Tile>& tiles);
+
+		Stats stats() const;
+		void print(FILE* out) const;
+
+	private:
+		struct Block {
+			int x, y, z;				// in blocks
+			unsigned long long used;	// the last frame integrated into it
+			float sdf[VOXELS];			// in truncations, x fastest
+			float weight[VOXELS];
+			ubyte3 color[VOXELS];
+		};
+
+		std::vector<Block> blocks;						// the pool, up to capacity
+		std::vector<int> free_blocks;
+		std::unordered_map<uint64_t, int> table;		// key of the block coordinates -> index into blocks
+		std::vector<int> touched;						// by the current frame
+		size_t capacity = 0;
+		unsigned long long frame = 0;
+		Stats counters;
+
+		static uint64_t Key(int x, int y, int z);
+		int allocate(int x, int y, int z);
+		void evict();
+		void integrate(Block& block, const scapture::Frame& view) const;
+		const Block* find(int x, int y, int z) const;
+		int threads() const;
+	};
+}
@@ -0,0 +1,95 @@
+#include "latency.h"
+#include <cmath>
+
+namespace slatency {
+
+	static const double FIRST_EDGE = 0.01; // in ms.
+	static const double GROWTH = 1.1;
+
+	void Histogram::add(double ms) {
+		int bucket = ms <= FIRST_EDGE ? 0 : 1 + int(std::log(ms / FIRST_EDGE) / std::log(GROWTH));
+		if (bucket >= BUCKETS) bucket = BUCKETS - 1;
+		buckets[bucket]++;
+		n++;
+		sum += ms;
+		if (ms > largest_ms) largest_ms = ms;
+	}
+
+	void Histogram::reset() {
+		for (int& bucket : buckets) bucket = 0;
+		n = 0;
+		sum = largest_ms = 0.0;
+	}
+
+	double Histogram::percentile(double p) const {
+		if (n == 0) return 0.0;
+		int rank = int(std::ceil(p*n)), seen = 0;
+		for (int k = 0; k < BUCKETS; k++) {
+			seen += buckets[k];
+			if (seen >= rank && seen > 0) {
+				double edge = FIRST_EDGE*std::pow(GROWTH, k);
+				return edge < largest_ms ? edge : largest_ms;
+			}
+		}
+		return largest_ms;
+	}
+
+	void Tracker::frame(const FrameTag& tag) {
+		deproject.add(tag.deprojected - tag.arrival);
+		queue.add(tag.merged - tag.deprojected);
+		process.add(tag.submitted - tag.merged);
+		gpu.add(tag.completed - tag.submitted);
+		total.add(tag.completed - tag.arrival);
+		frames++;
+		shown_arrival = tag.arrival;
+
+		// the shortest gap between device timestamps is taken as the frame interval.
+		double gap = tag.device - last_device;
+		if (last_device > 0.0 && gap > 0.0) {
+			if (interval == 0.0 || gap < interval) interval = gap;
+			skipped += int(std::floor(gap / interval + 0.5)) - 1;
+		}
+		last_device = tag.device;
+
+		// the first frame merged after the result shows it.
+		if (click_pending && tag.merged >= result_time) {
+			click_photon.add(tag.completed - click_time);
+			click_pending = false;
+		}
+	}
+
+	void Tracker::click(double now) {
+		if (shown_arrival > 0.0) click_age.add(now - shown_arrival);
+		click_time = now;
+	}
+
+	void Tracker::click_result(double now) {
+		click_fit.add(now - click_time);
+		result_time = now;
+		click_pending = true;
+	}
+
+	void Tracker::reset() {
+		Histogram* histograms[] = { &deproject, &queue, &process, &gpu, &total, &click_age, &click_fit, &click_photon };
+		for (Histogram* h : histograms) h->reset();
+		frames = skipped = 0;
+		last_device = interval = 0.0;
+		click_pending = false;
+	}
+
+	void Tracker::print(FILE* out) const {
+		struct Row { const char* name; const Histogram& h; };
+		const Row rows[] = {
+			{ "deprojection", deproject }, { "queue", queue }, { "process", process }, { "GPU", gpu }, { "capture to photon", total },
+			{ "image age at click", click_age }, { "click to result", click_fit }, { "click to photon", click_photon }
+		};
+
+		fprintf(out, "Latency: %d frames shown, %d skipped.\n", frames, skipped);
+		fprintf(out, "%-20s %7s %8s %8s %8s %8s %8s\n", "(ms.)", "count", "mean", "p50", "p90", "p99", "max");
+		for (const Row& row : rows) {
+			if (row.h.count() == 0) continue;
+			fprintf(out, "%-20s %7d %8.2f %8.2f %8.2f %8.2f %8.2f\n", row.name, row.h.count(), row.h.mean(),
+				row.h.percentile(0.5), row.h.percentile(0.9), row.h.percentile(0.99), row.h.largest());
+		}
+	}
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <cstdio>
+
+namespace slatency {
+
+	// latencies (in ms.) in logarithmic buckets, 10% wide from 0.01 ms. (up to about 20 minutes).
+	class Histogram {
+	public:
+		void add(double ms);
+		void reset();
+
+		int count() const { return n; }
+		double mean() const { return n > 0 ? sum / n : 0.0; }
+		double largest() const { return largest_ms; }
+		double percentile(double p) const; // p in [0, 1]; the upper edge of the bucket
+
+	private:
+		static const int BUCKETS = 256;
+		int buckets[BUCKETS] = {};
+		int n = 0;
+		double sum = 0.0, largest_ms = 0.0;
+	};
+
+	// host times of a frame along the pipeline (in ms.)
+	struct FrameTag {
+		double device = 0.0;		// by the device clock: only the gaps between frames mean something
+		double arrival = 0.0;		// into the host
+		double deprojected = 0.0;
+		double merged = 0.0;		// taken by the main thread
+		double submitted = 0.0;		// rendering commands issued, up to the swap
+		double completed = 0.0;		// by the GPU (its fence found signaled)
+	};
+
+	// per-stage latencies of the frames shown, and of the clicks.
+	class Tracker {
+	public:
+		Histogram deproject;	// arrival -> deprojected
+		Histogram queue;		// deprojected -> merged
+		Histogram process;		// merged -> submitted (FindSurface input and rendering)
+		Histogram gpu;			// submitted -> completed
+		Histogram total;		// arrival -> completed
+
+		Histogram click_age;	// age of the image on screen at a click (since its arrival)
+		Histogram click_fit;	// click -> result
+		Histogram click_photon;	// click -> completion of the first frame showing the result
+
+		int frames = 0;
+		int skipped = 0;		// frames never shown, from the gaps of the device timestamps
+
+		void frame(const FrameTag& tag); // completed by the GPU
+		void click(double now);
+		void click_result(double now);
+		void reset();
+		void reset_interval() { interval = 0.0; } // the frame rate changes
+		void print(FILE* out) const;
+
+	private:
+		double shown_arrival = 0.0;	// of the latest completed frame
+		double last_device = 0.0, interval = 0.0;
+		double click_time = 0.0, result_time = 0.0;
+		bool click_pending = false;
+	};
+}
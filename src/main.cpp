@@ -1,11 +1,197 @@
 #include "Application.h"
+#include "depth_codec.h"
+#include "fs_sweep.h"
+#include "normals.h"
+#include "primitive_store.h"
 
-int main() {
+// the depth codec on a synthetic scene and on the frames of replay files.
+static void bench_codec(const std::vector<const char*>& paths) {
+	static const int FRAMES = 30; // per file
+	std::vector<std::vector<uint16_t>> frames;
+	int width = 0, height = 0;
+	for (const char* path : paths) {
+		scapture::ReplaySource replay(path);
+		replay.paced = false;
+		if (!replay.start()) continue;
+		if (!frames.empty() && (replay.depth_intrin.width != width || replay.depth_intrin.height != height)) {
+			fprintf(stderr, "Codec: %s has another resolution; skipped.\n", path);
+			continue;
+		}
+		width = replay.depth_intrin.width;
+		height = replay.depth_intrin.height;
+
+		const uint16_t* depth_image;
+		const uint8_t* color_image;
+		double timestamp;
+		for (int k = 0; k < FRAMES && replay.next(depth_image, color_image, timestamp); k++) {
+			frames.push_back(std::vector<uint16_t>(depth_image, depth_image + width*height));
+		}
+	}
+	scodec::BenchmarkDepthCodec(frames, width, height);
+}
+
+// the normal estimation on a synthetic scene and on the frames of replay files.
+static void bench_normals(const std::vector<const char*>& paths) {
+	static const int FRAMES = 10; // per file
+	std::vector<scapture::Frame> frames;
+	for (const char* path : paths) {
+		scapture::ReplaySource replay(path);
+		replay.paced = false;
+		if (!replay.start()) continue;
+
+		const uint16_t* depth_image;
+		const uint8_t* color_image;
+		double timestamp;
+		for (int k = 0; k < FRAMES && replay.next(depth_image, color_image, timestamp); k++) {
+			frames.push_back(scapture::Frame());
+			scapture::Deproject(replay, depth_image, color_image, smath::Identity4x4(), frames.back());
+		}
+	}
+	snormal::BenchmarkNormals(frames);
+}
+
+static const char USAGE[] =
+	"usage: RealSenseDemo [--headless] [--socket <path>] [--shm <name>] [--shm-points] [--store <path>] [--budget <ms>] [--roi] [--segment] [--normals] [--pyramid] [--accumulate [--voxel-size <m>] [--fusion-budget <MB>]] [--program-cache <dir>|--no-program-cache] [FindSurface parameters] [rig config]\n"
+	"       RealSenseDemo --bench-arc\n"
+	"       RealSenseDemo --check-arc (fails if GetArcExtent and the three-pass estimate disagree, see make check)\n"
+	"       RealSenseDemo --write-scene <path> [frames] (a replay of a synthetic scene, see tests/server_check.sh)\n"
+	"       RealSenseDemo --bench-codec [replay files]\n"
+	"       RealSenseDemo --bench-normals [replay files]\n"
+	"       RealSenseDemo --bench-store [path] [primitives]\n"
+	"       RealSenseDemo --bench-render [--size <width>x<height>] [--redraws <n>] [--roi|--segment|...] [rig config] (offscreen, no display; make OFFSCREEN=1)\n"
+	"       RealSenseDemo --sweep <sweep file> [FindSurface parameters] [replay files]\n"
+	"FindSurface parameters: --config <path> (a \"<key> <value>\" per line) and --set <key>=<value>, applied in order.\n";
+
+// a usage error: the message, then the usage.
+static int usage(const char* message, const char* arg) {
+	fprintf(stderr, "%s \"%s\".\n%s", message, arg, USAGE);
+	return EXIT_FAILURE;
+}
+
+int main(int argc, char* argv[]) {
+
+	if (argc > 2 && strcmp(argv[1], "--write-scene") == 0) {
+		return scapture::WriteSyntheticReplay(argv[2], argc > 3 ? atoi(argv[3]) : 30) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+	if (argc > 1 && strcmp(argv[1], "--bench-arc") == 0) {
+		sgeometry::BenchmarkArcExtent();
+		return EXIT_SUCCESS;
+	}
+	if (argc > 1 && strcmp(argv[1], "--check-arc") == 0) {
+		return sgeometry::CheckArcExtent() ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+	if (argc > 1 && strcmp(argv[1], "--bench-codec") == 0) {
+		bench_codec(std::vector<const char*>(argv + 2, argv + argc));
+		return EXIT_SUCCESS;
+	}
+	if (argc > 1 && strcmp(argv[1], "--bench-normals") == 0) {
+		bench_normals(std::vector<const char*>(argv + 2, argv + argc));
+		return EXIT_SUCCESS;
+	}
+	if (argc > 1 && strcmp(argv[1], "--bench-store") == 0) {
+		sdb::BenchmarkStore(argc > 2 ? argv[2] : "primitives_bench.db", argc > 3 ? uint32_t(atoi(argv[3])) : 1000000);
+		return EXIT_SUCCESS;
+	}
+
+	const char* rig_config = nullptr;
+	const char* sweep_path = nullptr;
+	std::vector<const char*> replay_paths;
+	sparams::Params params;
+	const char* socket_path = nullptr;
+	const char* shm_name = nullptr;
+	bool shm_points = false;
+	const char* store_path = nullptr;
+	bool headless = false;
+	double budget = 0.0;
+	bool roi = false;
+	bool segment = false;
+	bool normals = false;
+	bool pyramid = false;
+	bool accumulate = false;
+	sfusion::VoxelMap::Params fusion;
+	const char* program_cache = "program_cache";
+	bool bench_render = false;
+	int render_width = 1280, render_height = 960, render_redraws = 300;
+	static const char* const VALUE_OPTIONS[] = { "--socket", "--shm", "--store", "--budget", "--voxel-size", "--fusion-budget",
+		"--program-cache", "--config", "--set", "--sweep", "--size", "--redraws" };
+	for (int k = 1; k < argc; k++) {
+		for (const char* option : VALUE_OPTIONS) {
+			if (strcmp(argv[k], option) == 0 && k + 1 == argc) return usage("Missing the value of", argv[k]);
+		}
+
+		if (strcmp(argv[k], "--help") == 0) { fputs(USAGE, stdout); return EXIT_SUCCESS; }
+		else if (strcmp(argv[k], "--headless") == 0) headless = true;
+		else if (strcmp(argv[k], "--socket") == 0) { socket_path = argv[++k]; headless = true; }
+		else if (strcmp(argv[k], "--shm") == 0) shm_name = argv[++k];
+		else if (strcmp(argv[k], "--shm-points") == 0) shm_points = true;
+		else if (strcmp(argv[k], "--store") == 0) store_path = argv[++k];
+		else if (strcmp(argv[k], "--budget") == 0) budget = atof(argv[++k]);
+		else if (strcmp(argv[k], "--roi") == 0) roi = true;
+		else if (strcmp(argv[k], "--segment") == 0) segment = true;
+		else if (strcmp(argv[k], "--normals") == 0) normals = true;
+		else if (strcmp(argv[k], "--pyramid") == 0) pyramid = true;
+		else if (strcmp(argv[k], "--accumulate") == 0) accumulate = true;
+		else if (strcmp(argv[k], "--voxel-size") == 0) {
+			fusion.voxel_size = float(atof(argv[++k]));
+			fusion.truncation = 4.f*fusion.voxel_size;
+		}
+		else if (strcmp(argv[k], "--fusion-budget") == 0) fusion.memory_budget = size_t(atof(argv[++k])*1024.0*1024.0);
+		else if (strcmp(argv[k], "--program-cache") == 0) program_cache = argv[++k];
+		else if (strcmp(argv[k], "--no-program-cache") == 0) program_cache = nullptr;
+		else if (strcmp(argv[k], "--config") == 0) { if (!params.load(argv[++k])) return EXIT_FAILURE; }
+		else if (strcmp(argv[k], "--set") == 0) {
+			if (!params.set(argv[++k])) { fprintf(stderr, "Config: bad parameter \"%s\".\n", argv[k]); return EXIT_FAILURE; }
+		}
+		else if (strcmp(argv[k], "--sweep") == 0) sweep_path = argv[++k];
+		else if (strcmp(argv[k], "--bench-render") == 0) bench_render = true;
+		else if (strcmp(argv[k], "--size") == 0) {
+			if (sscanf(argv[++k], "%dx%d", &render_width, &render_height) != 2 || render_width <= 0 || render_height <= 0) {
+				fprintf(stderr, "Render: bad size \"%s\" (<width>x<height>).\n", argv[k]);
+				return EXIT_FAILURE;
+			}
+		}
+		else if (strcmp(argv[k], "--redraws") == 0) {
+			render_redraws = atoi(argv[++k]);
+			if (render_redraws <= 0) { fprintf(stderr, "Render: bad count of redraws \"%s\".\n", argv[k]); return EXIT_FAILURE; }
+		}
+		else if (strncmp(argv[k], "--", 2) == 0) return usage("Unknown option", argv[k]);
+		else replay_paths.push_back(argv[k]);
+	}
+
+	// the replay files of a sweep, or a single rig config.
+	if (!sweep_path && replay_paths.size() > 1) return usage("More than one rig config:", replay_paths[1]);
+	if (!sweep_path && !replay_paths.empty()) rig_config = replay_paths[0];
+
+	if (sweep_path) return ssweep::RunSweep(sweep_path, replay_paths, params) ? EXIT_SUCCESS : EXIT_FAILURE;
 
 	try {
+		sgl::SetProgramCache(program_cache);
 		Application app;
+		app.set_params(params);
+		app.set_fusion(fusion, accumulate);
+		if (bench_render) {
+			app.set_offscreen(render_width, render_height);
+			headless = false;
+		}
+
+		if (app.init(rig_config, headless) == false) return EXIT_FAILURE;
+		if (shm_name && app.open_result_ring(shm_name, shm_points) == false) return EXIT_FAILURE;
+		if (store_path && app.open_primitive_store(store_path) == false) return EXIT_FAILURE;
+		if (budget > 0) app.set_latency_budget(budget);
+		app.set_roi(roi);
+		app.set_segments(segment);
+		app.set_normals(normals);
+		app.set_pyramid(pyramid);
+
+		if (bench_render) {
+			app.benchmark_render(render_redraws, stdout);
+			return EXIT_SUCCESS;
+		}
 
-		if (app.init() == false) return EXIT_FAILURE;
+		if (headless) {
+			app.serve(socket_path);
+			return EXIT_SUCCESS;
+		}
 
 		app.prompt_usage();
 
@@ -0,0 +1,249 @@
+#include <cmath>
+#include <thread>
+#include <random>
+
+#include "normals.h"
+
+namespace snormal {
+	using namespace smath;
+
+	static inline void Add(Moments& a, const Moments& b) {
+		a.n += b.n; a.x += b.x; a.y += b.y; a.z += b.z;
+		a.xx += b.xx; a.xy += b.xy; a.xz += b.xz; a.yy += b.yy; a.yz += b.yz; a.zz += b.zz;
+	}
+
+	// the eigenvector of the smallest eigenvalue of a covariance (xx, xy, xz, yy, yz, zz), unless that eigenvalue
+	// over the sum of the eigenvalues (the curvature) is above max_curvature. the roots of the characteristic polynomial are all real and not negative,
+	// so newton's method from 0 rises to the smallest one (in a few steps when it is far below the others, as on
+	// surfaces); the vector is then the longest cross product of two rows of (c - lambda*I).
+	static bool SmallestEigenvector(const double c[6], float max_curvature, float3& normal) {
+		const double xx = c[0], xy = c[1], xz = c[2], yy = c[3], yz = c[4], zz = c[5];
+		const double trace = xx + yy + zz;
+		if (trace <= 0.0) return false;
+		const double minors = xx*yy - xy*xy + xx*zz - xz*xz + yy*zz - yz*yz;
+		const double det = xx*(yy*zz - yz*yz) - xy*(xy*zz - yz*xz) + xz*(xy*yz - yy*xz);
+
+		// lambda^3 - trace*lambda^2 + minors*lambda - det
+		double lambda = 0.0;
+		for (int k = 0; k < 16; k++) {
+			double value = ((lambda - trace)*lambda + minors)*lambda - det;
+			double slope = (3.0*lambda - 2.0*trace)*lambda + minors;
+			if (slope <= 0.0) break;
+			double step = value / slope;
+			lambda -= step;
+			if (lambda > max_curvature*trace) return false; // it only rises
+			if (fabs(step) <= 1e-6*trace) break;
+		}
+
+		float3 r0 = { float(xx - lambda), float(xy), float(xz) };
+		float3 r1 = { float(xy), float(yy - lambda), float(yz) };
+		float3 r2 = { float(xz), float(yz), float(zz - lambda) };
+		float3 c01 = Cross(r0, r1), c02 = Cross(r0, r2), c12 = Cross(r1, r2);
+		float d01 = Dot(c01, c01), d02 = Dot(c02, c02), d12 = Dot(c12, c12);
+		float3 v = c01;
+		float length2 = d01;
+		if (d02 > length2) { v = c02; length2 = d02; }
+		if (d12 > length2) { v = c12; length2 = d12; }
+		if (length2 <= 0.f) return false;
+		normal = v * (1.f / sqrtf(length2));
+		return true;
+	}
+
+	template <typename Body> static void ForBands(int threads, Body body) {
+		std::vector<std::thread> workers;
+		for (int k = 1; k < threads; k++) workers.push_back(std::thread(body, k));
+		body(0);
+		for (std::thread& worker : workers) worker.join();
+	}
+
+	void Estimator::estimate(const scapture::Frame& frame, rs::float3* normals) {
+		double t0 = scapture::Now();
+		width = frame.depth_intrin.width;
+		height = frame.depth_intrin.height;
+		pixels = width*height;
+		const int stride = width + 1;
+
+		scapture::PixelPoints(frame, pixel_points);
+		integral.resize(size_t(stride)*(height + 1));
+		for (int x = 0; x < stride; x++) integral[x] = Moments{};
+
+		int threads = params.threads > 0 ? params.threads : max(1, int(std::thread::hardware_concurrency()));
+		threads = max(min(threads, height / 16), 1);
+
+		// the points relative to the camera, both for the precision of the sums and to face the normals to it.
+		const rs::float3 origin = scapture::Transform(frame.extrinsic, rs::float3{ 0.f, 0.f, 0.f });
+		const rs::float3* points = frame.points.data();
+
+		// 1. the prefix sums along the rows.
+		ForBands(threads, [&](int k) {
+			for (int y = height*k / threads; y < height*(k + 1) / threads; y++) {
+				Moments sum = {};
+				Moments* row = &integral[size_t(y + 1)*stride];
+				row[0] = sum;
+				for (int x = 0; x < width; x++) {
+					int index = pixel_points[y*width + x];
+					if (index >= 0) {
+						double px = points[index].x - origin.x, py = points[index].y - origin.y, pz = points[index].z - origin.z;
+						sum.n += 1.0; sum.x += px; sum.y += py; sum.z += pz;
+						sum.xx += px*px; sum.xy += px*py; sum.xz += px*pz; sum.yy += py*py; sum.yz += py*pz; sum.zz += pz*pz;
+					}
+					row[x + 1] = sum;
+				}
+			}
+		});
+
+		// 2. then along the columns, a strip of columns per thread.
+		ForBands(threads, [&](int k) {
+			int begin = 1 + width*k / threads, end = 1 + width*(k + 1) / threads;
+			for (int y = 2; y <= height; y++) {
+				Moments* row = &integral[size_t(y)*stride];
+				const Moments* above = row - stride;
+				for (int x = begin; x < end; x++) Add(row[x], above[x]);
+			}
+		});
+
+		// 3. the covariance of the window of every point, clipped to the image.
+		const int r = params.window;
+		const double min_count = 0.25*(2 * r + 1)*(2 * r + 1);
+		const float max_curvature = params.max_curvature;
+		const float min_cos2 = cosf(params.max_incidence*PI / 180.f)*cosf(params.max_incidence*PI / 180.f);
+		ForBands(threads, [&](int k) {
+			for (int y = height*k / threads; y < height*(k + 1) / threads; y++) {
+				const Moments* top = &integral[size_t(max(y - r, 0))*stride];
+				const Moments* bottom = &integral[size_t(min(y + r + 1, height))*stride];
+				for (int x = 0; x < width; x++) {
+					int index = pixel_points[y*width + x];
+					if (index < 0) continue;
+					int x0 = max(x - r, 0), x1 = min(x + r + 1, width);
+					const Moments &a = top[x0], &b = top[x1], &c = bottom[x0], &d = bottom[x1];
+
+					rs::float3& normal = normals[index];
+					normal = rs::float3{ 0.f, 0.f, 0.f };
+					double n = d.n - b.n - c.n + a.n;
+					if (n < min_count) continue;
+
+					double inv = 1.0 / n;
+					double mx = (d.x - b.x - c.x + a.x)*inv, my = (d.y - b.y - c.y + a.y)*inv, mz = (d.z - b.z - c.z + a.z)*inv;
+					double covariance[6] = {
+						(d.xx - b.xx - c.xx + a.xx)*inv - mx*mx, (d.xy - b.xy - c.xy + a.xy)*inv - mx*my,
+						(d.xz - b.xz - c.xz + a.xz)*inv - mx*mz, (d.yy - b.yy - c.yy + a.yy)*inv - my*my,
+						(d.yz - b.yz - c.yz + a.yz)*inv - my*mz, (d.zz - b.zz - c.zz + a.zz)*inv - mz*mz
+					};
+
+					float3 v;
+					if (!SmallestEigenvector(covariance, max_curvature, v)) continue;
+					// a window across a depth jump looks like a surface along the rays: its normal is across them.
+					const rs::float3& p = points[index];
+					float3 ray = { p.x - origin.x, p.y - origin.y, p.z - origin.z };
+					float cosine = Dot(v, ray);
+					if (cosine*cosine < min_cos2*Dot(ray, ray)) continue;
+					normal = cosine > 0.f ? rs::float3{ -v[0], -v[1], -v[2] } : rs::float3{ v[0], v[1], v[2] };
+				}
+			}
+		});
+
+		estimate_ms = scapture::Now() - t0;
+	}
+
+	// benchmark ***************************
+
+	// a depth image rendered into the source by the scene (and the true normals of its pixels).
+	struct SyntheticSource : scapture::Source {
+		bool start() override { return true; }
+		void stop() override {}
+		bool switch_profile(int) override { return false; }
+		bool next(const uint16_t*&, const uint8_t*&, double&) override { return false; }
+		std::string name() const override { return "synthetic"; }
+	};
+
+	static void Measure(const char* name, const std::vector<scapture::Frame>& frames, const std::vector<std::vector<float3>>& truths) {
+		const int REPEAT = 10;
+		const int WINDOWS[] = { 2, 5, 10 };
+		for (int window : WINDOWS) {
+			double ms1 = 0.0, msn = 0.0, error = 0.0;
+			long long pixels = 0, points = 0, found = 0, compared = 0;
+			Estimator estimator;
+			estimator.params.window = window;
+			std::vector<rs::float3> normals;
+			std::vector<int> pixel_points;
+			for (size_t f = 0; f < frames.size(); f++) {
+				const scapture::Frame& frame = frames[f];
+				normals.resize(frame.points.size());
+				estimator.params.threads = 1;
+				for (int k = 0; k < REPEAT; k++) { estimator.estimate(frame, normals.data()); ms1 += estimator.estimate_ms / REPEAT; }
+				estimator.params.threads = 0;
+				for (int k = 0; k < REPEAT; k++) { estimator.estimate(frame, normals.data()); msn += estimator.estimate_ms / REPEAT; }
+				pixels += estimator.pixels;
+				points += frame.points.size();
+
+				if (f < truths.size()) scapture::PixelPoints(frame, pixel_points);
+				for (size_t pixel = 0; f < truths.size() && pixel < pixel_points.size(); pixel++) {
+					int index = pixel_points[pixel];
+					if (index < 0 || (normals[index].x == 0.f && normals[index].y == 0.f && normals[index].z == 0.f)) continue;
+					const float3& truth = truths[f][pixel];
+					float cosine = normals[index].x*truth[0] + normals[index].y*truth[1] + normals[index].z*truth[2];
+					error += acos(clamp(double(cosine), -1.0, 1.0))*180.0 / PI;
+					compared++;
+				}
+				for (const rs::float3& normal : normals) found += normal.x != 0.f || normal.y != 0.f || normal.z != 0.f;
+			}
+
+			fprintf(stdout, "%-10s %3d frames, window %2dx%-2d: %.1f ns/pixel (%.1f ns/pixel with %d threads), %.1f%% of the points with a normal",
+				name, int(frames.size()), 2 * window + 1, 2 * window + 1, ms1*1e6 / pixels, msn*1e6 / pixels,
+				max(1, int(std::thread::hardware_concurrency())), 100.0*found / max(points, 1LL));
+			if (compared > 0) fprintf(stdout, ", mean error %.2f deg", error / compared);
+			fprintf(stdout, "\n");
+		}
+	}
+
+	void BenchmarkNormals(const std::vector<scapture::Frame>& frames) {
+
+		// synthetic scene: a floor, a wall and a sphere, sensor noise growing with distance, and holes.
+		const int W = 640, H = 480;
+		SyntheticSource source;
+		source.depth_intrin.width = source.color_intrin.width = W;
+		source.depth_intrin.height = source.color_intrin.height = H;
+		source.depth_intrin.fx = source.depth_intrin.fy = source.color_intrin.fx = source.color_intrin.fy = 580.f;
+		source.depth_intrin.ppx = source.color_intrin.ppx = W / 2.f;
+		source.depth_intrin.ppy = source.color_intrin.ppy = H / 2.f;
+		source.depth_to_color.rotation[0] = source.depth_to_color.rotation[4] = source.depth_to_color.rotation[8] = 1.f;
+		source.scale = 0.001f;
+
+		std::vector<scapture::Frame> synthetic(4);
+		std::vector<std::vector<float3>> truths(synthetic.size(), std::vector<float3>(W*H));
+		std::mt19937 random(11);
+		std::normal_distribution<float> noise(0.f, 1.f);
+		std::uniform_real_distribution<float> uniform(0.f, 1.f);
+		std::vector<uint16_t> depth(W*H);
+		std::vector<uint8_t> color(W*H * 3, 128);
+		for (size_t f = 0; f < synthetic.size(); f++) {
+			const float3 center = { 0.1f + 0.05f*f, 0.f, 1.5f };
+			const float radius = 0.3f;
+			for (int y = 0; y < H; y++) {
+				for (int x = 0; x < W; x++) {
+					float3 ray = { (x - W / 2.f) / 580.f, (y - H / 2.f) / 580.f, 1.f }; // z = 1
+					float z = 3.f;								// the wall
+					float3 normal = { 0.f, 0.f, -1.f };
+					if (ray[1] > 0.f && 0.6f / ray[1] < z) {	// the floor, 0.6 m. below the camera (y down)
+						z = 0.6f / ray[1];
+						normal = float3{ 0.f, -1.f, 0.f };
+					}
+					float b = Dot(ray, center), a = Dot(ray, ray), c = Dot(center, center) - radius*radius;
+					float disc = b*b - a*c;
+					if (disc >= 0.f && (b - sqrtf(disc)) / a < z) {
+						z = (b - sqrtf(disc)) / a;
+						normal = Normalize(ray*z - center);
+					}
+					z += noise(random)*z*z*0.001f;				// noise ~ z^2, 1 mm. at 1 m.
+					bool hole = uniform(random) < 0.03f;
+					depth[y*W + x] = hole ? 0 : uint16_t(z*1000.f + 0.5f);
+					truths[f][y*W + x] = normal;
+				}
+			}
+			scapture::Deproject(source, depth.data(), color.data(), Identity4x4(), synthetic[f]);
+		}
+		Measure("synthetic", synthetic, truths);
+
+		if (!frames.empty()) Measure("recorded", frames, std::vector<std::vector<float3>>());
+	}
+}
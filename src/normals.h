@@ -0,0 +1,42 @@
+#pragma once
+#include <vector>
+
+#include "capture.h"
+
+namespace snormal {
+
+	struct Params {
+		int window = 5;				// half side of the window of pixels (in pixels): (2*window + 1)^2 pixels
+		float max_curvature = 0.1f;	// windows curved more than this (across an edge or a depth jump) give no normal
+		float max_incidence = 80.f;	// nor those whose normal is farther from the ray of the pixel (in degrees)
+		int threads = 0;			// the number of cores by default
+	};
+
+	// of the points in a range of pixels: their count, sums and sums of products.
+	struct Moments {
+		double n, x, y, z, xx, xy, xz, yy, yz, zz;
+	};
+
+	/* the normals of the points of a frame, from the covariance of the points in a window of pixels around each one.
+	   the moments of the points (their count, sums and sums of products) are summed into integral images of the
+	   depth grid, so that the covariance of any window costs four lookups, whatever its size.
+	   the rows are summed in parallel, then the columns, then the normals of the bands of rows are found in parallel. */
+	class Estimator {
+	public:
+		Params params;
+		double estimate_ms = 0.0;	// of the last estimate()
+		int pixels = 0;				// of the depth image of the last estimate()
+
+		// the unit normal of every point of frame (in the common frame, facing its camera) into normals[0 ~ points.size()),
+		// or zero where the window holds too few points, is too curved or seen too obliquely: on edges, depth jumps and noise.
+		void estimate(const scapture::Frame& frame, rs::float3* normals);
+
+	private:
+		int width = 0, height = 0;
+		std::vector<int> pixel_points;	// point of every pixel (-1: dead)
+		std::vector<Moments> integral;	// (width + 1) x (height + 1), the first row and column zero
+	};
+
+	// ns per pixel on a synthetic scene of known normals (with the angular error) and on the given frames (if any).
+	void BenchmarkNormals(const std::vector<scapture::Frame>& frames);
+}
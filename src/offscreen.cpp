@@ -0,0 +1,157 @@
+#include <cstdio>
+#include <cstring>
+
+#if defined(WITH_EGL)
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#include "offscreen.h"
+
+namespace sgl {
+
+#if defined(WITH_EGL)
+
+	static bool HasExtension(const char* extensions, const char* name) {
+		size_t length = strlen(name);
+		for (const char* p = extensions; p && (p = strstr(p, name)) != nullptr; p += length) {
+			if ((p == extensions || p[-1] == ' ') && (p[length] == ' ' || p[length] == '\0')) return true;
+		}
+		return false;
+	}
+
+	bool OffscreenContext::create(int width, int height) {
+		release();
+
+		// the surfaceless platform of Mesa needs no display server at all; the default display may.
+		EGLDisplay egl_display = EGL_NO_DISPLAY;
+		const char* client_extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+		PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+		if (get_platform_display && HasExtension(client_extensions, "EGL_MESA_platform_surfaceless")) {
+			egl_display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+		}
+		EGLint major = 0, minor = 0;
+		if (egl_display == EGL_NO_DISPLAY || !eglInitialize(egl_display, &major, &minor)) {
+			egl_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+			if (egl_display == EGL_NO_DISPLAY || !eglInitialize(egl_display, &major, &minor)) {
+				fprintf(stderr, "EGL: failed to initialize a display (0x%04x).\n", eglGetError());
+				return false;
+			}
+		}
+		display = egl_display;
+		surfaceless = HasExtension(eglQueryString(egl_display, EGL_EXTENSIONS), "EGL_KHR_surfaceless_context");
+
+		if (!eglBindAPI(EGL_OPENGL_API)) {
+			fprintf(stderr, "EGL: desktop OpenGL is not supported (EGL %d.%d).\n", major, minor);
+			release();
+			return false;
+		}
+
+		// no surface type is asked for a surfaceless context (any config will do).
+		const EGLint config_attribs[] = {
+			EGL_SURFACE_TYPE, surfaceless ? 0 : EGL_PBUFFER_BIT,
+			EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+			EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8,
+			EGL_NONE
+		};
+		EGLConfig config;
+		EGLint config_count = 0;
+		if (!eglChooseConfig(egl_display, config_attribs, &config, 1, &config_count) || config_count == 0) {
+			fprintf(stderr, "EGL: no config for OpenGL.\n");
+			release();
+			return false;
+		}
+
+		const EGLint context_attribs[] = {
+			EGL_CONTEXT_MAJOR_VERSION_KHR, 4,
+			EGL_CONTEXT_MINOR_VERSION_KHR, 3,
+			EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR,
+			EGL_NONE
+		};
+		context = eglCreateContext(egl_display, config, EGL_NO_CONTEXT, context_attribs);
+		if (context == EGL_NO_CONTEXT) {
+			context = nullptr;
+			fprintf(stderr, "EGL: failed to create an OpenGL 4.3 core context (0x%04x).\n", eglGetError());
+			release();
+			return false;
+		}
+
+		// the pbuffer is only there to make the context current; everything is drawn into the framebuffer.
+		EGLSurface egl_surface = EGL_NO_SURFACE;
+		if (!surfaceless) {
+			const EGLint pbuffer_attribs[] = { EGL_WIDTH, 16, EGL_HEIGHT, 16, EGL_NONE };
+			egl_surface = eglCreatePbufferSurface(egl_display, config, pbuffer_attribs);
+			if (egl_surface == EGL_NO_SURFACE) {
+				fprintf(stderr, "EGL: failed to create a pbuffer (0x%04x).\n", eglGetError());
+				release();
+				return false;
+			}
+			surface = egl_surface;
+		}
+		if (!eglMakeCurrent(egl_display, egl_surface, egl_surface, (EGLContext)context)) {
+			fprintf(stderr, "EGL: failed to make the context current (0x%04x).\n", eglGetError());
+			release();
+			return false;
+		}
+
+		// glewInit() looks for a GLX display after the entry points are loaded, and fails without one.
+		glewExperimental = true;
+		if (glewContextInit() != GLEW_OK) {
+			fprintf(stderr, "GLEW: failed to initialize GLEW.\n");
+			release();
+			return false;
+		}
+		glGetError(); // GL_INVALID_ENUM from GLEW on core profiles
+
+		this->width = width;
+		this->height = height;
+		glGenRenderbuffers(1, &color_buffer);
+		glBindRenderbuffer(GL_RENDERBUFFER, color_buffer);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+		glGenRenderbuffers(1, &depth_buffer);
+		glBindRenderbuffer(GL_RENDERBUFFER, depth_buffer);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+		glGenFramebuffers(1, &framebuffer);
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color_buffer);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth_buffer);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+			fprintf(stderr, "OpenGL: the offscreen framebuffer is incomplete.\n");
+			release();
+			return false;
+		}
+
+		fprintf(stderr, "EGL: %s %s, %s (%s), %dx%d offscreen.\n", eglQueryString(egl_display, EGL_VENDOR), eglQueryString(egl_display, EGL_VERSION),
+			(const char*)glGetString(GL_RENDERER), surfaceless ? "surfaceless" : "pbuffer", width, height);
+		return true;
+	}
+
+	void OffscreenContext::release() {
+		if (context) {
+			if (framebuffer) glDeleteFramebuffers(1, &framebuffer);
+			if (color_buffer) glDeleteRenderbuffers(1, &color_buffer);
+			if (depth_buffer) glDeleteRenderbuffers(1, &depth_buffer);
+			eglMakeCurrent((EGLDisplay)display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+			eglDestroyContext((EGLDisplay)display, (EGLContext)context);
+		}
+		if (surface) eglDestroySurface((EGLDisplay)display, (EGLSurface)surface);
+		if (display) eglTerminate((EGLDisplay)display);
+		framebuffer = color_buffer = depth_buffer = 0;
+		display = context = surface = nullptr;
+		width = height = 0;
+	}
+
+#else
+
+	bool OffscreenContext::create(int width, int height) {
+		fprintf(stderr, "Offscreen: not built in (make OFFSCREEN=1, Linux only).\n");
+		return false;
+	}
+
+	void OffscreenContext::release() {
+	}
+
+#endif
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include "opengl_wrapper.h"
+
+namespace sgl {
+
+	/* an OpenGL 4.3 core context without a display or a window (EGL: surfaceless if the driver allows it, on a small
+	   pbuffer otherwise), drawing into a framebuffer of a fixed size, which stays bound as the one on screen would.
+	   (built with WITH_EGL, i.e. make OFFSCREEN=1; create() fails otherwise.) */
+	class OffscreenContext {
+	public:
+		~OffscreenContext() { release(); }
+
+		bool create(int width, int height); // makes the context current, and loads the entry points (GLEW)
+		void release();
+		bool active() const { return context != nullptr; }
+
+		GLuint framebuffer = 0;
+		int width = 0, height = 0;
+		bool surfaceless = false;
+
+	private:
+		void* display = nullptr;	// EGLDisplay, EGLContext, EGLSurface
+		void* context = nullptr;
+		void* surface = nullptr;
+		GLuint color_buffer = 0, depth_buffer = 0;
+	};
+}
@@ -1,14 +1,28 @@
 #include "opengl_wrapper.h"
+#include <cstdio>
+#include <cstdint>
+#include <vector>
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
 
 namespace sgl {
 
-	GLuint CreateShader(GLenum shader_type, const char* shader_source) {
+	// the compilation is only started; the status is asked (and waited for) by CheckShader.
+	static GLuint CompileShader(GLenum shader_type, const char* shader_source) {
 		GLuint shader = glCreateShader(shader_type);
 
 		int shader_source_length = (int)strlen(shader_source);
 		glShaderSource(shader, 1, &shader_source, &shader_source_length);
 		glCompileShader(shader);
+		return shader;
+	}
 
+	// returns 0 (and deletes the shader) if it failed to compile.
+	static GLuint CheckShader(GLenum shader_type, GLuint shader) {
 		int info_log_length = 0; glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &info_log_length);
 		if (info_log_length != 0) {
 			std::string info_log; info_log.resize(info_log_length);
@@ -22,14 +36,12 @@ namespace sgl {
 		return shader;
 	}
 
-	GLuint CreateProgram(GLuint vertex_shader, GLuint fragment_shader) {
-		if (vertex_shader == 0 || fragment_shader == 0) return 0;
-
-		GLuint program = glCreateProgram();
+	GLuint CreateShader(GLenum shader_type, const char* shader_source) {
+		return CheckShader(shader_type, CompileShader(shader_type, shader_source));
+	}
 
-		glAttachShader(program, vertex_shader);
-		glAttachShader(program, fragment_shader);
-		glLinkProgram(program);
+	// returns 0 (and deletes the program) if it failed to link or to validate.
+	static GLuint CheckProgram(GLuint program) {
 		{
 			int info_log_length = 0; glGetProgramiv(program, GL_INFO_LOG_LENGTH, &info_log_length);
 			if (info_log_length != 0) {
@@ -58,6 +70,97 @@ namespace sgl {
 		return program;
 	}
 
+	GLuint CreateProgram(GLuint vertex_shader, GLuint fragment_shader) {
+		if (vertex_shader == 0 || fragment_shader == 0) return 0;
+
+		GLuint program = glCreateProgram();
+
+		glAttachShader(program, vertex_shader);
+		glAttachShader(program, fragment_shader);
+		glLinkProgram(program);
+		return CheckProgram(program);
+	}
+
+	// program binary cache ***************************
+
+	static std::string program_cache;
+
+	void SetProgramCache(const char* dir) { program_cache = dir ? dir : ""; }
+
+	// FNV-1a, with a separator after each string.
+	static uint64_t Hash(uint64_t hash, const char* s) {
+		for (; s && *s; s++) { hash ^= uint8_t(*s); hash *= 1099511628211ull; }
+		hash ^= 0xff; hash *= 1099511628211ull;
+		return hash;
+	}
+
+	static std::string CachePath(const char* vs_src, const char* fs_src) {
+		if (program_cache.empty() || !(GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary)) return "";
+		GLint formats = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		if (formats == 0) return "";
+
+		uint64_t hash = 14695981039346656037ull;
+		hash = Hash(hash, vs_src);
+		hash = Hash(hash, fs_src);
+		for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION }) hash = Hash(hash, reinterpret_cast<const char*>(glGetString(name)));
+
+		char file_name[32];
+		snprintf(file_name, sizeof(file_name), "%016llx.bin", static_cast<unsigned long long>(hash));
+		return program_cache + "/" + file_name;
+	}
+
+	// the binary format (uint32_t) and the binary. returns 0 if there is none or the driver refuses it (e.g. after an update).
+	static GLuint LoadProgramBinary(const std::string& path) {
+		FILE* file = path.empty() ? nullptr : fopen(path.c_str(), "rb");
+		if (file == nullptr) return 0;
+
+		uint32_t format = 0;
+		std::vector<char> binary;
+		bool read = fread(&format, sizeof(format), 1, file) == 1 && fseek(file, 0, SEEK_END) == 0;
+		long size = read ? ftell(file) - long(sizeof(format)) : 0;
+		if (size > 0 && fseek(file, long(sizeof(format)), SEEK_SET) == 0) {
+			binary.resize(size);
+			read = fread(binary.data(), size, 1, file) == 1;
+		}
+		fclose(file);
+		if (!read || binary.empty()) return 0;
+
+		GLuint program = glCreateProgram();
+		glProgramBinary(program, format, binary.data(), GLsizei(binary.size()));
+		GLint program_link_status; glGetProgramiv(program, GL_LINK_STATUS, &program_link_status);
+		if (program_link_status == GL_FALSE) {
+			glDeleteProgram(program);
+			remove(path.c_str());
+			return 0;
+		}
+		return program;
+	}
+
+	// written into a temporary file first, so that a crash never leaves a partial binary behind.
+	static void SaveProgramBinary(GLuint program, const std::string& path) {
+		GLint length = 0;
+		glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (length <= 0) return;
+
+		std::vector<char> binary(length);
+		GLenum format = 0;
+		glGetProgramBinary(program, length, nullptr, &format, binary.data());
+
+#if defined(_WIN32) || defined(_WIN64)
+		_mkdir(program_cache.c_str());
+#else
+		mkdir(program_cache.c_str(), 0755);
+#endif
+		std::string temporary = path + ".tmp";
+		FILE* file = fopen(temporary.c_str(), "wb");
+		if (file == nullptr) return;
+		uint32_t format32 = format;
+		bool written = fwrite(&format32, sizeof(format32), 1, file) == 1 && fwrite(binary.data(), binary.size(), 1, file) == 1;
+		written = fclose(file) == 0 && written;
+		if (!written || rename(temporary.c_str(), path.c_str()) != 0) remove(temporary.c_str());
+	}
+
 	void CheckShaderProgram(GLuint program) {
 		int info_log_length = 0; glGetProgramiv(program, GL_INFO_LOG_LENGTH, &info_log_length);
 		if (!info_log_length) {
@@ -68,15 +171,55 @@ namespace sgl {
 	}
 
 	void Program::Init(const char* vs_src, const char* fs_src) {
-		VS_ID = CreateShader(GL_VERTEX_SHADER, vs_src);
-		FS_ID = CreateShader(GL_FRAGMENT_SHADER, fs_src);
+		Begin(vs_src, fs_src);
+		End();
+	}
+
+	void Program::Begin(const char* vs_src, const char* fs_src) {
+		static bool parallel = false;
+		if (!parallel) {
+			parallel = true;
+#if defined(GL_KHR_parallel_shader_compile)
+			if (GLEW_KHR_parallel_shader_compile) glMaxShaderCompilerThreadsKHR(0xFFFFFFFFu); // as many as the driver likes
+#endif
+		}
+
+		VS_ID = FS_ID = 0;
+		cache_path = CachePath(vs_src, fs_src);
+		cached = (ID = LoadProgramBinary(cache_path)) != 0;
+		if (cached) return;
+
+		VS_ID = CompileShader(GL_VERTEX_SHADER, vs_src);
+		FS_ID = CompileShader(GL_FRAGMENT_SHADER, fs_src);
+		ID = glCreateProgram();
+		glAttachShader(ID, VS_ID);
+		glAttachShader(ID, FS_ID);
+		if (!cache_path.empty()) glProgramParameteri(ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		glLinkProgram(ID);
+	}
+
+	bool Program::End() {
+		if (cached) {
+			glUseProgram(ID);
+			return true;
+		}
 
-		ID = CreateProgram(VS_ID, FS_ID);
+		VS_ID = CheckShader(GL_VERTEX_SHADER, VS_ID);
+		FS_ID = CheckShader(GL_FRAGMENT_SHADER, FS_ID);
+		if (VS_ID == 0 || FS_ID == 0) {
+			glDeleteProgram(ID);
+			ID = 0;
+			return false;
+		}
+
+		ID = CheckProgram(ID);
+		if (ID != 0 && !cache_path.empty()) SaveProgramBinary(ID, cache_path);
+		return false;
 	}
 
 	void Program::Release() {
-		glDetachShader(ID, VS_ID); glDeleteShader(VS_ID);
-		glDetachShader(ID, FS_ID); glDeleteShader(FS_ID);
+		if (VS_ID) { glDetachShader(ID, VS_ID); glDeleteShader(VS_ID); }
+		if (FS_ID) { glDetachShader(ID, FS_ID); glDeleteShader(FS_ID); }
 		glDeleteProgram(ID);
 	}
 
@@ -200,6 +343,15 @@ namespace sgl {
 	}
 
 
+	void Query::Init(GLenum target) { glGenQueries(1, &ID); this->target = target; }
+	void Query::Release() { glDeleteQueries(1, &ID); }
+
+	void Query::Begin() { glBeginQuery(target, ID); }
+	void Query::End() { glEndQuery(target); }
+	bool Query::Available() { GLint available = 0; glGetQueryObjectiv(ID, GL_QUERY_RESULT_AVAILABLE, &available); return available != 0; }
+	GLuint64 Query::Result() { GLuint64 result = 0; glGetQueryObjectui64v(ID, GL_QUERY_RESULT, &result); return result; }
+
+
 	void VertexArray::Init() { glGenVertexArrays(1, &ID); }
 	void VertexArray::Release() { glDeleteVertexArrays(1, &ID); }
 
@@ -236,6 +388,15 @@ namespace sgl {
 		if (binding != ID) glBindVertexArray(binding);
 	}
 
+	void VertexArray::AttribDivisor(GLuint index, GLuint divisor) {
+		GLuint binding = Binding();
+		if (binding != ID) glBindVertexArray(ID);
+
+		glVertexAttribDivisor(index, divisor);
+
+		if (binding != ID) glBindVertexArray(binding);
+	}
+
 	void DrawArrays::operator()() {
 		glDrawArrays(mode, first, count);
 	}
@@ -244,4 +405,12 @@ namespace sgl {
 		glDrawElementsBaseVertex(mode, count, type, indices, basevertex);
 	}
 
+	void DrawArraysInstancedBaseInstance::operator()() {
+		glDrawArraysInstancedBaseInstance(mode, first, count, instancecount, baseinstance);
+	}
+
+	void DrawElementsInstancedBaseVertexBaseInstance::operator()() {
+		glDrawElementsInstancedBaseVertexBaseInstance(mode, count, type, indices, instancecount, basevertex, baseinstance);
+	}
+
 }
\ No newline at end of file
@@ -1,5 +1,6 @@
 #pragma once
 #include <map>
+#include <string>
 #include "smath.h"
 #include "3rdparty\glew-2.1.0\include\GL\glew.h"
 
@@ -8,12 +9,23 @@ namespace sgl {
 	GLuint CreateProgram(GLuint vertex_shader, GLuint fragment_shader);
 	void CheckShaderProgram(GLuint program);
 
+	// program binaries are cached in dir (nullptr: not cached), keyed by a hash of the sources and of the driver (vendor, renderer and version).
+	void SetProgramCache(const char* dir);
+
 	struct Program {
 		GLuint ID;
-		GLuint VS_ID;
+		GLuint VS_ID;	// 0 if loaded from the cache
 		GLuint FS_ID;
+		std::string cache_path;
+		bool cached = false;
 
 		void Init(const char* vs_src, const char* fs_src);
+
+		// Begin loads the cached binary, or starts compiling and linking without waiting, so that the driver
+		// may compile several programs in parallel (GL_KHR_parallel_shader_compile) until their End.
+		// End returns whether the program came from the cache.
+		void Begin(const char* vs_src, const char* fs_src);
+		bool End();
 		void Release();
 
 		void Use(bool use = true);
@@ -71,6 +83,19 @@ namespace sgl {
 		void Data(size_t count, size_t size, GLvoid* data, GLenum usage);
 	};
 
+	struct Query {
+		GLuint ID;
+		GLenum target;
+
+		void Init(GLenum target);
+		void Release();
+
+		void Begin();
+		void End();
+		bool Available();
+		GLuint64 Result();
+	};
+
 	struct VertexArray {
 		GLuint ID;
 
@@ -83,6 +108,7 @@ namespace sgl {
 		void AttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const GLvoid* pointer);
 		void AttribIPointer(GLuint index, GLint size, GLenum type, GLsizei stride, const GLvoid* pointer);
 		void AttribLPointer(GLuint index, GLint size, GLenum type, GLsizei stride, const GLvoid* pointer);
+		void AttribDivisor(GLuint index, GLuint divisor);
 	};
 
 	struct DrawArrays {
@@ -109,4 +135,32 @@ namespace sgl {
 		void operator()();
 	};
 
+	struct DrawArraysInstancedBaseInstance {
+		GLenum mode;
+		GLint first;
+		GLsizei count;
+		GLsizei instancecount;
+		GLuint baseinstance;
+
+		DrawArraysInstancedBaseInstance() : mode(GL_POINTS), first(), count(), instancecount(), baseinstance() {}
+		DrawArraysInstancedBaseInstance(GLenum mode, GLint first, GLsizei count) : mode(mode), first(first), count(count), instancecount(), baseinstance() {}
+
+		void operator()();
+	};
+
+	struct DrawElementsInstancedBaseVertexBaseInstance {
+		GLenum mode;
+		GLsizei count;
+		GLenum type;
+		GLvoid* indices;
+		GLsizei instancecount;
+		GLint basevertex;
+		GLuint baseinstance;
+
+		DrawElementsInstancedBaseVertexBaseInstance() : mode(GL_POINTS), count(), type(GL_UNSIGNED_INT), indices(), instancecount(), basevertex(), baseinstance() {}
+		DrawElementsInstancedBaseVertexBaseInstance(GLenum mode, GLsizei count, GLenum type, GLvoid* indices, GLint basevertex) : mode(mode), count(count), type(type), indices(indices), instancecount(), basevertex(basevertex), baseinstance() {}
+
+		void operator()();
+	};
+
 }
\ No newline at end of file
@@ -0,0 +1,138 @@
+#include "ply_writer.h"
+#include <cstring>
+
+namespace sply {
+
+	void PlyWriter::start() {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (running) return;
+		running = true;
+		thread = std::thread([this]() { write_loop(); });
+	}
+
+	void PlyWriter::stop() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!running) return;
+			running = false;
+		}
+		changed.notify_all();
+		thread.join();
+	}
+
+	bool PlyWriter::submit(const std::string& path, const rs::float3* points, const ubyte3* colors, size_t count) {
+		Buffer* buffer = nullptr;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			for (Buffer& b : buffers) if (b.state == State::FREE) { buffer = &b; break; }
+			if (buffer == nullptr) {
+				current.dropped++;
+				return false;
+			}
+			buffer->state = State::FILLING;
+		}
+
+		buffer->path = path;
+		buffer->points.assign(points, points + count);
+		if (colors) buffer->colors.assign(colors, colors + count);
+		else buffer->colors.clear();
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			buffer->state = State::QUEUED;
+			queue.push_back(buffer);
+		}
+		changed.notify_all();
+		return true;
+	}
+
+	void PlyWriter::wait() {
+		std::unique_lock<std::mutex> lock(mutex);
+		changed.wait(lock, [this]() -> bool {
+			return !running || (queue.empty() && buffers[0].state != State::WRITING && buffers[1].state != State::WRITING);
+		});
+	}
+
+	PlyWriter::Stats PlyWriter::stats() {
+		std::lock_guard<std::mutex> lock(mutex);
+		return current;
+	}
+
+	void PlyWriter::reset_stats() {
+		std::lock_guard<std::mutex> lock(mutex);
+		current = Stats();
+	}
+
+	void PlyWriter::write_loop() {
+		while (true) {
+			Buffer* buffer;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				changed.wait(lock, [this]() { return !running || !queue.empty(); });
+				if (queue.empty()) break; // stopped, with nothing left to write
+				buffer = queue.front();
+				queue.pop_front();
+				buffer->state = State::WRITING;
+			}
+
+			double t0 = scapture::Now();
+			double bytes = 0.0;
+			bool written = write(*buffer, bytes);
+			double t1 = scapture::Now();
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				buffer->state = State::FREE;
+				if (written) {
+					current.files++;
+					current.bytes += bytes;
+					current.seconds += (t1 - t0) / 1000.0;
+				}
+			}
+			changed.notify_all();
+		}
+	}
+
+	// the vertices are interleaved in chunks, so that the file is written with a few large fwrite calls.
+	// (x86 and ARM are little-endian, so the floats are written as they are.)
+	bool PlyWriter::write(const Buffer& buffer, double& bytes) {
+		FILE* file = fopen(buffer.path.c_str(), "wb");
+		if (file == nullptr) {
+			fprintf(stderr, "PLY: failed to open %s.\n", buffer.path.c_str());
+			return false;
+		}
+
+		bool has_colors = !buffer.colors.empty();
+		size_t count = buffer.points.size();
+		std::string header = "ply\nformat binary_little_endian 1.0\nelement vertex " + std::to_string(count) + "\n"
+			"property float x\nproperty float y\nproperty float z\n";
+		if (has_colors) header += "property uchar red\nproperty uchar green\nproperty uchar blue\n";
+		header += "end_header\n";
+
+		bool ok = fwrite(header.data(), 1, header.size(), file) == header.size();
+		bytes = double(header.size());
+
+		static const size_t CHUNK_VERTICES = 65536;
+		const size_t stride = sizeof(rs::float3) + (has_colors ? sizeof(ubyte3) : 0);
+		chunk.resize(CHUNK_VERTICES*stride);
+
+		for (size_t first = 0; ok && first < count; first += CHUNK_VERTICES) {
+			size_t n = min(CHUNK_VERTICES, count - first);
+			unsigned char* ptr = chunk.data();
+			if (has_colors) {
+				for (size_t k = first; k < first + n; k++) {
+					memcpy(ptr, &buffer.points[k], sizeof(rs::float3));
+					memcpy(ptr + sizeof(rs::float3), &buffer.colors[k], sizeof(ubyte3));
+					ptr += stride;
+				}
+				ok = fwrite(chunk.data(), stride, n, file) == n;
+			}
+			else ok = fwrite(&buffer.points[first], sizeof(rs::float3), n, file) == n;
+			bytes += double(n*stride);
+		}
+
+		ok = fclose(file) == 0 && ok;
+		if (!ok) fprintf(stderr, "PLY: failed to write %s.\n", buffer.path.c_str());
+		return ok;
+	}
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "capture.h"
+
+namespace sply {
+
+	// writes point clouds into binary little-endian PLY files on a background thread.
+	// a snapshot is copied into one of two buffers, so the caller never waits for the disk:
+	// while one buffer is being written, the other one takes the next snapshot.
+	class PlyWriter {
+	public:
+		struct Stats {
+			int files = 0;
+			int dropped = 0;			// snapshots given up because both buffers were busy
+			double bytes = 0.0;
+			double seconds = 0.0;		// spent in writing
+			double mb_per_second() const { return seconds > 0 ? bytes / (1024.0*1024.0) / seconds : 0.0; }
+		};
+
+		~PlyWriter() { stop(); }
+
+		void start();
+		void stop(); // after writing the queued snapshots
+
+		// colors may be nullptr. returns false if the snapshot was dropped.
+		bool submit(const std::string& path, const rs::float3* points, const ubyte3* colors, size_t count);
+
+		void wait(); // until every queued snapshot is written
+		Stats stats();
+		void reset_stats();
+
+	private:
+		enum class State { FREE, FILLING, QUEUED, WRITING };
+		struct Buffer {
+			State state = State::FREE;
+			std::string path;
+			std::vector<rs::float3> points;
+			std::vector<ubyte3> colors;
+		};
+
+		Buffer buffers[2];
+		std::deque<Buffer*> queue;
+		std::vector<unsigned char> chunk; // interleaved vertices being written
+
+		std::thread thread;
+		std::mutex mutex;
+		std::condition_variable changed;
+		bool running = false;
+		Stats current;
+
+		void write_loop();
+		bool write(const Buffer& buffer, double& bytes);
+	};
+}
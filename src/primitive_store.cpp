@@ -0,0 +1,617 @@
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <cfloat>
+#include <chrono>
+#include <queue>
+#include <random>
+#include <algorithm>
+
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "primitive_store.h"
+#include "smath.h"
+
+namespace sdb {
+
+	static const char MAGIC[8] = "FSPRIM1";
+	static const uint32_t MAX_ENTRIES = 32, MIN_ENTRIES = 12; // of a node
+	static const uint32_t NONE = 0xffffffff;
+	static const float PAD = 0.01f; // added to each side of the boxes measured, so that flat ones (planes) still compare
+
+	struct PrimitiveStore::Header {
+		char magic[8];
+		uint32_t count, record_capacity;
+		uint32_t node_count, node_capacity;
+		uint32_t root;
+		uint32_t dirty;			// the tree is being changed: rebuilt if the store is opened so
+		uint8_t reserved[32];
+	};
+
+	struct PrimitiveStore::Entry {
+		float box_min[3], box_max[3];
+		uint32_t child;			// a node, or a record in the leaves
+	};
+
+	struct PrimitiveStore::Node {
+		uint32_t level;			// 0: a leaf
+		uint32_t count;
+		Entry entries[MAX_ENTRIES];
+	};
+
+	static_assert(sizeof(Record) == 96, "the record layout has changed");
+
+	// boxes ***************************
+
+	static inline float Measure(const float* lo, const float* hi) {
+		return (hi[0] - lo[0] + PAD)*(hi[1] - lo[1] + PAD)*(hi[2] - lo[2] + PAD);
+	}
+
+	static inline float Enlarged(const float* lo, const float* hi, const float* add_lo, const float* add_hi) {
+		float l[3], h[3];
+		for (int i = 0; i < 3; i++) { l[i] = min(lo[i], add_lo[i]); h[i] = max(hi[i], add_hi[i]); }
+		return Measure(l, h);
+	}
+
+	static inline void Extend(float* lo, float* hi, const float* add_lo, const float* add_hi) {
+		for (int i = 0; i < 3; i++) { lo[i] = min(lo[i], add_lo[i]); hi[i] = max(hi[i], add_hi[i]); }
+	}
+
+	static inline bool Overlap(const float* lo, const float* hi, const float* other_lo, const float* other_hi) {
+		return lo[0] <= other_hi[0] && other_lo[0] <= hi[0] && lo[1] <= other_hi[1] && other_lo[1] <= hi[1] && lo[2] <= other_hi[2] && other_lo[2] <= hi[2];
+	}
+
+	static inline float Distance2(const float* lo, const float* hi, const float* p) {
+		float d2 = 0.f;
+		for (int i = 0; i < 3; i++) {
+			float d = max(max(lo[i] - p[i], p[i] - hi[i]), 0.f);
+			d2 += d*d;
+		}
+		return d2;
+	}
+
+	// file ***************************
+
+	uint32_t PrimitiveStore::size() const { return file ? header()->count : 0; }
+
+	int PrimitiveStore::height() const { return file ? int(node(header()->root)->level) + 1 : 0; }
+
+	const Record& PrimitiveStore::operator[](uint32_t id) const { return records()[id]; }
+
+	Record* PrimitiveStore::records() const { return reinterpret_cast<Record*>(file + sizeof(Header)); }
+
+	PrimitiveStore::Node* PrimitiveStore::node(uint32_t index) const {
+		return reinterpret_cast<Node*>(file + sizeof(Header) + size_t(header()->record_capacity)*sizeof(Record)) + index;
+	}
+
+	size_t PrimitiveStore::file_size(uint32_t record_capacity, uint32_t node_capacity) {
+		return sizeof(Header) + size_t(record_capacity)*sizeof(Record) + size_t(node_capacity)*sizeof(Node);
+	}
+
+#if !defined(_WIN32) && !defined(_WIN64)
+
+	bool PrimitiveStore::open(const char* path) {
+		close();
+
+		fd = ::open(path, O_RDWR | O_CREAT, 0644);
+		struct stat st;
+		if (fd < 0 || fstat(fd, &st) < 0) {
+			fprintf(stderr, "Store: failed to open %s.\n", path);
+			close();
+			return false;
+		}
+		this->path = path;
+
+		if (st.st_size == 0) {
+			const uint32_t RECORDS = 1024, NODES = 64;
+			if (ftruncate(fd, off_t(file_size(RECORDS, NODES))) < 0 || !resize(RECORDS, NODES)) {
+				fprintf(stderr, "Store: failed to create %s.\n", path);
+				close();
+				return false;
+			}
+			Header* h = header();
+			memcpy(h->magic, MAGIC, sizeof(MAGIC));
+			h->count = 0;
+			h->record_capacity = RECORDS;
+			h->node_count = 0;
+			h->node_capacity = NODES;
+			h->root = allocate_node(0);
+			h->dirty = 0;
+		}
+		else {
+			Header h;
+			if (size_t(st.st_size) < sizeof(Header) || pread(fd, &h, sizeof(h), 0) != ssize_t(sizeof(h)) || memcmp(h.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+				size_t(st.st_size) != file_size(h.record_capacity, h.node_capacity) || h.count > h.record_capacity) {
+				fprintf(stderr, "Store: %s is not a store of primitives.\n", path);
+				close();
+				return false;
+			}
+			file = static_cast<uint8_t*>(mmap(nullptr, size_t(st.st_size), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+			if (file == MAP_FAILED) {
+				file = nullptr;
+				fprintf(stderr, "Store: failed to map %s.\n", path);
+				close();
+				return false;
+			}
+			mapped = size_t(st.st_size);
+			if (header()->dirty) {
+				fprintf(stderr, "Store: %s was not closed; rebuilding its index.\n", path);
+				rebuild();
+				flush();
+			}
+		}
+
+		fprintf(stderr, "Store: %u primitives in %s.\n", header()->count, path);
+		return true;
+	}
+
+	void PrimitiveStore::close() {
+		if (file) {
+			flush();
+			munmap(file, mapped);
+			file = nullptr;
+			mapped = 0;
+		}
+		if (fd >= 0) ::close(fd);
+		fd = -1;
+	}
+
+	void PrimitiveStore::flush() {
+		if (!file) return;
+		msync(file, mapped, MS_SYNC);
+		if (!header()->dirty) return;
+		header()->dirty = 0; // only once the tree is on the disk
+		msync(file, sizeof(Header), MS_SYNC);
+	}
+
+	// (the file has been mapped with the current capacities, unless it is empty.)
+	bool PrimitiveStore::resize(uint32_t record_capacity, uint32_t node_capacity) {
+		size_t size = file_size(record_capacity, node_capacity);
+		if (file) {
+			if (ftruncate(fd, off_t(size)) < 0) return false;
+			munmap(file, mapped);
+		}
+		void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (ptr == MAP_FAILED) {
+			file = nullptr;
+			return false;
+		}
+		file = static_cast<uint8_t*>(ptr);
+		mapped = size;
+
+		// the nodes follow the records: moved up when these grow.
+		Header* h = header();
+		if (h->record_capacity != 0 && record_capacity != h->record_capacity) {
+			const uint8_t* from = reinterpret_cast<const uint8_t*>(node(0));
+			h->record_capacity = record_capacity;
+			memmove(node(0), from, size_t(h->node_count)*sizeof(Node));
+		}
+		h->record_capacity = record_capacity;
+		h->node_capacity = node_capacity;
+		return true;
+	}
+
+#else
+
+	bool PrimitiveStore::open(const char* path) {
+		fprintf(stderr, "Store: memory-mapped files are not supported on this platform.\n");
+		return false;
+	}
+
+	void PrimitiveStore::close() {}
+	void PrimitiveStore::flush() {}
+	bool PrimitiveStore::resize(uint32_t record_capacity, uint32_t node_capacity) { return false; }
+
+#endif
+
+	void PrimitiveStore::mark_dirty() {
+		if (header()->dirty) return;
+		header()->dirty = 1;
+	}
+
+	uint32_t PrimitiveStore::allocate_node(uint32_t level) {
+		Header* h = header();
+		if (h->node_count == h->node_capacity && !resize(h->record_capacity, h->node_capacity * 2)) return NONE;
+		uint32_t index = header()->node_count++;
+		Node* n = node(index);
+		n->level = level;
+		n->count = 0;
+		return index;
+	}
+
+	// records ***************************
+
+	uint32_t PrimitiveStore::append(const FS_FEATURE_RESULT& result, uint32_t inlier_count, double timestamp) {
+		return append(MakeRecord(result, inlier_count, timestamp));
+	}
+
+	// the record is written and indexed before it is counted: a crash in between leaves it out.
+	uint32_t PrimitiveStore::append(const Record& record) {
+		if (!file) return NONE;
+		mark_dirty();
+		Header* h = header();
+		if (h->count == h->record_capacity && !resize(h->record_capacity * 2, h->node_capacity)) {
+			fprintf(stderr, "Store: failed to grow %s.\n", path.c_str());
+			return NONE;
+		}
+		uint32_t id = header()->count;
+		records()[id] = record;
+		insert(id, record.box_min, record.box_max);
+		header()->count = id + 1;
+		return id;
+	}
+
+	Record PrimitiveStore::MakeRecord(const FS_FEATURE_RESULT& result, uint32_t inlier_count, double timestamp) {
+		using namespace smath;
+		Record record = {};
+		record.type = uint32_t(result.type);
+		record.inlier_count = inlier_count;
+		record.timestamp = timestamp;
+		record.rms = result.rms;
+		memcpy(record.params, &result.plane_param, sizeof(record.params)); // the largest member of the union
+
+		// a disc of radius r across axis reaches r*sqrt(1 - axis[i]^2) along each axis i.
+		float3 lo = {}, hi = {};
+		auto disc = [&](const float* c, float3 axis, float r, bool first) {
+			for (int i = 0; i < 3; i++) {
+				float extent = r*sqrtf(max(1.f - axis[i] * axis[i], 0.f));
+				lo[i] = first ? c[i] - extent : min(lo[i], c[i] - extent);
+				hi[i] = first ? c[i] + extent : max(hi[i], c[i] + extent);
+			}
+		};
+		switch (result.type) {
+		case FS_FEATURE_TYPE::FS_TYPE_PLANE: {
+			const float* corners[4] = { result.plane_param.ll, result.plane_param.lr, result.plane_param.ur, result.plane_param.ul };
+			lo = hi = ToFloat3((float*)corners[0]);
+			for (int k = 1; k < 4; k++) {
+				for (int i = 0; i < 3; i++) { lo[i] = min(lo[i], corners[k][i]); hi[i] = max(hi[i], corners[k][i]); }
+			}
+			break;
+		}
+		case FS_FEATURE_TYPE::FS_TYPE_SPHERE:
+			disc(result.sphere_param.c, float3{ 0, 0, 0 }, result.sphere_param.r, true);
+			break;
+		case FS_FEATURE_TYPE::FS_TYPE_CYLINDER: {
+			float3 axis = Normalize(ToFloat3((float*)result.cylinder_param.t) - ToFloat3((float*)result.cylinder_param.b));
+			disc(result.cylinder_param.b, axis, result.cylinder_param.r, true);
+			disc(result.cylinder_param.t, axis, result.cylinder_param.r, false);
+			break;
+		}
+		case FS_FEATURE_TYPE::FS_TYPE_CONE: {
+			float3 axis = Normalize(ToFloat3((float*)result.cone_param.t) - ToFloat3((float*)result.cone_param.b));
+			disc(result.cone_param.b, axis, result.cone_param.br, true);
+			disc(result.cone_param.t, axis, result.cone_param.tr, false);
+			break;
+		}
+		case FS_FEATURE_TYPE::FS_TYPE_TORUS: {
+			// the whole ring (the extent of the elbow is not known here): its mean circle, grown by the tube.
+			float3 axis = Normalize(ToFloat3((float*)result.torus_param.n));
+			disc(result.torus_param.c, axis, result.torus_param.mr, true);
+			for (int i = 0; i < 3; i++) { lo[i] -= result.torus_param.tr; hi[i] += result.torus_param.tr; }
+			break;
+		}
+		default: break;
+		}
+		for (int i = 0; i < 3; i++) {
+			record.box_min[i] = lo[i];
+			record.box_max[i] = hi[i];
+		}
+		return record;
+	}
+
+	// R-tree ***************************
+
+	// down to the leaf whose box grows the least (the smallest one of those), growing the boxes on the way,
+	// then back up as long as the nodes split.
+	void PrimitiveStore::insert(uint32_t id, const float box_min[3], const float box_max[3]) {
+		Entry entry;
+		memcpy(entry.box_min, box_min, sizeof(entry.box_min));
+		memcpy(entry.box_max, box_max, sizeof(entry.box_max));
+		entry.child = id;
+
+		uint32_t path[32], slots[32];
+		int depth = 0;
+		uint32_t index = header()->root;
+		while (node(index)->level > 0) {
+			Node* n = node(index);
+			uint32_t best = 0;
+			float best_growth = FLT_MAX, best_measure = FLT_MAX;
+			for (uint32_t k = 0; k < n->count; k++) {
+				const Entry& e = n->entries[k];
+				float measure = Measure(e.box_min, e.box_max);
+				float growth = Enlarged(e.box_min, e.box_max, box_min, box_max) - measure;
+				if (growth < best_growth || (growth == best_growth && measure < best_measure)) {
+					best = k;
+					best_growth = growth;
+					best_measure = measure;
+				}
+			}
+			Extend(n->entries[best].box_min, n->entries[best].box_max, box_min, box_max);
+			path[depth] = index;
+			slots[depth] = best;
+			depth++;
+			index = n->entries[best].child;
+		}
+
+		while (true) {
+			Node* n = node(index);
+			if (n->count < MAX_ENTRIES) {
+				n->entries[n->count++] = entry;
+				return;
+			}
+			uint32_t sibling = split(index, entry);
+			if (sibling == NONE) return;
+
+			// the boxes of both halves, for their parent.
+			Entry halves[2];
+			uint32_t children[2] = { index, sibling };
+			for (int h = 0; h < 2; h++) {
+				const Node* half = node(children[h]);
+				halves[h] = half->entries[0];
+				for (uint32_t k = 1; k < half->count; k++) Extend(halves[h].box_min, halves[h].box_max, half->entries[k].box_min, half->entries[k].box_max);
+				halves[h].child = children[h];
+			}
+
+			if (depth == 0) { // the root split: a new one above
+				uint32_t root = allocate_node(node(index)->level + 1);
+				if (root == NONE) return;
+				Node* r = node(root);
+				r->entries[0] = halves[0];
+				r->entries[1] = halves[1];
+				r->count = 2;
+				header()->root = root;
+				return;
+			}
+			depth--;
+			node(path[depth])->entries[slots[depth]] = halves[0];
+			entry = halves[1];
+			index = path[depth];
+		}
+	}
+
+	// quadratic split: the two entries which would waste the most in one box start the two groups,
+	// then the entry with the strongest preference goes next, to the group it enlarges the least.
+	uint32_t PrimitiveStore::split(uint32_t index, const Entry& extra) {
+		uint32_t sibling = allocate_node(node(index)->level);
+		if (sibling == NONE) return NONE;
+
+		const uint32_t N = MAX_ENTRIES + 1;
+		Entry all[N];
+		memcpy(all, node(index)->entries, sizeof(Entry)*MAX_ENTRIES);
+		all[MAX_ENTRIES] = extra;
+
+		uint32_t seed_a = 0, seed_b = 1;
+		float worst = -FLT_MAX;
+		for (uint32_t i = 0; i < N; i++) {
+			for (uint32_t j = i + 1; j < N; j++) {
+				float waste = Enlarged(all[i].box_min, all[i].box_max, all[j].box_min, all[j].box_max) - Measure(all[i].box_min, all[i].box_max) - Measure(all[j].box_min, all[j].box_max);
+				if (waste > worst) { worst = waste; seed_a = i; seed_b = j; }
+			}
+		}
+
+		Node* a = node(index);
+		Node* b = node(sibling);
+		a->count = b->count = 0;
+		Entry box[2] = { all[seed_a], all[seed_b] };
+		a->entries[a->count++] = all[seed_a];
+		b->entries[b->count++] = all[seed_b];
+		bool assigned[N] = {};
+		assigned[seed_a] = assigned[seed_b] = true;
+
+		for (uint32_t left = N - 2; left > 0; left--) {
+			// a group that needs every entry left to reach the minimum takes them.
+			Node* short_group = a->count + left == MIN_ENTRIES ? a : b->count + left == MIN_ENTRIES ? b : nullptr;
+			if (short_group) {
+				int g = short_group == a ? 0 : 1;
+				for (uint32_t k = 0; k < N; k++) {
+					if (assigned[k]) continue;
+					short_group->entries[short_group->count++] = all[k];
+					Extend(box[g].box_min, box[g].box_max, all[k].box_min, all[k].box_max);
+				}
+				break;
+			}
+
+			uint32_t next = 0;
+			float preference = -1.f, growth[2] = {};
+			for (uint32_t k = 0; k < N; k++) {
+				if (assigned[k]) continue;
+				float g0 = Enlarged(box[0].box_min, box[0].box_max, all[k].box_min, all[k].box_max) - Measure(box[0].box_min, box[0].box_max);
+				float g1 = Enlarged(box[1].box_min, box[1].box_max, all[k].box_min, all[k].box_max) - Measure(box[1].box_min, box[1].box_max);
+				if (fabsf(g0 - g1) > preference) { preference = fabsf(g0 - g1); next = k; growth[0] = g0; growth[1] = g1; }
+			}
+			int g;
+			if (growth[0] != growth[1]) g = growth[0] < growth[1] ? 0 : 1;
+			else {
+				float m0 = Measure(box[0].box_min, box[0].box_max), m1 = Measure(box[1].box_min, box[1].box_max);
+				g = m0 != m1 ? (m0 < m1 ? 0 : 1) : (a->count <= b->count ? 0 : 1);
+			}
+			Node* group = g == 0 ? a : b;
+			group->entries[group->count++] = all[next];
+			Extend(box[g].box_min, box[g].box_max, all[next].box_min, all[next].box_max);
+			assigned[next] = true;
+		}
+		return sibling;
+	}
+
+	void PrimitiveStore::rebuild() {
+		mark_dirty();
+		Header* h = header();
+		h->node_count = 0;
+		h->root = allocate_node(0);
+		for (uint32_t id = 0; id < header()->count; id++) {
+			Record record = records()[id]; // (the mapping moves when the nodes grow)
+			insert(id, record.box_min, record.box_max);
+		}
+	}
+
+	// queries ***************************
+
+	void PrimitiveStore::intersect(const float box_min[3], const float box_max[3], std::vector<uint32_t>& ids) const {
+		ids.clear();
+		if (!file || header()->count == 0) return;
+		std::vector<uint32_t> stack(1, header()->root);
+		while (!stack.empty()) {
+			const Node* n = node(stack.back());
+			stack.pop_back();
+			for (uint32_t k = 0; k < n->count; k++) {
+				const Entry& e = n->entries[k];
+				if (!Overlap(e.box_min, e.box_max, box_min, box_max)) continue;
+				if (n->level == 0) ids.push_back(e.child);
+				else stack.push_back(e.child);
+			}
+		}
+	}
+
+	// best first: the nodes and the records in the order of the distance to their boxes, so the first record is the nearest.
+	int64_t PrimitiveStore::nearest(const float p[3], float* distance) const {
+		if (!file || header()->count == 0) return -1;
+		typedef std::pair<float, uint64_t> Item; // squared distance, and a node or (1 << 32 | a record)
+		std::priority_queue<Item, std::vector<Item>, std::greater<Item>> queue;
+		queue.push(Item(0.f, header()->root));
+		while (!queue.empty()) {
+			Item item = queue.top();
+			queue.pop();
+			if (item.second >> 32) {
+				if (distance) *distance = sqrtf(item.first);
+				return int64_t(item.second & NONE);
+			}
+			const Node* n = node(uint32_t(item.second));
+			uint64_t tag = n->level == 0 ? uint64_t(1) << 32 : 0;
+			for (uint32_t k = 0; k < n->count; k++) {
+				const Entry& e = n->entries[k];
+				queue.push(Item(Distance2(e.box_min, e.box_max, p), tag | e.child));
+			}
+		}
+		return -1;
+	}
+
+	// benchmark ***************************
+
+	void BenchmarkStore(const char* path, uint32_t count) {
+		typedef std::chrono::steady_clock clock;
+		auto ms = [](clock::time_point t0, clock::time_point t1) { return std::chrono::duration<double, std::milli>(t1 - t0).count(); };
+		const int QUERIES = 1000, SCANS = 50;
+		const float SITE = 200.f, QUERY_BOX = 2.f; // in m.
+
+		// a plant: primitives of a few cm to a few m over 200 x 200 x 20 m.
+		std::mt19937 random(7);
+		std::uniform_real_distribution<float> uniform(0.f, 1.f);
+		auto direction = [&]() {
+			using namespace smath;
+			float3 d = { uniform(random) - 0.5f, uniform(random) - 0.5f, uniform(random) - 0.5f };
+			return Normalize(d + float3{ 0, 0, 1e-3f });
+		};
+		std::vector<Record> records(count);
+		for (uint32_t k = 0; k < count; k++) {
+			using namespace smath;
+			FS_FEATURE_RESULT r = {};
+			float3 c = { uniform(random)*SITE, uniform(random)*SITE, uniform(random)*SITE*0.1f };
+			float3 axis = direction();
+			float radius = 0.02f + 0.5f*uniform(random)*uniform(random);
+			float length = 0.2f + 3.f*uniform(random);
+			r.type = FS_FEATURE_TYPE(int(FS_FEATURE_TYPE::FS_TYPE_PLANE) + int(k % 5));
+			r.rms = 0.001f;
+			switch (r.type) {
+			case FS_FEATURE_TYPE::FS_TYPE_PLANE: {
+				float3 u = Normalize(Cross(axis, direction()))*length, v = Normalize(Cross(axis, u))*length;
+				float3 corners[4] = { c, c + v, c + u + v, c + u };
+				float* params[4] = { r.plane_param.ll, r.plane_param.lr, r.plane_param.ur, r.plane_param.ul };
+				for (int i = 0; i < 4; i++) memcpy(params[i], corners[i].data(), sizeof(float) * 3);
+				break;
+			}
+			case FS_FEATURE_TYPE::FS_TYPE_SPHERE:
+				memcpy(r.sphere_param.c, c.data(), sizeof(float) * 3);
+				r.sphere_param.r = radius;
+				break;
+			case FS_FEATURE_TYPE::FS_TYPE_CYLINDER:
+				memcpy(r.cylinder_param.b, c.data(), sizeof(float) * 3);
+				memcpy(r.cylinder_param.t, (c + axis*length).data(), sizeof(float) * 3);
+				r.cylinder_param.r = radius;
+				break;
+			case FS_FEATURE_TYPE::FS_TYPE_CONE:
+				memcpy(r.cone_param.b, c.data(), sizeof(float) * 3);
+				memcpy(r.cone_param.t, (c + axis*length).data(), sizeof(float) * 3);
+				r.cone_param.br = radius;
+				r.cone_param.tr = radius*0.5f;
+				break;
+			default:
+				memcpy(r.torus_param.c, c.data(), sizeof(float) * 3);
+				memcpy(r.torus_param.n, axis.data(), sizeof(float) * 3);
+				r.torus_param.mr = radius*3.f;
+				r.torus_param.tr = radius;
+				break;
+			}
+			records[k] = PrimitiveStore::MakeRecord(r, 1000, double(k));
+		}
+
+		remove(path);
+		PrimitiveStore store;
+		auto t0 = clock::now();
+		if (!store.open(path)) return;
+		for (const Record& record : records) store.append(record);
+		auto t1 = clock::now();
+		store.close();
+		auto t2 = clock::now();
+		if (!store.open(path)) return;
+		auto t3 = clock::now();
+		fprintf(stdout, "Store: %u primitives appended in %.0f ms (%.0f k/s), closed in %.0f ms, reopened in %.3f ms, %.1f MB of records, tree height %d\n",
+			store.size(), ms(t0, t1), count / ms(t0, t1), ms(t1, t2), ms(t2, t3), double(sizeof(Record))*count / (1024.0*1024.0), store.height());
+
+		// the queries around random primitives, then the same ones by scanning every record.
+		std::vector<smath::float3> points(QUERIES);
+		for (auto& p : points) {
+			const Record& record = records[random() % count];
+			for (int i = 0; i < 3; i++) p[i] = 0.5f*(record.box_min[i] + record.box_max[i]) + (uniform(random) - 0.5f)*QUERY_BOX;
+		}
+
+		std::vector<uint32_t> ids;
+		double hits = 0;
+		t0 = clock::now();
+		for (const auto& p : points) {
+			float lo[3] = { p[0] - QUERY_BOX*0.5f, p[1] - QUERY_BOX*0.5f, p[2] - QUERY_BOX*0.5f };
+			float hi[3] = { p[0] + QUERY_BOX*0.5f, p[1] + QUERY_BOX*0.5f, p[2] + QUERY_BOX*0.5f };
+			store.intersect(lo, hi, ids);
+			hits += ids.size();
+		}
+		t1 = clock::now();
+		bool same = true;
+		std::vector<uint32_t> scanned;
+		for (int q = 0; q < SCANS; q++) {
+			const auto& p = points[q];
+			float lo[3] = { p[0] - QUERY_BOX*0.5f, p[1] - QUERY_BOX*0.5f, p[2] - QUERY_BOX*0.5f };
+			float hi[3] = { p[0] + QUERY_BOX*0.5f, p[1] + QUERY_BOX*0.5f, p[2] + QUERY_BOX*0.5f };
+			scanned.clear();
+			for (uint32_t k = 0; k < store.size(); k++) {
+				if (Overlap(store[k].box_min, store[k].box_max, lo, hi)) scanned.push_back(k);
+			}
+			store.intersect(lo, hi, ids);
+			std::sort(ids.begin(), ids.end());
+			same = same && ids == scanned;
+		}
+		t2 = clock::now();
+		fprintf(stdout, "       box of %.0f m: %.2f us/query (%.1f hits), scan %.0f us/query, %s\n",
+			QUERY_BOX, 1000.0*ms(t0, t1) / QUERIES, hits / QUERIES, 1000.0*ms(t1, t2) / SCANS, same ? "same" : "MISMATCH");
+
+		float d;
+		t0 = clock::now();
+		for (const auto& p : points) store.nearest(p.data(), &d);
+		t1 = clock::now();
+		same = true;
+		for (int q = 0; q < SCANS; q++) {
+			float best = FLT_MAX;
+			for (uint32_t k = 0; k < store.size(); k++) best = min(best, Distance2(store[k].box_min, store[k].box_max, points[q].data()));
+			store.nearest(points[q].data(), &d);
+			same = same && d == sqrtf(best);
+		}
+		t2 = clock::now();
+		fprintf(stdout, "       nearest: %.2f us/query, scan %.0f us/query, %s\n",
+			1000.0*ms(t0, t1) / QUERIES, 1000.0*ms(t1, t2) / SCANS, same ? "same" : "MISMATCH");
+
+		store.close();
+	}
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#if defined(_MSC_VER)
+#include "libFindSurface\include\FindSurface.h"
+#else
+#include <FindSurface.h>
+#endif
+
+namespace sdb {
+
+	// a detected primitive as it is stored: 96 bytes, the same on every platform.
+	struct Record {
+		uint32_t type;			// FS_FEATURE_TYPE
+		uint32_t inlier_count;
+		double timestamp;		// of the frame it was fitted in: wall-clock time, in ms since the Unix epoch (UTC)
+		float rms;
+		float params[12];		// the parameters of FS_FEATURE_RESULT as they are (plane: ll, lr, ur, ul, sphere: c, r, ...)
+		float box_min[3];		// bounding box of the primitive (of the finite surface the parameters describe)
+		float box_max[3];
+		uint32_t reserved;
+	};
+
+	/* an append-only store of detected primitives in a memory-mapped file, indexed by an R-tree of their bounding boxes
+	   (quadratic split, nodes of up to 32 entries), so that the primitives in a box or the nearest one to a point are
+	   found in logarithmic time. the file is the header, the records in the order they were appended, then the nodes of
+	   the tree, which are moved when the records grow; opening it only maps it. the tree can be rebuilt from the records,
+	   so it is marked dirty while it changes, and rebuilt when a store is opened dirty (after a crash).
+	   (POSIX only; open() fails elsewhere.) */
+	class PrimitiveStore {
+	public:
+		~PrimitiveStore() { close(); }
+
+		bool open(const char* path); // creates the file if it does not exist
+		void close();
+		bool active() const { return file != nullptr; }
+
+		uint32_t size() const;
+		int height() const; // of the tree (1: the root is a leaf)
+		const Record& operator[](uint32_t id) const;
+
+		// returns the id of the record.
+		uint32_t append(const FS_FEATURE_RESULT& result, uint32_t inlier_count, double timestamp);
+		uint32_t append(const Record& record);
+
+		// the ids of the records whose boxes intersect [box_min, box_max], in no particular order.
+		void intersect(const float box_min[3], const float box_max[3], std::vector<uint32_t>& ids) const;
+
+		// the record whose box is the nearest to p (0 inside it), or -1 if the store is empty. distance: from the box.
+		int64_t nearest(const float p[3], float* distance = nullptr) const;
+
+		void flush(); // onto the disk
+
+		static Record MakeRecord(const FS_FEATURE_RESULT& result, uint32_t inlier_count, double timestamp);
+
+	private:
+		struct Header;
+		struct Entry;
+		struct Node;
+
+		int fd = -1;
+		uint8_t* file = nullptr;
+		size_t mapped = 0;
+		std::string path;
+
+		Header* header() const { return reinterpret_cast<Header*>(file); }
+		Record* records() const;
+		Node* node(uint32_t index) const;
+		static size_t file_size(uint32_t record_capacity, uint32_t node_capacity);
+
+		bool resize(uint32_t record_capacity, uint32_t node_capacity);
+		uint32_t allocate_node(uint32_t level);
+		void insert(uint32_t id, const float box_min[3], const float box_max[3]);
+		uint32_t split(uint32_t index, const Entry& extra); // returns the new sibling of the node
+		void rebuild();
+		void mark_dirty();
+	};
+
+	// appends, reopening, box and nearest queries of a store of primitives at path (replaced), against linear scans.
+	void BenchmarkStore(const char* path, uint32_t count);
+}
@@ -0,0 +1,112 @@
+#include <cmath>
+#include <cfloat>
+
+#include "pyramid.h"
+
+namespace spyramid {
+	using namespace smath;
+
+	// a 2x2 block, the dead pixels (0) left out. unsigned 16-bit min and max only, so that the rows vectorize.
+	static inline uint16_t Nearest(uint16_t a, uint16_t b, uint16_t c, uint16_t d) {
+		// 0 - 1 wraps to the largest value, which loses every min; and back to 0 if all are dead.
+		uint16_t m = min(min(uint16_t(a - 1), uint16_t(b - 1)), min(uint16_t(c - 1), uint16_t(d - 1)));
+		return uint16_t(m + 1);
+	}
+
+	static inline uint16_t Median(uint16_t a, uint16_t b, uint16_t c, uint16_t d) {
+		// sorted by a network, the dead pixels first: the valid ones are the last (a != 0) + (b != 0) + ... of them.
+		uint16_t s0 = min(a, b), s1 = max(a, b), s2 = min(c, d), s3 = max(c, d);
+		uint16_t t2 = max(s0, s2), t1 = min(s1, s3), t3 = max(s1, s3); // (the smallest is never taken)
+		uint16_t u1 = min(t1, t2), u2 = max(t1, t2);
+		int valid = (a != 0) + (b != 0) + (c != 0) + (d != 0);
+		return valid == 4 ? u1 : valid >= 2 ? u2 : t3;
+	}
+
+	void Build(const scapture::Frame& frame, int levels, Reduce reduce, std::vector<Level>& pyramid) {
+		pyramid.resize(max(levels, 1));
+		Level& base = pyramid[0];
+		base.width = frame.depth_intrin.width;
+		base.height = frame.depth_intrin.height;
+		base.intrin = frame.depth_intrin;
+		base.depth = frame.depth_image;
+
+		for (size_t k = 1; k < pyramid.size(); k++) {
+			const Level& fine = pyramid[k - 1];
+			Level& coarse = pyramid[k];
+			coarse.width = fine.width / 2;
+			coarse.height = fine.height / 2;
+			coarse.intrin = fine.intrin;
+			coarse.intrin.width = coarse.width;
+			coarse.intrin.height = coarse.height;
+			coarse.intrin.fx = fine.intrin.fx / 2.f;
+			coarse.intrin.fy = fine.intrin.fy / 2.f;
+			coarse.intrin.ppx = (fine.intrin.ppx + 0.5f) / 2.f - 0.5f; // the center of the block of pixels
+			coarse.intrin.ppy = (fine.intrin.ppy + 0.5f) / 2.f - 0.5f;
+			coarse.depth.resize(size_t(coarse.width)*coarse.height);
+
+			for (int y = 0; y < coarse.height; y++) {
+				const uint16_t* top = &fine.depth[size_t(2 * y)*fine.width];
+				const uint16_t* bottom = top + fine.width;
+				uint16_t* out = &coarse.depth[size_t(y)*coarse.width];
+				if (reduce == Reduce::MIN) {
+					for (int x = 0; x < coarse.width; x++) out[x] = Nearest(top[2 * x], top[2 * x + 1], bottom[2 * x], bottom[2 * x + 1]);
+				}
+				else {
+					for (int x = 0; x < coarse.width; x++) out[x] = Median(top[2 * x], top[2 * x + 1], bottom[2 * x], bottom[2 * x + 1]);
+				}
+			}
+		}
+	}
+
+	void Deproject(const scapture::Frame& frame, const Level& level, std::vector<rs::float3>& points) {
+		points.clear();
+		for (int y = 0; y < level.height; y++) {
+			for (int x = 0; x < level.width; x++) {
+				uint16_t depth_value = level.depth[size_t(y)*level.width + x];
+				if (depth_value == 0) continue;
+				rs::float3 depth_point = level.intrin.deproject(rs::float2{ float(x), float(y) }, depth_value * frame.scale);
+				points.push_back(scapture::Transform(frame.extrinsic, depth_point));
+			}
+		}
+	}
+
+	static float3 F3(const float* v) { return float3{ v[0], v[1], v[2] }; }
+
+	float Distance(const FS_FEATURE_RESULT& result, const rs::float3& point) {
+		const float3 p = { point.x, point.y, point.z };
+		switch (result.type) {
+		case FS_FEATURE_TYPE::FS_TYPE_PLANE: {
+			const auto& plane = result.plane_param;
+			float3 normal = Normalize(Cross(F3(plane.lr) - F3(plane.ll), F3(plane.ul) - F3(plane.ll)));
+			return fabsf(Dot(p - F3(plane.ll), normal));
+		}
+		case FS_FEATURE_TYPE::FS_TYPE_SPHERE:
+			return fabsf(Length(p - F3(result.sphere_param.c)) - result.sphere_param.r);
+		case FS_FEATURE_TYPE::FS_TYPE_CYLINDER: {
+			const auto& cylinder = result.cylinder_param;
+			float3 axis = Normalize(F3(cylinder.t) - F3(cylinder.b));
+			float3 d = p - F3(cylinder.b);
+			return fabsf(Length(d - axis*Dot(d, axis)) - cylinder.r);
+		}
+		case FS_FEATURE_TYPE::FS_TYPE_CONE: {
+			// across the slanted side: the radial gap times the cosine of the half angle.
+			const auto& cone = result.cone_param;
+			float length = Length(F3(cone.t) - F3(cone.b));
+			float3 axis = (F3(cone.t) - F3(cone.b)) / length;
+			float3 d = p - F3(cone.b);
+			float h = Dot(d, axis);
+			float radius = cone.br + (cone.tr - cone.br)*h / length;
+			return fabsf(Length(d - axis*h) - radius)*length / sqrtf(length*length + (cone.br - cone.tr)*(cone.br - cone.tr));
+		}
+		case FS_FEATURE_TYPE::FS_TYPE_TORUS: {
+			const auto& torus = result.torus_param;
+			float3 normal = Normalize(F3(torus.n));
+			float3 d = p - F3(torus.c);
+			float h = Dot(d, normal);
+			float radial = Length(d - normal*h) - torus.mr;
+			return fabsf(sqrtf(radial*radial + h*h) - torus.tr);
+		}
+		default: return FLT_MAX;
+		}
+	}
+}
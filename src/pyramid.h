@@ -0,0 +1,29 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "capture.h"
+#include "fs_params.h"
+
+namespace spyramid {
+
+	// how a 2x2 block of pixels becomes one: the nearest depth, or the median of the valid ones (the lower one of two).
+	// dead pixels (0) are left out, and a block without any valid pixel stays dead.
+	enum class Reduce { MIN, MEDIAN };
+
+	struct Level {
+		int width = 0, height = 0;
+		rs::intrinsics intrin = {};		// of the depth image, scaled
+		std::vector<uint16_t> depth;
+	};
+
+	// the raw depth image of frame, then halved levels - 1 times. the rows are reduced without branches,
+	// so that the compiler vectorizes them (a 2x2 block is a sorting network of min and max).
+	void Build(const scapture::Frame& frame, int levels, Reduce reduce, std::vector<Level>& pyramid);
+
+	// the points of a level in the common frame of the rig (as Deproject would, without the colors and the tiles).
+	void Deproject(const scapture::Frame& frame, const Level& level, std::vector<rs::float3>& points);
+
+	// the distance of p from the surface of a result: of the infinite plane, cylinder and cone.
+	float Distance(const FS_FEATURE_RESULT& result, const rs::float3& p);
+}
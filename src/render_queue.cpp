@@ -0,0 +1,145 @@
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+#include "render_queue.h"
+
+namespace sgl {
+
+	void RenderQueue::submit(GLuint program, GLuint vertex_array, GLuint texture, unsigned int state, std::function<void()> draw) {
+		Packet packet;
+		packet.program = program;
+		packet.vertex_array = vertex_array;
+		packet.texture = texture;
+		packet.state = state;
+		packet.order = int(packets.size());
+		packet.first_uniform = int(uniforms.size());
+		packet.uniform_count = 0;
+		packet.draw = std::move(draw);
+		packets.push_back(std::move(packet));
+	}
+
+	// the interned uniform names, by id (built while the static constants of the renderers are initialized).
+	static std::vector<std::string>& Names() {
+		static std::vector<std::string> names;
+		return names;
+	}
+
+	int RenderQueue::Intern(const char* name) {
+		std::vector<std::string>& names = Names();
+		for (size_t k = 0; k < names.size(); k++) if (names[k] == name) return int(k);
+		names.push_back(name);
+		return int(names.size()) - 1;
+	}
+
+	int RenderQueue::slot(GLuint program, int name) {
+		auto found = slot_index.find(std::make_pair(program, name));
+		if (found != slot_index.end()) return found->second;
+		Slot slot;
+		slot.location = glGetUniformLocation(program, Names()[name].c_str());
+		slots.push_back(slot);
+		slot_index[std::make_pair(program, name)] = int(slots.size()) - 1;
+		return int(slots.size()) - 1;
+	}
+
+	void RenderQueue::Uniform1i(int name, int value) {
+		Uniform uniform = {};
+		uniform.slot = slot(packets.back().program, name);
+		uniform.matrix = false;
+		uniform.value = value;
+		uniforms.push_back(uniform);
+		packets.back().uniform_count++;
+	}
+
+	void RenderQueue::UniformMatrix4fv(int name, const smath::mat4& value) {
+		Uniform uniform = {};
+		uniform.slot = slot(packets.back().program, name);
+		uniform.matrix = true;
+		uniform.matrix_value = value;
+		uniforms.push_back(uniform);
+		packets.back().uniform_count++;
+	}
+
+	void RenderQueue::upload(const Uniform& uniform) {
+		Slot& slot = slots[uniform.slot];
+		if (slot.set && slot.matrix == uniform.matrix &&
+			(uniform.matrix ? slot.matrix_value == uniform.matrix_value : slot.value == uniform.value)) {
+			stats.uniforms_skipped++;
+			return;
+		}
+		if (uniform.matrix) glUniformMatrix4fv(slot.location, 1, GL_TRUE, uniform.matrix_value.data()); // row-major
+		else glUniform1i(slot.location, uniform.value);
+		slot.matrix = uniform.matrix;
+		slot.value = uniform.value;
+		slot.matrix_value = uniform.matrix_value;
+		slot.set = true;
+		stats.uniforms++;
+	}
+
+	void RenderQueue::flush() {
+		if (packets.empty()) return;
+		stats.flushes++;
+		stats.packets += int(packets.size());
+
+		// programs change the most (and cost the most), then the vertex arrays, the textures and the state.
+		sorted.resize(packets.size());
+		for (size_t k = 0; k < packets.size(); k++) sorted[k] = int(k);
+		std::sort(sorted.begin(), sorted.end(), [&](int a, int b) {
+			const Packet& p = packets[a];
+			const Packet& q = packets[b];
+			if (p.program != q.program) return p.program < q.program;
+			if (p.vertex_array != q.vertex_array) return p.vertex_array < q.vertex_array;
+			if (p.texture != q.texture) return p.texture < q.texture;
+			if (p.state != q.state) return p.state < q.state;
+			return p.order < q.order;
+		});
+
+		GLuint program = 0, vertex_array = 0, texture = 0;
+		unsigned int state = DEPTH_TEST;
+		auto apply_state = [&](unsigned int next) {
+			unsigned int changed = next ^ state;
+			if (changed & DEPTH_TEST) {
+				if (next & DEPTH_TEST) glEnable(GL_DEPTH_TEST);
+				else glDisable(GL_DEPTH_TEST);
+				stats.states++;
+			}
+			if (changed & WIREFRAME) {
+				glPolygonMode(GL_FRONT_AND_BACK, next & WIREFRAME ? GL_LINE : GL_FILL);
+				stats.states++;
+			}
+			state = next;
+		};
+
+		for (int k : sorted) {
+			const Packet& packet = packets[k];
+			if (packet.program != program) {
+				glUseProgram(packet.program);
+				program = packet.program;
+				stats.programs++;
+			}
+			if (packet.vertex_array != vertex_array) {
+				glBindVertexArray(packet.vertex_array);
+				vertex_array = packet.vertex_array;
+				stats.vertex_arrays++;
+			}
+			if (packet.texture != 0 && packet.texture != texture) {
+				glActiveTexture(GL_TEXTURE0);
+				glBindTexture(GL_TEXTURE_2D, packet.texture);
+				texture = packet.texture;
+				stats.textures++;
+			}
+			apply_state(packet.state);
+			for (int u = 0; u < packet.uniform_count; u++) upload(uniforms[packet.first_uniform + u]);
+
+			packet.draw();
+		}
+
+		// back to the default state, for what is drawn outside the queue.
+		apply_state(DEPTH_TEST);
+		if (vertex_array) glBindVertexArray(0);
+		if (program) glUseProgram(0);
+
+		packets.clear();
+		uniforms.clear();
+	}
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include <map>
+#include <vector>
+#include <functional>
+#include "smath.h"
+#include "opengl_wrapper.h"
+
+namespace sgl {
+
+	// the fixed-function state of a draw. the default (between the flushes) is DEPTH_TEST alone.
+	enum RenderState : unsigned int {
+		DEPTH_TEST = 1 << 0,
+		WIREFRAME = 1 << 1,		// glPolygonMode(GL_LINE)
+	};
+
+	/* draw packets of the renderers, sorted by program, vertex array, texture and state, and submitted in one pass
+	   in which only the binds and the state changes that differ from the current ones are issued. the uniforms are
+	   kept per program across the flushes (every uniform of the programs is set through the queue), and uploaded
+	   only when their values change; their names are interned once, so that drawing compares no strings. the packets
+	   of a pass are flushed before its framebuffer or viewport changes. */
+	class RenderQueue {
+	public:
+		struct Stats {
+			int flushes = 0, packets = 0;
+			int programs = 0, vertex_arrays = 0, textures = 0, states = 0;	// changes issued
+			int uniforms = 0, uniforms_skipped = 0;		// uploaded, and left out as unchanged
+			int changes() const { return programs + vertex_arrays + textures + states + uniforms; }
+		};
+
+		// texture: bound to unit 0, if not 0. draw: called with all the rest bound.
+		void submit(GLuint program, GLuint vertex_array, GLuint texture, unsigned int state, std::function<void()> draw);
+		// the id of a uniform name (the same for every queue): interned once, e.g. into a static constant.
+		static int Intern(const char* name);
+		// of the last packet submitted (name: an id from Intern()).
+		void Uniform1i(int name, int value);
+		void UniformMatrix4fv(int name, const smath::mat4& value);
+
+		void flush();
+
+		Stats stats;	// summed over the flushes, until reset by the caller
+
+	private:
+		struct Packet {
+			GLuint program, vertex_array, texture;
+			unsigned int state;
+			int order;						// of submission, among equal keys
+			int first_uniform, uniform_count;
+			std::function<void()> draw;
+		};
+		struct Uniform {
+			int slot;
+			bool matrix;
+			int value;
+			smath::mat4 matrix_value;
+		};
+		struct Slot {
+			GLint location = -1;
+			bool set = false;			// and the last values uploaded:
+			bool matrix = false;
+			int value = 0;
+			smath::mat4 matrix_value;
+		};
+
+		std::vector<Packet> packets;
+		std::vector<Uniform> uniforms;
+		std::vector<int> sorted;
+		std::vector<Slot> slots;
+		std::map<std::pair<GLuint, int>, int> slot_index; // of every program and name id, in slots
+
+		int slot(GLuint program, int name); // found, or added with its location
+		void upload(const Uniform& uniform);
+	};
+}
@@ -0,0 +1,176 @@
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+
+#if !defined(_WIN32) && !defined(_WIN64)
+#include "result_ring.h"
+#endif
+
+#include "result_publisher.h"
+#include "sgeometry.h"
+
+namespace sipc {
+
+#if !defined(_WIN32) && !defined(_WIN64)
+
+	static_assert(sizeof(fs_ring_header) == 64 && sizeof(fs_ring_slot) == 144, "result_ring.h layout has changed");
+
+	bool ResultPublisher::create(const char* name, uint32_t slot_count, uint32_t max_points) {
+		release();
+
+		size_t ring_size = size_t(fs_ring_size(slot_count, max_points));
+		int fd = shm_open(name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+		if (fd < 0 || ftruncate(fd, off_t(ring_size)) < 0) {
+			if (fd >= 0) close(fd);
+			fprintf(stderr, "Publisher: failed to create the shared memory %s.\n", name);
+			return false;
+		}
+
+		void* ptr = mmap(nullptr, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		if (ptr == MAP_FAILED) {
+			shm_unlink(name);
+			fprintf(stderr, "Publisher: failed to map the shared memory %s.\n", name);
+			return false;
+		}
+
+		fs_ring_header* header = reinterpret_cast<fs_ring_header*>(ptr);
+		header->slot_count = slot_count;
+		header->max_points = max_points;
+		header->slot_size = (fs_ring_size(slot_count, max_points) - sizeof(fs_ring_header)) / slot_count;
+		header->head = 0;
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		memcpy(header->magic, FS_RING_MAGIC, 8); // readers check the magic last written.
+
+		ring = ptr;
+		size = ring_size;
+		this->name = name;
+
+		fprintf(stderr, "Publisher: publishing results into %s (%u slots of %u points).\n", name, slot_count, max_points);
+		return true;
+	}
+
+	void ResultPublisher::release() {
+		if (ring == nullptr) return;
+		munmap(ring, size);
+		shm_unlink(name.c_str());
+		ring = nullptr;
+	}
+
+	void ResultPublisher::publish(const FS_FEATURE_RESULT& result, float arc, const unsigned char* flags, const rs::float3* points, uint32_t point_count, bool with_points) {
+		if (ring == nullptr) return;
+		using namespace smath;
+
+		fs_ring_header* header = reinterpret_cast<fs_ring_header*>(ring);
+		uint64_t index = header->head; // the only writer
+		fs_ring_slot* slot = fs_ring_slot_at(header, index);
+
+		// seqlock: readers see an odd sequence before any of the data changes.
+		uint32_t sequence = slot->sequence;
+		__atomic_store_n(&slot->sequence, sequence + 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+
+		slot->type = uint32_t(result.type);
+		slot->index = index;
+		slot->timestamp = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+		slot->rms = result.rms;
+		memcpy(slot->params, &result.plane_param, sizeof(slot->params)); // the largest member of the union
+
+		// the inliers (in the point cloud of the frame); truncated to the capacity of the slot, which readers are told.
+		uint32_t* inliers = fs_ring_inliers(slot);
+		uint32_t inlier_count = 0, inlier_total = 0;
+		for (uint32_t k = 0; k < point_count; k++) {
+			if (flags[k]) continue;
+			if (inlier_count < header->max_points) inliers[inlier_count++] = k;
+			inlier_total++;
+		}
+		slot->inlier_count = inlier_count;
+		slot->inlier_total = inlier_total;
+
+		slot->point_count = slot->point_total = 0;
+		if (with_points) {
+			slot->point_count = min(point_count, header->max_points);
+			slot->point_total = point_count;
+			memcpy(fs_ring_points(header, slot), points, slot->point_count * sizeof(rs::float3));
+		}
+		slot->flags = inlier_total > inlier_count || slot->point_total > slot->point_count ? FS_RING_TRUNCATED : 0;
+		slot->reserved = 0;
+
+		float3 center = {}, axis = {};
+		float width = 0.f, height = 0.f, radius = 0.f, radius2 = 0.f, angle = 0.f;
+		switch (result.type) {
+		case FS_FEATURE_TYPE::FS_TYPE_PLANE:
+		{
+			float3 ll = ToFloat3((float*)result.plane_param.ll);
+			float3 lr = ToFloat3((float*)result.plane_param.lr);
+			float3 ur = ToFloat3((float*)result.plane_param.ur);
+			float3 ul = ToFloat3((float*)result.plane_param.ul);
+			float3 hori = ul - ll;
+			float3 vert = lr - ll;
+			center = (ll + lr + ur + ul)*0.25f;
+			axis = Normalize(Cross(hori, vert));
+			width = Length(hori);
+			height = Length(vert);
+			break;
+		}
+		case FS_FEATURE_TYPE::FS_TYPE_SPHERE:
+			center = ToFloat3((float*)result.sphere_param.c);
+			radius = result.sphere_param.r;
+			break;
+		case FS_FEATURE_TYPE::FS_TYPE_CYLINDER:
+		{
+			float3 bottom = ToFloat3((float*)result.cylinder_param.b);
+			float3 top = ToFloat3((float*)result.cylinder_param.t);
+			center = (bottom + top)*0.5f;
+			axis = Normalize(top - bottom);
+			height = Length(top - bottom);
+			radius = result.cylinder_param.r;
+			break;
+		}
+		case FS_FEATURE_TYPE::FS_TYPE_CONE:
+		{
+			float3 bottom = ToFloat3((float*)result.cone_param.b);
+			float3 top = ToFloat3((float*)result.cone_param.t);
+			center = (bottom + top)*0.5f;
+			axis = Normalize(top - bottom);
+			height = Length(top - bottom);
+			radius = result.cone_param.br;
+			radius2 = result.cone_param.tr;
+			break;
+		}
+		case FS_FEATURE_TYPE::FS_TYPE_TORUS:
+		{
+			center = ToFloat3((float*)result.torus_param.c);
+			axis = ToFloat3((float*)result.torus_param.n);
+			radius = result.torus_param.mr;
+			radius2 = result.torus_param.tr;
+			angle = arc;
+			break;
+		}
+		default: break;
+		}
+		memcpy(slot->center, center.data(), sizeof(slot->center));
+		memcpy(slot->axis, axis.data(), sizeof(slot->axis));
+		slot->width = width;
+		slot->height = height;
+		slot->radius = radius;
+		slot->radius2 = radius2;
+		slot->angle = angle;
+
+		__atomic_store_n(&slot->sequence, sequence + 2, __ATOMIC_RELEASE);
+		__atomic_store_n(&header->head, index + 1, __ATOMIC_RELEASE);
+	}
+
+#else
+
+	bool ResultPublisher::create(const char* name, uint32_t slot_count, uint32_t max_points) {
+		fprintf(stderr, "Publisher: POSIX shared memory is not supported on this platform.\n");
+		return false;
+	}
+
+	void ResultPublisher::release() {}
+
+	void ResultPublisher::publish(const FS_FEATURE_RESULT& result, float arc, const unsigned char* flags, const rs::float3* points, uint32_t point_count, bool with_points) {}
+
+#endif
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#if defined(_MSC_VER)
+#include "3rdparty\librealsense\includes\rs.hpp"
+#include "libFindSurface\include\FindSurface.h"
+#else
+#include <librealsense/rs.hpp>
+#include <FindSurface.h>
+#endif
+
+namespace sipc {
+
+	// publishes FindSurface results into a shared-memory ring that other processes map read-only.
+	// the layout and the reader protocol are in result_ring.h (POSIX only; create() fails elsewhere).
+	class ResultPublisher {
+	public:
+		~ResultPublisher() { release(); }
+
+		bool create(const char* name, uint32_t slot_count, uint32_t max_points);
+		void release();
+		bool active() const { return ring != nullptr; }
+
+		// arc: of a torus result, measured on all its inliers (which the slot may not hold). flags: the in/outlier flags
+		// of FindSurface (0 for inliers) of the point cloud. the point cloud itself is copied into the slot only if with_points.
+		void publish(const FS_FEATURE_RESULT& result, float arc, const unsigned char* flags, const rs::float3* points, uint32_t point_count, bool with_points);
+
+	private:
+		void* ring = nullptr; // fs_ring_header
+		size_t size = 0;
+		std::string name;
+	};
+}
@@ -0,0 +1,116 @@
+/* Shared-memory ring of FindSurface results (POSIX, C99 or C++).
+ *
+ * The demo publishes each result into the next slot of a ring in shared memory ("/findsurface" by default).
+ * Readers map it read-only and read the slots in place, with no copying:
+ *
+ *		const fs_ring_header* ring = fs_ring_map("/findsurface");
+ *		uint64_t index = fs_ring_head(ring) - 1;		// the latest result
+ *		const fs_ring_slot* slot = fs_ring_slot_at(ring, index);
+ *		uint32_t seq;
+ *		if (fs_ring_read_begin(slot, &seq)) {
+ *			... use slot, fs_ring_inliers(slot), fs_ring_points(ring, slot) ...
+ *			if (!fs_ring_read_end(slot, seq)) ... the slot was overwritten meanwhile, discard what was read ...
+ *		}
+ *
+ * Each slot is guarded by a seqlock: the sequence is odd while the slot is being written.
+ */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define FS_RING_MAGIC "FSRING2"
+#define FS_RING_DEFAULT_NAME "/findsurface"
+
+typedef struct {
+	char magic[8];			/* FS_RING_MAGIC */
+	uint32_t slot_count;
+	uint32_t max_points;	/* capacity of the inlier and point arrays of a slot */
+	uint64_t slot_size;		/* in bytes, including the arrays */
+	uint64_t head;			/* number of results published; the latest one is at index head - 1 */
+	uint8_t reserved[32];
+} fs_ring_header;			/* 64 bytes, followed by the slots */
+
+typedef struct {
+	uint32_t sequence;		/* seqlock: odd while the slot is being written */
+	uint32_t type;			/* FS_FEATURE_TYPE: 2 plane, 3 sphere, 4 cylinder, 5 cone, 6 torus */
+	uint64_t index;			/* index of the result since the ring was created */
+	double timestamp;		/* CLOCK_MONOTONIC (std::chrono::steady_clock) time of publishing, in ms. */
+	float rms;
+	float params[12];		/* the parameters of FS_FEATURE_RESULT as they are (plane: ll, lr, ur, ul, sphere: c, r, ...) */
+
+	/* derived quantities */
+	float center[3];
+	float axis[3];			/* plane normal, cylinder/cone axis (bottom to top), torus axis; zero for spheres */
+	float width;			/* plane */
+	float height;			/* plane, cylinder, cone */
+	float radius;			/* sphere, cylinder, cone bottom, torus mean radius */
+	float radius2;			/* cone top, torus tube radius */
+	float angle;			/* torus: angular extent of the inliers (in radians) */
+
+	uint32_t inlier_count;	/* in the slot (at most max_points) */
+	uint32_t point_count;	/* in the slot; 0 unless the point cloud of the frame is published as well */
+	uint32_t inlier_total;	/* of the result, and of the point cloud of the frame (if published): */
+	uint32_t point_total;	/* more than the counts above if the slot could not hold them all */
+	uint32_t flags;			/* FS_RING_TRUNCATED */
+	uint32_t reserved;
+} fs_ring_slot;				/* 144 bytes, followed by uint32_t inliers[max_points] and float points[max_points][3] */
+
+#define FS_RING_TRUNCATED 1u	/* the inliers or the points of the slot are a prefix of those of the result */
+
+static inline fs_ring_slot* fs_ring_slot_at(const fs_ring_header* ring, uint64_t index) {
+	return (fs_ring_slot*)((uint8_t*)ring + sizeof(fs_ring_header) + (index % ring->slot_count) * ring->slot_size);
+}
+
+/* indices of the inliers in the point cloud of the frame. */
+static inline uint32_t* fs_ring_inliers(const fs_ring_slot* slot) {
+	return (uint32_t*)((uint8_t*)slot + sizeof(fs_ring_slot));
+}
+
+static inline float* fs_ring_points(const fs_ring_header* ring, const fs_ring_slot* slot) {
+	return (float*)((uint8_t*)fs_ring_inliers(slot) + ring->max_points * sizeof(uint32_t));
+}
+
+static inline uint64_t fs_ring_size(uint32_t slot_count, uint32_t max_points) {
+	uint64_t slot_size = sizeof(fs_ring_slot) + (uint64_t)max_points * (sizeof(uint32_t) + 3 * sizeof(float));
+	slot_size = (slot_size + 63) & ~(uint64_t)63;
+	return sizeof(fs_ring_header) + slot_count * slot_size;
+}
+
+static inline uint64_t fs_ring_head(const fs_ring_header* ring) {
+	return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+}
+
+/* returns 0 if the slot is being written. */
+static inline int fs_ring_read_begin(const fs_ring_slot* slot, uint32_t* sequence) {
+	*sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+	return (*sequence & 1) == 0;
+}
+
+/* returns 0 if the slot has been (or is being) rewritten since fs_ring_read_begin. */
+static inline int fs_ring_read_end(const fs_ring_slot* slot, uint32_t sequence) {
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) == sequence;
+}
+
+/* maps the ring read-only; returns NULL on failure. */
+static inline const fs_ring_header* fs_ring_map(const char* name) {
+	struct stat st;
+	void* ptr;
+	int fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0) return NULL;
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(fs_ring_header)) { close(fd); return NULL; }
+	ptr = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (ptr == MAP_FAILED) return NULL;
+	if (memcmp(((const fs_ring_header*)ptr)->magic, FS_RING_MAGIC, 8) != 0) { munmap(ptr, (size_t)st.st_size); return NULL; }
+	return (const fs_ring_header*)ptr;
+}
+
+static inline void fs_ring_unmap(const fs_ring_header* ring) {
+	munmap((void*)ring, (size_t)fs_ring_size(ring->slot_count, ring->max_points));
+}
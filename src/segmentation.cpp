@@ -0,0 +1,163 @@
+#include "segmentation.h"
+#include <cmath>
+#include <thread>
+
+namespace ssegment {
+	using namespace smath;
+
+	// parents always point to smaller pixels, so a set is rooted at its first pixel.
+	int Segmenter::find(int pixel) {
+		while (labels[pixel] != pixel) {
+			labels[pixel] = labels[labels[pixel]]; // path halving
+			pixel = labels[pixel];
+		}
+		return pixel;
+	}
+
+	int Segmenter::unite(int a, int b) {
+		a = find(a);
+		b = find(b);
+		if (a < b) return labels[b] = a;
+		labels[a] = b;
+		return b;
+	}
+
+	bool Segmenter::connected(const scapture::Frame& frame, int a, int b, float cos_angle) const {
+		if (pixel_points[a] < 0 || pixel_points[b] < 0) return false;
+		float za = frame.depth_image[a] * frame.scale, zb = frame.depth_image[b] * frame.scale;
+		if (fabsf(za - zb) > params.depth_jump*min(za, zb)) return false;
+
+		const float3& na = normals[a];
+		const float3& nb = normals[b];
+		if (Dot(na, na) == 0.f || Dot(nb, nb) == 0.f) return true; // unknown: the depth decides
+		return fabsf(Dot(na, nb)) >= cos_angle;
+	}
+
+	void Segmenter::segment(const scapture::Frame& frame) {
+		double t0 = scapture::Now();
+		width = frame.depth_intrin.width;
+		height = frame.depth_intrin.height;
+		const int pixels = width*height;
+
+		scapture::PixelPoints(frame, pixel_points);
+		point_pixels.assign(frame.points.size(), -1);
+		for (int pixel = 0; pixel < pixels; pixel++) {
+			if (pixel_points[pixel] >= 0 && pixel_points[pixel] < int(point_pixels.size())) point_pixels[pixel_points[pixel]] = pixel;
+		}
+		normals.assign(pixels, float3{});
+		labels.resize(pixels);
+
+		int threads = params.threads > 0 ? params.threads : max(1, int(std::thread::hardware_concurrency()));
+		threads = max(min(threads, height / 16), 1);
+		const float cos_angle = cosf(params.normal_angle*PI / 180.f);
+
+		// 1. normals in the depth camera (the angles are the same in the common frame), from the depth image directly:
+		// the neighbors 4 pixels away (nearer ones are mostly noise), across no depth jump. the distortion is neglected.
+		// 2. the bands of rows, each by a thread: the sets do not leave the band yet.
+		auto band = [this, &frame, threads, cos_angle](int k) {
+			const int STEP = 4;
+			const float ifx = 1.f / frame.depth_intrin.fx, ify = 1.f / frame.depth_intrin.fy, ppx = frame.depth_intrin.ppx, ppy = frame.depth_intrin.ppy;
+			const uint16_t* depth = frame.depth_image.data();
+			const float jump = 2.f*params.depth_jump;
+			int begin = height*k / threads, end = height*(k + 1) / threads;
+
+			for (int y = max(begin, STEP); y < min(end, height - STEP); y++) {
+				for (int x = STEP; x < width - STEP; x++) {
+					int pixel = y*width + x;
+					float z = depth[pixel] * frame.scale;
+					float zl = depth[pixel - STEP] * frame.scale, zr = depth[pixel + STEP] * frame.scale;
+					float zu = depth[pixel - STEP*width] * frame.scale, zd = depth[pixel + STEP*width] * frame.scale;
+					if (z == 0.f || zl == 0.f || zr == 0.f || zu == 0.f || zd == 0.f) continue;
+					if (fabs(zl - z) > jump*z || fabs(zr - z) > jump*z || fabs(zu - z) > jump*z || fabs(zd - z) > jump*z) continue;
+
+					float3 tx = { (x + STEP - ppx)*ifx*zr - (x - STEP - ppx)*ifx*zl, (y - ppy)*ify*(zr - zl), zr - zl };
+					float3 ty = { (x - ppx)*ifx*(zd - zu), (y + STEP - ppy)*ify*zd - (y - STEP - ppy)*ify*zu, zd - zu };
+					float3 n = Cross(tx, ty);
+					float length = Length(n);
+					if (length > 0.f) normals[pixel] = n * (1.f / length);
+				}
+			}
+
+			for (int pixel = begin*width; pixel < end*width; pixel++) labels[pixel] = pixel_points[pixel] >= 0 ? pixel : -1;
+			for (int y = begin; y < end; y++) {
+				for (int x = 0; x < width; x++) {
+					int pixel = y*width + x;
+					if (labels[pixel] < 0) continue;
+					// the root of the pixel is carried along: a neighbor already in its set is not looked up.
+					int root = find(pixel);
+					if (x + 1 < width && labels[pixel + 1] != root && connected(frame, pixel, pixel + 1, cos_angle)) root = unite(root, pixel + 1);
+					if (y + 1 < end && labels[pixel + width] != root && connected(frame, pixel, pixel + width, cos_angle)) unite(root, pixel + width);
+				}
+			}
+		};
+		std::vector<std::thread> workers;
+		for (int k = 1; k < threads; k++) workers.push_back(std::thread(band, k));
+		band(0);
+		for (std::thread& worker : workers) worker.join();
+
+		// 3. the borders of the bands; the normals of their rows are complete by now.
+		for (int k = 1; k < threads; k++) {
+			int y = height*k / threads;
+			for (int x = 0; x < width; x++) {
+				int pixel = y*width + x;
+				if (connected(frame, pixel - width, pixel, cos_angle)) unite(pixel - width, pixel);
+			}
+		}
+
+		// 4. every pixel to its root, in order: parents come first.
+		for (int pixel = 0; pixel < pixels; pixel++) {
+			if (labels[pixel] >= 0) labels[pixel] = labels[labels[pixel]];
+		}
+
+		segment_ms = scapture::Now() - t0;
+	}
+
+	int Segmenter::segments() const {
+		int count = 0;
+		for (int pixel = 0; pixel < int(labels.size()); pixel++) count += labels[pixel] == pixel;
+		return count;
+	}
+
+	void Segmenter::select(int seed, std::vector<int>& points) const {
+		points.clear();
+		if (seed < 0 || seed >= int(point_pixels.size()) || point_pixels[seed] < 0) return;
+		const int label = labels[point_pixels[seed]];
+
+		// the bounding box of the segment, grown by the margin.
+		int x0 = width, y0 = height, x1 = -1, y1 = -1;
+		for (int pixel = label; pixel < int(labels.size()); pixel++) {
+			if (labels[pixel] != label) continue;
+			int x = pixel % width, y = pixel / width;
+			x0 = min(x0, x); x1 = max(x1, x);
+			y0 = min(y0, y); y1 = max(y1, y);
+		}
+		const int m = params.margin;
+		x0 = max(x0 - m, 0); y0 = max(y0 - m, 0);
+		x1 = min(x1 + m, width - 1); y1 = min(y1 + m, height - 1);
+		const int w = x1 - x0 + 1, h = y1 - y0 + 1;
+
+		// the segment dilated by the margin (a square), separably: along the rows, then along the columns.
+		std::vector<unsigned char> mask(w*h), rows(w*h);
+		for (int y = 0; y < h; y++) {
+			for (int x = 0; x < w; x++) mask[y*w + x] = labels[(y0 + y)*width + x0 + x] == label;
+		}
+		for (int y = 0; y < h; y++) {
+			int count = 0; // in the window [x - m, x + m]
+			for (int x = 0; x < min(m, w); x++) count += mask[y*w + x];
+			for (int x = 0; x < w; x++) {
+				if (x + m < w) count += mask[y*w + x + m];
+				if (x - m - 1 >= 0) count -= mask[y*w + x - m - 1];
+				rows[y*w + x] = count > 0;
+			}
+		}
+		for (int x = 0; x < w; x++) {
+			int count = 0;
+			for (int y = 0; y < min(m, h); y++) count += rows[y*w + x];
+			for (int y = 0; y < h; y++) {
+				if (y + m < h) count += rows[(y + m)*w + x];
+				if (y - m - 1 >= 0) count -= rows[(y - m - 1)*w + x];
+				if (count > 0 && pixel_points[(y0 + y)*width + x0 + x] >= 0) points.push_back(pixel_points[(y0 + y)*width + x0 + x]);
+			}
+		}
+	}
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <vector>
+
+#include "capture.h"
+
+namespace ssegment {
+
+	struct Params {
+		float depth_jump = 0.03f;	// neighbor pixels farther apart in depth (relative to the depth) are cut
+		float normal_angle = 35.f;	// and so are those whose normals are farther apart (in degrees)
+		int margin = 3;				// pixels around the segment of the seed, given with it
+		int threads = 0;			// the number of cores by default
+	};
+
+	/* connected components of the depth image of a frame: 4-neighbors are connected unless a depth jump or
+	   a crease (the angle between their normals) lies between them. linear in the pixels: the bands of rows
+	   are labeled in parallel by union-find, then their borders are merged. */
+	class Segmenter {
+	public:
+		Params params;
+		double segment_ms = 0.0; // of the last segment()
+
+		void segment(const scapture::Frame& frame);
+
+		// the indices into frame.points of the segment of the point seed, and of the pixels within margin of it.
+		void select(int seed, std::vector<int>& points) const;
+
+		int segments() const; // of the last segment()
+
+	private:
+		int width = 0, height = 0;
+		std::vector<int> pixel_points;	// point of every pixel (-1: dead)
+		std::vector<int> point_pixels;
+		std::vector<smath::float3> normals; // zero where unknown
+		std::vector<int> labels;		// union-find parents, then the segment of every pixel (its first pixel; -1: dead)
+
+		int find(int pixel);
+		int unite(int a, int b); // the root of the union
+		bool connected(const scapture::Frame& frame, int a, int b, float cos_angle) const;
+	};
+}
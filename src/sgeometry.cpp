@@ -1,3 +1,9 @@
+#include <cstdio>
+#include <chrono>
+#include <random>
+#include <numeric>
+#include <algorithm>
+
 #include "sgeometry.h"
 
 
@@ -9,7 +15,8 @@ namespace sgeometry {
 	void CreateSphereVertexData(std::vector<float3>& vertices, std::vector<unsigned int>& indices, int LOD) {
 
 		/* reference: https://sites.google.com/site/ofauckland/examples/subdivide-a-tetrahedron-to-a-sphere */
-		static std::function<void(int, int, int, int)> subdivide = [&](int i0, int i1, int i2, int level) {
+		// not static: it has to capture the vectors of this call, not the ones of the first call.
+		std::function<void(int, int, int, int)> subdivide = [&](int i0, int i1, int i2, int level) {
 			if (level-- > 0) {
 				float3& p0 = vertices[i0];
 				float3& p1 = vertices[i1];
@@ -56,16 +63,14 @@ namespace sgeometry {
 	}
 
 	// It's center will be located at the origin (0, 0, 0) and its length is 2 and radius is 1.
-	void CreateCylinderVertexData(std::vector<float3>& vertices, std::vector<unsigned int>& indices) {
-
-		static const int CYLINDER_SUBDIV = 36;
+	void CreateCylinderVertexData(std::vector<float3>& vertices, std::vector<unsigned int>& indices, int subdiv) {
 
 		//unsigned int base_index = unsigned int(vertices.size());
 
 		float t = 1.f / 3.f;
 
-		float unit_angle = PI / (CYLINDER_SUBDIV / 2);
-		for (int k = 0; k < CYLINDER_SUBDIV; k++) {
+		float unit_angle = 2.f * PI / subdiv;
+		for (int k = 0; k < subdiv; k++) {
 			float angle = unit_angle*k;
 			float c = cosf(angle);
 			float s = sinf(angle);
@@ -85,7 +90,7 @@ namespace sgeometry {
 			//    |_\|				   |_\|
 			// 30      31			30		31
 			//
-			int i00 = k * 4;	int i01 = ((k + 1) % CYLINDER_SUBDIV) * 4;
+			int i00 = k * 4;	int i01 = ((k + 1) % subdiv) * 4;
 			int i10 = i00 + 1;	int i11 = i01 + 1;
 			int i20 = i10 + 1;	int i21 = i11 + 1;
 			int i30 = i20 + 1;	int i31 = i21 + 1;
@@ -102,58 +107,222 @@ namespace sgeometry {
 	}
 
 	/* about terminology: https://en.wikipedia.org/wiki/Torus */
-	// It's center will be located at the origin (0, 0, 0) and mean radius is 1 and tube radius is 0.5.
-	void CreateTorusVertexData(std::vector<float3>& vertices, std::vector<unsigned int>& indices) {
-
-		static const int TOROIDAL_SUBDIV = 36;
-		static const int POLOIDAL_SUBDIV = 10;
-		//vertices.clear(); vertices.reserve(TOROIDAL_SUBDIV*POLOIDAL_SUBDIV);
-		//indices.clear(); indices.reserve(TOROIDAL_SUBDIV*POLOIDAL_SUBDIV * 6);
-		//unsigned int base_index = unsigned int(vertices.size());
+	// Each vertex is stored as (toroidal fraction in [0, 1], cos(poloidal angle), sin(poloidal angle)).
+	// The vertex shader bends the tube around the axis (0, 1, 0) by the arc angle of each instance,
+	// so the first and the last ring are not shared and a partial torus needs no index trick.
+	void CreateTorusVertexData(std::vector<float3>& vertices, std::vector<unsigned int>& indices, int toroidal_subdiv, int poloidal_subdiv) {
 
-		float toroidal_unit_angle = PI / (TOROIDAL_SUBDIV / 2);
-		float poloidal_unit_angle = PI / (POLOIDAL_SUBDIV / 2);
+		float poloidal_unit_angle = 2.f * PI / poloidal_subdiv;
 
-		float mean_radius = 1.0f;
-		float tube_radius = 0.5f;
-		for (int k = 0; k < TOROIDAL_SUBDIV; k++) {
+		for (int k = 0; k <= toroidal_subdiv; k++) {
 
-			float phi = toroidal_unit_angle*float(k);
-			float cphi = cosf(phi);
-			float sphi = sinf(phi);
+			float u = float(k) / toroidal_subdiv;
 
-			for (int s = 0; s < POLOIDAL_SUBDIV; s++) {
+			for (int s = 0; s < poloidal_subdiv; s++) {
 
 				float theta = poloidal_unit_angle*float(s);
-				float ctheta = cosf(theta);
-				float stheta = sinf(theta);
-				
-				vertices.push_back({
-					(mean_radius + tube_radius*ctheta)*cphi,
-					tube_radius*stheta,
-					-(mean_radius + tube_radius*ctheta)*sphi
-				});
+				vertices.push_back({ u, cosf(theta), sinf(theta) });
+
+				if (k == toroidal_subdiv) continue;
 
 				// indexing order
 				//		k    _  k+1
 				//	s	00 |\ | 10
 				//	s+1	01 |_\| 11
 				//
-				int i0_ = k*POLOIDAL_SUBDIV;
-				int i1_ = ((k + 1) % TOROIDAL_SUBDIV)*POLOIDAL_SUBDIV;
+				int i0_ = k*poloidal_subdiv;
+				int i1_ = (k + 1)*poloidal_subdiv;
 				int i_0 = s;
-				int i_1 = (s + 1) % POLOIDAL_SUBDIV;
+				int i_1 = (s + 1) % poloidal_subdiv;
 				int i00 = i0_ + i_0;
 				int i01 = i0_ + i_1;
 				int i10 = i1_ + i_0;
 				int i11 = i1_ + i_1;
-				//int i10 = i00 - s + (s + 1) % POLOIDAL_SUBDIV;
-				//int i01 = ((k + 1) % TOROIDAL_SUBDIV)*POLOIDAL_SUBDIV + s;
-				//int i11 = i01 - s + (s + 1) % POLOIDAL_SUBDIV;
 
 				indices.push_back(i00); indices.push_back(i01); indices.push_back(i11);
 				indices.push_back(i00); indices.push_back(i11); indices.push_back(i10);
 			}
 		}
 	}
-}
\ No newline at end of file
+
+	// Find the angular extent of points lying on a partial torus (e.g. an elbow joint) in a single pass.
+	void GetArcExtent(const void* points, size_t count, size_t stride, float3 center, float3 axis, float3& begin, float& angle) {
+
+		static const int ARC_BINS = 512;
+
+		begin = float3{};
+		angle = 0.f;
+		if (points == nullptr || count == 0) return;
+		if (stride == 0) stride = sizeof(float3);
+
+		// an orthonormal basis (u, w, n) on which angles around n increase from u toward w.
+		float3 n = Normalize(axis);
+		float3 helper = fabsf(n[0]) < 0.9f ? float3{ 1, 0, 0 } : float3{ 0, 1, 0 };
+		float3 u = Normalize(Cross(helper, n));
+		float3 w = Cross(n, u);
+
+		// each bin keeps its extreme points so that the ends of the arc are exact, not bin-quantized.
+		struct Bin {
+			float lo, lo_x, lo_y;
+			float hi, hi_x, hi_y;
+		};
+		std::vector<Bin> bins(ARC_BINS, Bin{ 5.f, 0.f, 0.f, -1.f, 0.f, 0.f });
+
+		const unsigned char* ptr = reinterpret_cast<const unsigned char*>(points);
+		for (size_t k = 0; k < count; k++, ptr += stride) {
+			const float* p = reinterpret_cast<const float*>(ptr);
+			float vx = p[0] - center[0], vy = p[1] - center[1], vz = p[2] - center[2];
+
+			// projection onto the plane perpendicular to the axis (in the (u, w) coordinates).
+			float x = vx*u[0] + vy*u[1] + vz*u[2];
+			float y = vx*w[0] + vy*w[1] + vz*w[2];
+			float d = fabsf(x) + fabsf(y);
+			if (d < FLT_EPSILON) continue;
+
+			// "diamond angle": monotonic in the polar angle, ranges in [0, 4), and needs no atan2.
+			float t;
+			if (y >= 0)	t = x >= 0 ? y / d : 1 - x / d;
+			else		t = x < 0 ? 2 - y / d : 3 + x / d;
+
+			int b = min(int(t*(ARC_BINS / 4)), ARC_BINS - 1);
+			Bin& bin = bins[b];
+			if (t < bin.lo) { bin.lo = t; bin.lo_x = x; bin.lo_y = y; }
+			if (t > bin.hi) { bin.hi = t; bin.hi_x = x; bin.hi_y = y; }
+		}
+
+		auto occupied = [&bins](int b) { return bins[b].hi >= 0; };
+
+		int first = 0;
+		while (first < ARC_BINS && !occupied(first)) first++;
+		if (first == ARC_BINS) return;
+
+		// the arc is the complement of the largest run of empty bins (walking counterclockwise).
+		int largest_gap = 0;
+		int begin_bin = first, end_bin = first;
+		int last = 0;
+		for (int k = 1; k <= ARC_BINS; k++) {
+			int b = (first + k) % ARC_BINS;
+			if (!occupied(b)) continue;
+
+			int gap = k - last - 1;
+			if (gap > largest_gap) {
+				largest_gap = gap;
+				begin_bin = b;
+				end_bin = (first + last) % ARC_BINS;
+			}
+			last = k;
+		}
+
+		const Bin& b0 = bins[begin_bin];
+		begin = Normalize(u*b0.lo_x + w*b0.lo_y);
+
+		if (largest_gap == 0) { // the points go all the way around the axis.
+			angle = 2.f*PI;
+			return;
+		}
+
+		const Bin& b1 = bins[end_bin];
+		float3 end = Normalize(u*b1.hi_x + w*b1.hi_y);
+		angle = PositiveAngleBetween(begin, end, n);
+	}
+
+	// the estimate GetArcExtent replaced: the points projected and normalized, their barycenter as the middle of the arc,
+	// and the ends as the points at the largest angles from it on either side (three passes, an acos per point).
+	static void ArcExtentByBarycenter(const std::vector<float3>& points, float3 center, float3 axis, float3& begin, float& angle) {
+		std::vector<float3> projected(points.size());
+		for (size_t k = 0; k < points.size(); k++) projected[k] = Normalize(Cross(Cross(axis, points[k] - center), axis));
+
+		float3 middle = Normalize(std::accumulate(projected.begin(), projected.end(), float3(), [](float3 a, float3 b) { return a + b; }) / float(projected.size()));
+
+		std::vector<float> angles;
+		angles.reserve(projected.size());
+		// acosf of a dot rounded above 1 is NaN, which minmax_element does not order (the old code lost up to 0.015 rad.
+		// to it): those points are at the middle.
+		for (const float3& p : projected) {
+			float a = AngleBetween(p, middle, axis);
+			angles.push_back(a == a ? a : 0.f);
+		}
+
+		auto minmax = std::minmax_element(angles.begin(), angles.end());
+		begin = projected[minmax.second - angles.begin()];
+		angle = PositiveAngleBetween(begin, projected[minmax.first - angles.begin()], axis);
+	}
+
+	// an elbow of radii 0.3 and 0.05 m. around a tilted axis (center, axis), starting at a random angle; tube noise 1 mm.
+	static std::vector<float3> MakeElbow(std::mt19937& random, float arc, int count, float3 center, float3 axis) {
+		std::uniform_real_distribution<float> uniform(0.f, 1.f);
+		std::normal_distribution<float> noise(0.f, 1.f);
+		float3 u = Normalize(Cross(float3{ 1, 0, 0 }, axis));
+		float3 w = Cross(axis, u);
+		float start = uniform(random)*2.f*PI;
+
+		std::vector<float3> points(count);
+		for (float3& p : points) {
+			float t = start + uniform(random)*arc, s = uniform(random)*2.f*PI;
+			float3 radial = u*cosf(t) + w*sinf(t);
+			p = center + radial*(0.3f + 0.05f*cosf(s)) + axis*(0.05f*sinf(s)) + float3{ noise(random), noise(random), noise(random) }*0.001f;
+		}
+		return points;
+	}
+
+	bool CheckArcExtent() {
+		static const int POINTS = 20000, ELBOWS = 20;
+		static const float ARCS[] = { 0.3f, 0.8f, 1.57f, 2.2f, 2.8f };
+		static const float TOLERANCE = 0.001f; // rad., for the angle and for the direction where the arc starts
+
+		std::mt19937 random(7);
+		float3 center = { 0.1f, -0.2f, 1.2f };
+		float3 axis = Normalize(float3{ 0.3f, 1.f, -0.4f });
+		int failed = 0;
+		float worst = 0.f;
+		for (float arc : ARCS) {
+			for (int k = 0; k < ELBOWS; k++) {
+				std::vector<float3> points = MakeElbow(random, arc, POINTS, center, axis);
+				float3 begin[2];
+				float angle[2];
+				GetArcExtent(points.data(), points.size(), sizeof(float3), center, axis, begin[0], angle[0]);
+				ArcExtentByBarycenter(points, center, axis, begin[1], angle[1]);
+
+				float difference = max(fabsf(angle[0] - angle[1]), acosf(clamp(Dot(begin[0], begin[1]), -1.f, 1.f)));
+				worst = max(worst, difference);
+				if (difference > TOLERANCE) {
+					fprintf(stdout, "Arc extent: arc %.2f, elbow %d: %.4f rad. against %.4f rad. (off by %.4f)\n", arc, k, angle[0], angle[1], difference);
+					failed++;
+				}
+			}
+		}
+		fprintf(stdout, "Arc extent check: %d of %d elbows (arcs 0.3 to 2.8) within %.3f rad. of the three-pass estimate (worst %.4f).\n",
+			int(sizeof(ARCS) / sizeof(ARCS[0]))*ELBOWS - failed, int(sizeof(ARCS) / sizeof(ARCS[0]))*ELBOWS, TOLERANCE, worst);
+		return failed == 0;
+	}
+
+	void BenchmarkArcExtent() {
+		static const int POINTS = 200000, REPEAT = 10;
+		static const float ARCS[] = { 0.3f, 0.8f, 1.57f, 2.2f, 2.8f, 4.5f };
+
+		std::mt19937 random(5);
+		float3 center = { 0.1f, -0.2f, 1.2f };
+		float3 axis = Normalize(float3{ 0.3f, 1.f, -0.4f });
+
+		fprintf(stdout, "Arc extent (%d points on an elbow, tube noise 1 mm., %d runs)\n", POINTS, REPEAT);
+		fprintf(stdout, "     arc   single pass (error, ms)   barycenter (error, ms)   speedup\n");
+		for (float arc : ARCS) {
+			std::vector<float3> points = MakeElbow(random, arc, POINTS, center, axis);
+
+			float3 begin;
+			float angle[2] = {};
+			double ms[2] = {};
+			for (int method = 0; method < 2; method++) {
+				auto t0 = std::chrono::steady_clock::now();
+				for (int k = 0; k < REPEAT; k++) {
+					if (method == 0) GetArcExtent(points.data(), points.size(), sizeof(float3), center, axis, begin, angle[0]);
+					else ArcExtentByBarycenter(points, center, axis, begin, angle[1]);
+				}
+				ms[method] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count() / REPEAT;
+			}
+			fprintf(stdout, "%8.2f   %12.4f %10.2f   %12.4f %10.2f %8.1fx\n", arc,
+				fabsf(angle[0] - arc), ms[0], fabsf(angle[1] - arc), ms[1], ms[1] / max(ms[0], 1e-9));
+		}
+		fprintf(stdout, "(error: from the true arc, in rad.; the noise at the ends widens both estimates)\n");
+	}
+}
@@ -6,15 +6,42 @@
 namespace sgeometry {
 	using namespace smath;
 
+	// levels of detail of the primitive meshes (0: the coarsest one).
+	static const int LOD_COUNT = 3;
+	static const int SPHERE_LOD[LOD_COUNT] = { 1, 2, 3 };			// subdivision levels
+	static const int CYLINDER_SUBDIV[LOD_COUNT] = { 12, 24, 36 };	// segments around the axis
+	static const int TOROIDAL_SUBDIV[LOD_COUNT] = { 12, 24, 36 };	// segments around the torus axis
+	static const int POLOIDAL_SUBDIV[LOD_COUNT] = { 6, 8, 10 };		// segments around the tube
+	static const float LOD_SCREEN_SIZE[LOD_COUNT - 1] = { 48.f, 160.f }; // projected diameter (in pixels) to switch to the next level
+
 	// Create a vertex array of sphere to be drawn in wireframe mode. (xyz only)
 	// It will be a unit sphere located at the origin (0, 0, 0).
 	void CreateSphereVertexData(std::vector<float3>& vertices, std::vector<unsigned int>& indices, int LOD = 4);
 
 	// Its center will be located at the origin (0, 0, 0) and its length is 2 and radius is 1.
-	void CreateCylinderVertexData(std::vector<float3>& vertices, std::vector<unsigned int>& indices);
+	void CreateCylinderVertexData(std::vector<float3>& vertices, std::vector<unsigned int>& indices, int subdiv = 36);
 
 	/* about terminology: https://en.wikipedia.org/wiki/Torus */
-	// Its center will be located at the origin (0, 0, 0) and mean radius is 1 and tube radius is 0.5.
-	// Its axis is (0, 1, 0)
-	void CreateTorusVertexData(std::vector<float3>& vertices, std::vector<unsigned int>& indices);
+	// Its center will be located at the origin (0, 0, 0) and its axis is (0, 1, 0).
+	// Vertices are (toroidal fraction, cos, sin of poloidal angle); the radii and the arc angle are applied in the vertex shader.
+	void CreateTorusVertexData(std::vector<float3>& vertices, std::vector<unsigned int>& indices, int toroidal_subdiv = 36, int poloidal_subdiv = 10);
+
+	// Pick a level of detail for an object of the given bounding diameter on screen (in pixels).
+	inline int SelectLOD(float screen_size) {
+		int lod = 0;
+		while (lod < LOD_COUNT - 1 && screen_size > LOD_SCREEN_SIZE[lod]) lod++;
+		return lod;
+	}
+
+	// Find the angular extent of points lying on a partial torus (e.g. an elbow joint) in a single pass.
+	// Points are read from a strided buffer (stride in bytes, 0 means tightly packed float3).
+	// begin receives the unit direction (perpendicular to the axis) where the arc starts and
+	// angle receives the counterclockwise angle (around the axis) from begin to where the arc ends.
+	void GetArcExtent(const void* points, size_t count, size_t stride, float3 center, float3 axis, float3& begin, float& angle);
+
+	// GetArcExtent against the three-pass estimate it replaced, on synthetic elbows of several arcs: errors and times.
+	void BenchmarkArcExtent();
+	// true if GetArcExtent agrees with the three-pass estimate (within 0.001 rad.) on synthetic elbows of arcs below pi,
+	// where that one holds (its barycenter leaves the arc beyond).
+	bool CheckArcExtent();
 }
\ No newline at end of file
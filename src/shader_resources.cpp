@@ -11,24 +11,35 @@ void ShaderSource::init() {
 #version 430
 
 layout(location = 0) in vec3 pos;
+layout(location = 2) in vec4 model_row0; // per-instance model matrix (row-major)
+layout(location = 3) in vec4 model_row1;
+layout(location = 4) in vec4 model_row2;
+layout(location = 5) in vec4 model_row3;
+layout(location = 6) in vec4 params;
+layout(location = 7) in vec4 color;
+
+flat out vec3 frag_color;
 
-uniform vec3 quad[6]; // ll lr ur ll ur ul
 uniform mat4 view_matrix;
 uniform mat4 projection_matrix;
 
 void main() {
-	gl_Position = projection_matrix*view_matrix*vec4(quad[gl_VertexID], 1);	
+	vec2 quad[6] = vec2[6](vec2(0, 0), vec2(1, 0), vec2(1, 1), vec2(0, 0), vec2(1, 1), vec2(0, 1)); // ll lr ur ll ur ul
+	mat4 model_matrix = transpose(mat4(model_row0, model_row1, model_row2, model_row3));
+	frag_color = color.rgb;
+	gl_Position = projection_matrix*view_matrix*model_matrix*vec4(quad[gl_VertexID], 0, 1);
 }
 )";
 
 	fs_src["plane"] = R"(
 #version 430
-out vec4 fragcolor;
 
-uniform vec3 color;
+flat in vec3 frag_color;
+
+out vec4 fragcolor;
 
 void main() {
-	fragcolor = vec4(color, 1);
+	fragcolor = vec4(frag_color, 1);
 }
 )";
 
@@ -36,25 +47,37 @@ void main() {
 #version 430
 
 layout(location = 0) in vec3 pos;
+layout(location = 2) in vec4 model_row0; // per-instance model matrix (row-major)
+layout(location = 3) in vec4 model_row1;
+layout(location = 4) in vec4 model_row2;
+layout(location = 5) in vec4 model_row3;
+layout(location = 6) in vec4 params;
+layout(location = 7) in vec4 color;
+
+flat out vec3 frag_color;
+out vec3 view_pos; // for the shaded variant (benchmark_geometry)
 
-uniform mat4 model_matrix;
 uniform mat4 view_matrix;
 uniform mat4 projection_matrix;
 
 void main() {
-	gl_Position = projection_matrix*view_matrix*model_matrix*vec4(pos, 1);
+	mat4 model_matrix = transpose(mat4(model_row0, model_row1, model_row2, model_row3));
+	frag_color = color.rgb;
+	vec4 view = view_matrix*model_matrix*vec4(pos, 1);
+	view_pos = view.xyz;
+	gl_Position = projection_matrix*view;
 }
 )";
 
 	fs_src["sphere"] = R"(
 #version 430
 
-out vec4 fragcolor;
+flat in vec3 frag_color;
 
-uniform vec3 color;
+out vec4 fragcolor;
 
 void main() {
-	fragcolor = vec4(color, 1);
+	fragcolor = vec4(frag_color, 1);
 }
 )";
 
@@ -62,25 +85,37 @@ void main() {
 #version 430
 
 layout(location = 0) in vec3 pos;
+layout(location = 2) in vec4 model_row0; // per-instance model matrix (row-major)
+layout(location = 3) in vec4 model_row1;
+layout(location = 4) in vec4 model_row2;
+layout(location = 5) in vec4 model_row3;
+layout(location = 6) in vec4 params;
+layout(location = 7) in vec4 color;
+
+flat out vec3 frag_color;
+out vec3 view_pos; // for the shaded variant (benchmark_geometry)
 
-uniform mat4 model_matrix;
 uniform mat4 view_matrix;
 uniform mat4 projection_matrix;
 
 void main() {
-	gl_Position = projection_matrix*view_matrix*model_matrix*vec4(pos, 1);
+	mat4 model_matrix = transpose(mat4(model_row0, model_row1, model_row2, model_row3));
+	frag_color = color.rgb;
+	vec4 view = view_matrix*model_matrix*vec4(pos, 1);
+	view_pos = view.xyz;
+	gl_Position = projection_matrix*view;
 }
 )";
 
 	fs_src["cylinder"] = R"(
 #version 430
 
-out vec4 fragcolor;
+flat in vec3 frag_color;
 
-uniform vec3 color;
+out vec4 fragcolor;
 
 void main() {
-	fragcolor = vec4(color, 1);
+	fragcolor = vec4(frag_color, 1);
 }
 )";
 
@@ -88,31 +123,59 @@ void main() {
 #version 430
 
 layout(location = 0) in vec3 pos;
+layout(location = 2) in vec4 model_row0; // per-instance model matrix (row-major)
+layout(location = 3) in vec4 model_row1;
+layout(location = 4) in vec4 model_row2;
+layout(location = 5) in vec4 model_row3;
+layout(location = 6) in vec4 params;
+layout(location = 7) in vec4 color;
+
+flat out vec3 frag_color;
+out vec3 view_pos; // for the shaded variant (benchmark_geometry)
 
-uniform float bottom_radius;
-uniform float top_radius;
-uniform mat4 model_matrix;
 uniform mat4 view_matrix;
 uniform mat4 projection_matrix;
 
 void main() {
+	float top_radius = params.x;
+	float bottom_radius = params.y;
 	float height = (pos.y+1.0)*0.5;
 	float interpolated_radius = mix(top_radius, bottom_radius, height);
 	vec3 position = interpolated_radius*vec3(pos.x, 0, pos.z);
 	position.y = pos.y;
-	gl_Position = projection_matrix*view_matrix*model_matrix*vec4(position, 1);
+	mat4 model_matrix = transpose(mat4(model_row0, model_row1, model_row2, model_row3));
+	frag_color = color.rgb;
+	vec4 view = view_matrix*model_matrix*vec4(position, 1);
+	view_pos = view.xyz;
+	gl_Position = projection_matrix*view;
 }
 )";
 
 	fs_src["cone"] = R"(
 #version 430
 
+flat in vec3 frag_color;
+
 out vec4 fragcolor;
 
-uniform vec3 color;
+void main() {
+	fragcolor = vec4(frag_color, 1);
+}
+)";
+
+	// the sphere, cylinder and cone meshes filled and shaded as the impostors are, to time both alike (benchmark_geometry).
+	fs_src["mesh_shaded"] = R"(
+#version 430
+
+flat in vec3 frag_color;
+in vec3 view_pos;
+
+out vec4 fragcolor;
 
 void main() {
-	fragcolor = vec4(color, 1);
+	vec3 normal = normalize(cross(dFdx(view_pos), dFdy(view_pos))); // of the triangle
+	float shade = 0.3 + 0.7*abs(normal.z); // orthographic: the rays run along z
+	fragcolor = vec4(frag_color*shade, 1);
 }
 )";
 
@@ -120,17 +183,27 @@ void main() {
 #version 430
 
 layout(location = 0) in vec3 pos;
+layout(location = 2) in vec4 model_row0; // per-instance model matrix (row-major)
+layout(location = 3) in vec4 model_row1;
+layout(location = 4) in vec4 model_row2;
+layout(location = 5) in vec4 model_row3;
+layout(location = 6) in vec4 params;
+layout(location = 7) in vec4 color;
+
+flat out vec3 frag_color;
 
-uniform float mean_radius;
-uniform float tube_radius;
-uniform mat4 model_matrix;
 uniform mat4 view_matrix;
 uniform mat4 projection_matrix;
 
 void main() {
-	vec3 toroidal_direction = normalize(vec3(pos.x, 0, pos.z));
-	vec3 poloidal_direction = normalize(pos-toroidal_direction);
+	float mean_radius = params.x;
+	float tube_radius = params.y;
+	float phi = pos.x*params.z; // toroidal fraction * arc angle
+	vec3 toroidal_direction = vec3(cos(phi), 0, -sin(phi));
+	vec3 poloidal_direction = pos.y*toroidal_direction + vec3(0, pos.z, 0);
 	vec3 position = mean_radius*toroidal_direction+tube_radius*poloidal_direction;
+	mat4 model_matrix = transpose(mat4(model_row0, model_row1, model_row2, model_row3));
+	frag_color = color.rgb;
 	gl_Position = projection_matrix*view_matrix*model_matrix*vec4(position, 1);
 }
 )";
@@ -138,12 +211,137 @@ void main() {
 	fs_src["torus"] = R"(
 #version 430
 
+flat in vec3 frag_color;
+
 out vec4 fragcolor;
 
-uniform vec3 color;
+void main() {
+	fragcolor = vec4(frag_color, 1);
+}
+)";
+
+	vs_src["impostor"] = R"(
+#version 430
+
+layout(location = 2) in vec4 model_row0; // per-instance model matrix (row-major)
+layout(location = 3) in vec4 model_row1;
+layout(location = 4) in vec4 model_row2;
+layout(location = 5) in vec4 model_row3;
+layout(location = 6) in vec4 params; // w: 0 (sphere), 1 (cylinder), 2 (cone)
+layout(location = 7) in vec4 color;
+
+flat out vec3 frag_color;
+flat out vec4 frag_params;
+flat out mat4 inverse_model_view;
+noperspective out vec4 ray_near; // view space (homogeneous), interpolated linearly on screen
+noperspective out vec4 ray_far;
+
+uniform mat4 view_matrix;
+uniform mat4 projection_matrix;
+
+void main() {
+	vec2 quad[6] = vec2[6](vec2(0, 0), vec2(1, 0), vec2(1, 1), vec2(0, 0), vec2(1, 1), vec2(0, 1));
+	mat4 model_matrix = transpose(mat4(model_row0, model_row1, model_row2, model_row3));
+	mat4 model_view = view_matrix*model_matrix;
+	mat4 mvp = projection_matrix*model_view;
+
+	// the unit shapes fit in [-1, 1]^3 except cones, whose radii are not in the model matrix.
+	float radius = int(params.w) == 2 ? max(params.x, params.y) : 1.0;
+	vec3 extent = vec3(radius, 1, radius);
+
+	// screen-aligned bounds of the projected bounding box
+	vec3 lo = vec3(1e30), hi = vec3(-1e30);
+	for (int k = 0; k < 8; k++) {
+		vec3 corner = extent*vec3((k & 1) == 0 ? -1 : 1, (k & 2) == 0 ? -1 : 1, (k & 4) == 0 ? -1 : 1);
+		vec4 clip = mvp*vec4(corner, 1);
+		vec3 ndc = clip.xyz/clip.w;
+		lo = min(lo, ndc);
+		hi = max(hi, ndc);
+	}
+	vec2 ndc = mix(lo.xy, hi.xy, quad[gl_VertexID]);
+
+	mat4 inverse_projection = inverse(projection_matrix);
+	ray_near = inverse_projection*vec4(ndc, -1, 1);
+	ray_far = inverse_projection*vec4(ndc, 1, 1);
+
+	frag_color = color.rgb;
+	frag_params = params;
+	inverse_model_view = inverse(model_view);
+	gl_Position = vec4(ndc, max(lo.z, -1.0), 1);
+}
+)";
+
+	fs_src["impostor"] = R"(
+#version 430
+
+flat in vec3 frag_color;
+flat in vec4 frag_params;
+flat in mat4 inverse_model_view;
+noperspective in vec4 ray_near;
+noperspective in vec4 ray_far;
+
+out vec4 fragcolor;
+
+uniform mat4 projection_matrix;
+
+int shape;
+float a, b; // radius along the axis of a cylinder or a cone: a+b*y
+
+bool on_surface(float t, vec3 p) {
+	if (t < 0.0 || t > 1.0) return false; // outside of the near/far planes
+	if (shape == 0) return true;
+	return abs(p.y) <= 1.0 && a + b*p.y >= 0.0;
+}
 
 void main() {
-	fragcolor = vec4(color, 1);
+	vec3 near = ray_near.xyz/ray_near.w;
+	vec3 far = ray_far.xyz/ray_far.w;
+
+	// the ray in model space; t is the same in view and model space (affine transform).
+	vec3 o = (inverse_model_view*vec4(near, 1)).xyz;
+	vec3 d = (inverse_model_view*vec4(far, 1)).xyz - o;
+
+	shape = int(frag_params.w);
+	a = 1.0; b = 0.0;
+	if (shape == 2) { a = 0.5*(frag_params.x + frag_params.y); b = 0.5*(frag_params.y - frag_params.x); }
+
+	float A, B, C;
+	if (shape == 0) {
+		A = dot(d, d);
+		B = 2.0*dot(o, d);
+		C = dot(o, o) - 1.0;
+	}
+	else {
+		float r = a + b*o.y;
+		A = d.x*d.x + d.z*d.z - b*b*d.y*d.y;
+		B = 2.0*(o.x*d.x + o.z*d.z - r*b*d.y);
+		C = o.x*o.x + o.z*o.z - r*r;
+	}
+
+	float D = B*B - 4.0*A*C;
+	if (D < 0.0 || abs(A) < 1e-12) discard;
+
+	float s = sqrt(D);
+	float t0 = (-B - s)/(2.0*A);
+	float t1 = (-B + s)/(2.0*A);
+	if (t0 > t1) { float t = t0; t0 = t1; t1 = t; }
+
+	// the nearest hit (tubes are open, so the inner side can be seen through the ends)
+	float t = t0;
+	vec3 p = o + t*d;
+	if (!on_surface(t, p)) {
+		t = t1;
+		p = o + t*d;
+		if (!on_surface(t, p)) discard;
+	}
+
+	vec3 normal = shape == 0 ? p : vec3(p.x, -b*(a + b*p.y), p.z);
+	normal = normalize(normal*mat3(inverse_model_view)); // inverse transpose
+	float shade = 0.3 + 0.7*abs(dot(normal, normalize(far - near)));
+	fragcolor = vec4(frag_color*shade, 1);
+
+	vec4 clip = projection_matrix*vec4(mix(near, far, t), 1);
+	gl_FragDepth = 0.5*(clip.z/clip.w) + 0.5;
 }
 )";
 
@@ -152,17 +350,22 @@ void main() {
 
 layout(location = 0) in vec3 pos;
 layout(location = 1) in uvec3 color;
+layout(location = 2) in vec3 normal;
 
 out vec3 frag_color;
 
 uniform mat4 view_matrix;
 uniform mat4 projection_matrix;
+uniform bool shaded;
 
 void main() {
 	gl_PointSize = 2;
 	gl_Position = projection_matrix*view_matrix*vec4(pos, 1);
 	float norm = 1.0/255.0;
 	frag_color=vec3(color*norm);
+
+	// lit from the eye, where the normal is known.
+	if (shaded && dot(normal, normal) > 0) frag_color *= 0.3 + 0.7*abs(normalize(mat3(view_matrix)*normal).z);
 }
 )";
 
@@ -208,6 +411,39 @@ uniform sampler2D color_texture;
 void main() {
 	frag_color = texture(color_texture, tex);
 }
+)";
+
+	// the same quad, for textures rendered by OpenGL (whose first row is the bottom one).
+	vs_src["inset"] = R"(
+#version 430
+
+out vec2 tex;
+
+void main() {
+	vec2 vertices[6];
+	vertices[0] = vec2(-1,  1);
+	vertices[1] = vec2(-1, -1);
+	vertices[2] = vec2( 1, -1);
+	vertices[3] = vec2(-1,  1);
+	vertices[4] = vec2( 1, -1);
+	vertices[5] = vec2( 1,  1);
+	
+	tex = 0.5*vertices[gl_VertexID] + 0.5;
+	gl_Position = vec4(vertices[gl_VertexID], 0, 1);
+}
+)";
+
+	fs_src["inset"] = R"(
+#version 430
+
+in vec2 tex;
+out vec4 frag_color;
+
+uniform sampler2D inset_texture;
+
+void main() {
+	frag_color = texture(inset_texture, tex);
+}
 )";
 
 }
\ No newline at end of file
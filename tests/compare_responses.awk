@@ -0,0 +1,39 @@
+# compares the responses (the second file) with the expected lines (the first file), token by token. an expected token
+# is the same as the response, "*" (anything), or "key=v1,v2,..." where each value is the same, "*", or a number
+# within a tolerance ("3~0.01").
+NR == FNR { expected[FNR] = $0; lines = FNR; next }
+{
+	if (!match_line(expected[FNR], $0)) {
+		printf "line %d: expected \"%s\"\n        got      \"%s\"\n", FNR, expected[FNR], $0
+		failed++
+	}
+	responses = FNR
+}
+END {
+	if (responses != lines) { printf "%d responses for %d expected lines\n", responses, lines; failed++ }
+	if (failed) exit 1
+	printf "%d responses as expected\n", lines
+}
+
+function match_line(e, g,   et, gt, n, i) {
+	n = split(e, et, " ")
+	if (split(g, gt, " ") != n) return 0
+	for (i = 1; i <= n; i++) if (!match_token(et[i], gt[i])) return 0
+	return 1
+}
+
+function match_token(e, g,   ev, gv, n, i, p) {
+	if (e == g || e == "*") return 1
+	p = index(e, "=")
+	if (p == 0 || substr(e, 1, p) != substr(g, 1, p)) return 0
+	n = split(substr(e, p + 1), ev, ",")
+	if (split(substr(g, p + 1), gv, ",") != n) return 0
+	for (i = 1; i <= n; i++) {
+		if (ev[i] == "*" || ev[i] == gv[i]) continue
+		p = index(ev[i], "~")
+		if (p == 0 || abs(gv[i] - substr(ev[i], 1, p - 1)) > substr(ev[i], p + 1) + 0) return 0
+	}
+	return 1
+}
+
+function abs(x) { return x < 0 ? -x : x }
@@ -0,0 +1,40 @@
+#!/bin/sh
+# two processes: the headless server on a synthetic replay (RealSenseDemo --write-scene) publishing into a ring in shared
+# memory (--shm --shm-points), and tools/ring_reader following it; every result must reach the reader, whole.
+# usage: tests/ring_check.sh [path of RealSenseDemo] [path of ring_reader], from the root of the repository.
+APP=${1:-./RealSenseDemo}
+READER=${2:-./ring_reader}
+COUNT=20
+RING=/findsurface_check_$$
+TMP=$(mktemp -d) || exit 1
+trap 'rm -rf "$TMP"' EXIT
+
+"$APP" --write-scene "$TMP/scene.rsr" 30 || exit 1
+echo "replay $TMP/scene.rsr" > "$TMP/rig.txt"
+
+"$READER" $RING $COUNT > "$TMP/results.txt" 2> "$TMP/reader.txt" &
+READER_PID=$!
+
+# the reader follows the ring from its head once mapped: the requests wait for it.
+{
+	k=0
+	while ! grep -q mapped "$TMP/reader.txt" && [ $k -lt 100 ]; do sleep 0.1; k=$((k + 1)); done
+	k=0
+	while [ $k -lt $COUNT ]; do echo "point 0.1 0 1.2 sphere accuracy=0.004 mean_dist=0.01 touch_r=0.08"; k=$((k + 1)); done
+} | "$APP" --headless --shm $RING --shm-points "$TMP/rig.txt" > "$TMP/responses.txt"
+
+k=0
+while kill -0 $READER_PID 2> /dev/null && [ $k -lt 20 ]; do sleep 0.1; k=$((k + 1)); done
+kill -INT $READER_PID 2> /dev/null
+wait $READER_PID
+
+echo "ring check:"
+grep -v "^waiting" "$TMP/reader.txt"
+RESULTS=$(grep -c "^#" "$TMP/results.txt")
+TRUNCATED=$(grep -c "truncated" "$TMP/results.txt")
+if [ "$RESULTS" -ne $COUNT ] || [ "$TRUNCATED" -ne 0 ]; then
+	echo "FAIL: $RESULTS of $COUNT results read, $TRUNCATED truncated."
+	head -n 5 "$TMP/responses.txt"
+	exit 1
+fi
+echo "ok: $COUNT results read."
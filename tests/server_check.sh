@@ -0,0 +1,13 @@
+#!/bin/sh
+# the headless server on a synthetic replay (RealSenseDemo --write-scene): the requests of tests/server/requests.txt
+# on stdin, and each response compared with the same line of tests/server/expected.txt.
+# usage: tests/server_check.sh [path of RealSenseDemo], from the root of the repository.
+APP=${1:-./RealSenseDemo}
+TMP=$(mktemp -d) || exit 1
+trap 'rm -rf "$TMP"' EXIT
+
+"$APP" --write-scene "$TMP/scene.rsr" 30 || exit 1
+echo "replay $TMP/scene.rsr" > "$TMP/rig.txt"
+"$APP" --headless "$TMP/rig.txt" < tests/server/requests.txt > "$TMP/responses.txt" || exit 1
+echo "server check:"
+awk -f tests/compare_responses.awk tests/server/expected.txt "$TMP/responses.txt"
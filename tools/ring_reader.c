@@ -0,0 +1,100 @@
+/* A sample reader of the shared-memory ring of FindSurface results (see src/result_ring.h).
+ * It follows the results as they are published, and measures the latency from publishing to reading.
+ *
+ *		./ring_reader [name] [count]		(default: /findsurface; Ctrl+C, or count results, to print the summary)
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <time.h>
+#include "result_ring.h"
+
+static volatile sig_atomic_t stop = 0;
+static void on_signal(int sig) { (void)sig; stop = 1; }
+
+static double now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static int compare(const void* a, const void* b) {
+	double x = *(const double*)a, y = *(const double*)b;
+	return x < y ? -1 : x > y;
+}
+
+int main(int argc, char* argv[]) {
+	static const char* type_names[] = { "none", "any", "plane", "sphere", "cylinder", "cone", "torus" };
+	const char* name = argc > 1 ? argv[1] : FS_RING_DEFAULT_NAME;
+	size_t limit = argc > 2 ? (size_t)strtoul(argv[2], NULL, 10) : 0;
+	const fs_ring_header* ring;
+	uint64_t next = 0, skipped = 0, torn = 0, truncated = 0;
+	size_t count = 0, capacity = 1024;
+	double* latencies = (double*)malloc(capacity * sizeof(double));
+	struct timespec nap = { 0, 50000 }; /* 50 us */
+
+	signal(SIGINT, on_signal);
+
+	while ((ring = fs_ring_map(name)) == NULL) {
+		if (stop) return EXIT_FAILURE;
+		fprintf(stderr, "waiting for %s...\n", name);
+		sleep(1);
+	}
+	next = fs_ring_head(ring);
+	fprintf(stderr, "mapped %s: %u slots of %u points.\n", name, ring->slot_count, ring->max_points);
+
+	while (!stop) {
+		uint64_t head = fs_ring_head(ring);
+		if (next == head) { nanosleep(&nap, NULL); continue; }
+
+		/* the slots older than slot_count have been overwritten. */
+		if (head - next > ring->slot_count) {
+			skipped += head - ring->slot_count - next;
+			next = head - ring->slot_count;
+		}
+
+		for (; next < head && !stop; next++) {
+			const fs_ring_slot* slot = fs_ring_slot_at(ring, next);
+			uint32_t seq;
+			double read_time = now_ms(), latency;
+			uint32_t type, inliers, inlier_total, flags, first_inlier;
+			float center[3];
+
+			if (!fs_ring_read_begin(slot, &seq) || slot->index != next) { torn++; continue; }
+			latency = read_time - slot->timestamp;
+			type = slot->type;
+			inliers = slot->inlier_count;
+			inlier_total = slot->inlier_total;
+			flags = slot->flags;
+			first_inlier = inliers > 0 ? fs_ring_inliers(slot)[0] : 0;
+			center[0] = slot->center[0]; center[1] = slot->center[1]; center[2] = slot->center[2];
+			if (!fs_ring_read_end(slot, seq)) { torn++; continue; }
+
+			/* a truncated slot holds the first inliers (or points) only. */
+			if (flags & FS_RING_TRUNCATED) truncated++;
+			printf("#%llu %s inliers=%u%s (first %u) center=<%.4f, %.4f, %.4f> latency=%.3fms\n",
+				(unsigned long long)next, type < 7 ? type_names[type] : "?", inlier_total, flags & FS_RING_TRUNCATED ? " (truncated)" : "",
+				first_inlier, center[0], center[1], center[2], latency);
+			fflush(stdout);
+
+			if (count == capacity) latencies = (double*)realloc(latencies, (capacity *= 2) * sizeof(double));
+			latencies[count++] = latency;
+			if (count == limit) stop = 1;
+		}
+	}
+
+	if (count > 0) {
+		double sum = 0;
+		size_t k;
+		for (k = 0; k < count; k++) sum += latencies[k];
+		qsort(latencies, count, sizeof(double), compare);
+		fprintf(stderr, "%zu results (%llu skipped, %llu torn, %llu truncated): latency min %.3f, mean %.3f, p99 %.3f, max %.3f ms.\n",
+			count, (unsigned long long)skipped, (unsigned long long)torn, (unsigned long long)truncated,
+			latencies[0], sum / count, latencies[(count * 99) / 100], latencies[count - 1]);
+	}
+
+	free(latencies);
+	fs_ring_unmap(ring);
+	return EXIT_SUCCESS;
+}